@@ -1,8 +1,14 @@
 // main.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "stl.h"
+#include "stl_batch.h"
 
 // return the root name if a file
 static const char* short_name(const char* name)
@@ -19,47 +25,58 @@ static const char* short_name(const char* name)
 
 std::vector<float> Pyramid_vectors =
 {
+    // the triangles are counter clockwise seen from outside
+    // so calc_normals points the normals outwards
+
     // front triangle
     0, -1, 0,       // top
-    -1, 0, 1,     	// left front
     1, 0, 1,     	// right front
+    -1, 0, 1,     	// left front
 
     // right triangle
     0, -1, 0,       // top
-    1, 0, 1,     	// right front
     1, 0, -1,       // right back
+    1, 0, 1,     	// right front
 
     // back triangle
     0, -1, 0,       // top
-    1, 0, -1,  	    // right back
     -1, 0, -1,   	// left back
+    1, 0, -1,  	    // right back
 
     // left triangle
     0, -1, 0,       // top
-    -1, 0, -1,      // left back
-    -1, 0, 1        // left front 
+    -1, 0, 1,       // left front
+    -1, 0, -1       // left back
 };
 
 int main(int argc, char* argv[])
 {
-    stl stlfile;
-    for (auto arg = 1; arg < argc; ++arg) {
-        try {
-            stlfile.read_stl(argv[arg]);
-        } catch (const std::exception& ex) {
-            std::cerr << "Error in read_stl: " << ex.what() << std::endl;
-            return 1;
-        } catch (...) {
-            std::cerr << "Unknown error in read_stl." << std::endl;
+    stl_batch_loader loader;
+    try {
+        loader.load(std::vector<std::string>(argv + std::min(argc, 1), argv + argc));
+    } catch (const std::exception& ex) {
+        std::cerr << "Error in read_stl: " << ex.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "Unknown error in read_stl." << std::endl;
+        return 1;
+    }
+
+    for (auto& result : loader.m_results) {
+        if (!result.mesh) {
+            std::cerr << "Error in read_stl: " << result.error << std::endl;
             return 1;
         }
 
-        std::cout << "[" << std::setw(20) << short_name(argv[arg]) << "]  " <<
-            " Triangles " << stlfile.m_num_triangles <<
-            " Vectors " << stlfile.m_vectors.size() <<
-            " Normals " << stlfile.m_normals.size() <<
-            " RGBColors " << stlfile.m_rgb_color.size() << "\n";
+        std::cout << "[" << std::setw(20) << short_name(result.name.c_str()) << "]  " <<
+            " Triangles " << result.mesh->m_num_triangles <<
+            " Vectors " << result.mesh->m_vectors.size() <<
+            " Normals " << result.mesh->m_normals.size() <<
+            " RGBColors " << result.mesh->m_rgb_color.size() << "\n";
     }
+    loader.clear();
+
+    stl stlfile;
 
     stlfile.m_num_triangles = 0;
     stlfile.m_vectors.clear();
@@ -0,0 +1,123 @@
+// mapped_file.cpp : read only memory mapped files
+//
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+// open
+// map the whole file read only
+// throws if the file can not be opened or mapped
+bool mapped_file::open(const char* name)
+{
+    close();
+
+#ifdef _WIN32
+    auto file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+    m_file = file;
+    m_size = static_cast<size_t>(size.QuadPart);
+    m_open = true;
+
+    // an empty file can not be mapped
+    if (m_size == 0) {
+        return true;
+    }
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr) {
+        close();
+        throw std::runtime_error(std::string("Unable to map stl input file ") + name + ".");
+    }
+    m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        close();
+        throw std::runtime_error(std::string("Unable to map stl input file ") + name + ".");
+    }
+#else
+    auto fd = ::open(name, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    m_open = true;
+
+    // an empty file can not be mapped
+    if (m_size == 0) {
+        ::close(fd);
+        return true;
+    }
+
+    auto data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        m_size = 0;
+        m_open = false;
+        throw std::runtime_error(std::string("Unable to map stl input file ") + name + ".");
+    }
+    m_data = static_cast<const char*>(data);
+
+    // files are read front to back
+    posix_madvise(data, m_size, POSIX_MADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+// close
+// unmap the file
+void mapped_file::close()
+{
+#ifdef _WIN32
+    if (m_data != nullptr) {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping != nullptr) {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != nullptr) {
+        CloseHandle(m_file);
+    }
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_data != nullptr) {
+        munmap(const_cast<char*>(m_data), m_size);
+    }
+#endif
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
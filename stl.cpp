@@ -2,16 +2,24 @@
 // Written by Paul Baxter
 //
 #include <cctype>
+#include <charconv>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <string>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <fstream>
+#include <future>
 #include <stdexcept>
 #include <sstream>
 
 #include "stl.h"
+#include "stl_cache.h"
+#include "stl_parallel.h"
+#include "stl_pipe.h"
+#include "stl_simd.h"
 
 // Binary STL
 //
@@ -38,9 +46,23 @@
 // endfacet
 // endsolid name
 
+// free the memory of a vector
+// the empty vector keeps the memory resource
+static void release(stl_float_vector& values)
+{
+    stl_float_vector(values.get_allocator()).swap(values);
+}
+
 // class constructor
 // initialize member variables
-stl::stl()
+stl::stl() : stl(std::pmr::get_default_resource())
+{
+}
+
+// class constructor
+// allocate the vectors from resource
+stl::stl(std::pmr::memory_resource* resource) :
+    m_vectors(resource), m_x(resource), m_y(resource), m_z(resource), m_normals(resource), m_rgb_color(resource)
 {
     // this will initialize all member variables
     cleanup();
@@ -49,59 +71,199 @@ stl::stl()
 // read_stl
 // read a stl file 
 // handles both binary and ascii versions
+// the file is memory mapped and parsed in place
 int stl::read_stl(const char* name)
 {
     auto result = 0;
 
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
+
     // by calling cleanup
     // multiple stls can be read 1 at a time in the same instance
     cleanup();
     m_name = std::string(name);
-    if (!open_ascii()) {
+
+    // overlapped reads stream the file instead of mapping it
+    // the cache needs the whole file for its hash
+    if (m_overlapped_io && m_cache_mode == stl_cache_off) {
+        if (read_pipelined(name)) {
+            return result;
+        }
         cleanup();
-        return -1;
     }
 
-    // if 1st token is not 'solid' then its a binary stl
-    get_next_token();
-    if (strcmp(m_token, "solid") != 0) {
-        if (!open_binary()) {
-            cleanup();
-            return -1;
+    mapped_file map;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_open]);
+        map.open(name);
+    }
+    m_size = static_cast<std::streamoff>(map.size());
+    STL_STATS(m_stats.bytes_read = map.size());
+    if (m_size < MIN_STL_LENGTH) {
+        cleanup();
+        throw std::runtime_error(m_name + " invalid stl file.");
+    }
+
+    // a cache made from this exact file replaces the parse
+    // a quantized cache is lossy and only used when m_cache_quantized
+    // asks for one, otherwise it is a miss and rewritten. An exact cache
+    // serves both, a mesh with non finite coordinates is always cached exact
+    uint64_t hash = 0;
+    if (m_cache_mode != stl_cache_off) {
+        hash = stl_content_hash(map.data(), map.size(), m_num_threads);
+        stl_cache cache;
+        if (cache.open(stl_cache_name(name).c_str()) && cache.matches(hash, map.size()) &&
+            (!cache.quantized() || m_cache_quantized)) {
+            cache.load(*this, m_num_threads);
+            return 0;
         }
-        result = read_binary();
     }
-    else {
-        // read to EOL
-        read_line();
-        // if the line starts with 'facet' then its an ascii stl
-        if (strncmp(m_token, "facet", FACET_NAME_LEN) == 0) {
-            m_stl_input_file.seekg(0, std::ios::beg);
-            result = read_ascii();
+
+    result = read_image(map.data(), map.size());
+    STL_STATS(note_peak(map.size()));
+
+    // the stl has been read, a cache that can not be written is skipped
+    if (m_cache_mode == stl_cache_update) {
+        try {
+            stl_cache::write(stl_cache_name(name).c_str(), *this, hash, map.size(), m_cache_quantized, m_num_threads);
         }
-        else {
-            // the next token MUST be facet for it to be an ascii stl
-            get_next_token();
-            if (strcmp(m_token, "facet") == 0) {
-                m_stl_input_file.seekg(0, std::ios::beg);
-                result = read_ascii();
-            }
-            else {
-                if (!open_binary()) {
-                    cleanup();
-                    return -1;
-                }
+        catch (const std::exception&) {
+        }
+    }
+    return result;
+}
 
-                result = read_binary();
-            }
+// read_stl
+// read a stl image that is already in memory
+// handles both binary and ascii versions, name is used in the errors
+int stl::read_stl(const char* data, size_t size, const char* name)
+{
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
+
+    cleanup();
+    m_name = std::string(name);
+    m_size = static_cast<std::streamoff>(size);
+    STL_STATS(m_stats.bytes_read = size);
+    if (data == nullptr || m_size < MIN_STL_LENGTH) {
+        cleanup();
+        throw std::runtime_error(m_name + " invalid stl file.");
+    }
+    return read_image(data, size);
+}
+
+// read_stl
+// read a stl from a stream opened in binary mode
+// the rest of the stream is read into memory and parsed there
+int stl::read_stl(std::istream& in, const char* name)
+{
+    std::vector<char> image;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_open]);
+        char buffer[1U << 16];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+            image.insert(image.end(), buffer, buffer + in.gcount());
+        }
+    }
+    if (in.bad()) {
+        cleanup();
+        throw std::runtime_error(std::string("Unable to read stl input ") + name + ".");
+    }
+
+#ifdef STL_ENABLE_STATS
+    auto open_seconds = m_stats.seconds[stl_phase_open];
+    auto result = read_stl(image.data(), image.size(), name);
+    m_stats.seconds[stl_phase_open] += open_seconds;
+    m_stats.total_seconds += open_seconds;
+    note_peak(image.capacity());
+    return result;
+#else
+    return read_stl(image.data(), image.size(), name);
+#endif
+}
+
+// read_image
+// find the format of a whole stl image and read it
+int stl::read_image(const char* data, size_t size)
+{
+    auto ascii = false;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_detect]);
+        ascii = detect_ascii(data, size, size);
+    }
+
+    auto result = 0;
+    if (ascii) {
+        result = read_ascii(data, size);
+        if (m_layout == stl_soa) {
+            split_vectors();
         }
     }
-    if (m_stl_input_file.is_open()) {
-        m_stl_input_file.close();
+    else {
+        result = read_binary(data, size);
     }
     return result;
 }
 
+// detect_ascii
+// data holds the first size bytes of a file of file_size bytes
+// a file that matches the 80 + 4 + 50 * n binary layout is binary even if
+// its header starts with solid, only other files are tokenized by is_ascii
+// complete is set to false when the answer depends on bytes past size
+bool stl::detect_ascii(const char* data, size_t size, uint64_t file_size, bool* complete)
+{
+    if (size >= STL_HEADER_SIZE + STL_COUNT_SIZE) {
+        uint32_t num_triangles = 0;
+        memcpy(&num_triangles, data + STL_HEADER_SIZE, sizeof(num_triangles));
+        if (STL_HEADER_SIZE + STL_COUNT_SIZE + static_cast<uint64_t>(num_triangles) * STL_TRIANGLE_SIZE == file_size) {
+            if (complete != nullptr) {
+                *complete = true;
+            }
+            return false;
+        }
+    }
+    else if (size < file_size) {
+        // the layout check needs the triangle count
+        if (complete != nullptr) {
+            *complete = false;
+        }
+        return false;
+    }
+    return is_ascii(data, size, complete);
+}
+
+// is_ascii
+// if 1st token is not 'solid' then its a binary stl
+// the line after 'solid' or the token after it
+// MUST start with facet for it to be an ascii stl
+// data may be the start of the file, complete is then set to false
+// when the answer depends on bytes past size
+bool stl::is_ascii(const char* data, size_t size, bool* complete)
+{
+    stl_ascii_scanner scan(data, data + size);
+    auto decided = [&](bool ascii) {
+        if (complete != nullptr) {
+            *complete = scan.position() < data + size;
+        }
+        return ascii;
+    };
+
+    scan.next_token();
+    if (scan.token_keyword() != stl_ascii_scanner::kw_solid) {
+        return decided(false);
+    }
+
+    // read to EOL
+    scan.read_line();
+    if (scan.token_starts_with("facet", FACET_NAME_LEN)) {
+        return decided(true);
+    }
+
+    scan.next_token();
+    return decided(scan.token_keyword() == stl_ascii_scanner::kw_facet);
+}
+
 // create a binary stl
 // caller should set up
 // m_num_triangles, m_vectors, m_normals and m_rgb_color and m_header
@@ -109,17 +271,67 @@ int stl::read_stl(const char* name)
 //
 int stl::create_stl_binary(const char* name)
 {
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
+
     m_name = std::string(name);
-    if (!open_write_binary()) {
+    auto opened = false;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_open]);
+        opened = open_write_binary();
+    }
+    if (!opened) {
         cleanup();
         return -1;
     }
 
-    if (m_num_triangles * 3LL != m_normals.size() || m_vectors.size() != m_normals.size() * 3LL) {
+    try {
+        write_binary(m_stl_output_file);
+    }
+    catch (...) {
+        m_stl_output_file.close();
+        throw;
+    }
+
+    if (!m_stl_output_file) {
+        m_stl_output_file.close();
+        throw std::runtime_error(std::string("Unable to write stl output file ") + m_name + ".");
+    }
+
+    STL_STATS(m_stats.bytes_written = static_cast<uint64_t>(m_stl_output_file.tellp()));
+
+    if (m_stl_output_file.is_open()) {
+        m_stl_output_file.close();
+    }
+    return 0;
+}
+
+// create a binary stl on a stream
+// the stream should be opened in binary mode
+int stl::create_stl_binary(std::ostream& out)
+{
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
+
+    m_name = "stl stream";
+    STL_STATS(auto start = out.tellp());
+    write_binary(out);
+    if (!out) {
+        throw std::runtime_error("Unable to write stl output stream.");
+    }
+    STL_STATS(m_stats.bytes_written = start < 0 ? 0 : static_cast<uint64_t>(out.tellp() - start));
+    return 0;
+}
+
+// write_binary
+// the header, triangle count and records of a binary stl
+void stl::write_binary(std::ostream& out)
+{
+    if (m_num_triangles * 3LL != m_normals.size() || num_vertices() * AXIS_PER_VERTEX != m_normals.size() * 3LL) {
         std::ostringstream oss;
         oss << "Invalid stl data. "
             << " triangles [" << m_num_triangles << "]"
-            << " vectors [" << m_vectors.size() << "]"
+            << " vectors [" << num_vertices() * AXIS_PER_VERTEX << "]"
             << " normals [" << m_normals.size() << "]"
             << " rgb_colors [" << m_rgb_color.size() << "]";
         cleanup();
@@ -127,42 +339,82 @@ int stl::create_stl_binary(const char* name)
     }
 
     // write header
-    m_stl_output_file.write(reinterpret_cast<char*>(m_header), STL_HEADER_SIZE);
+    out.write(reinterpret_cast<char*>(m_header), STL_HEADER_SIZE);
 
     // write number of triangles
-    m_stl_output_file.write(reinterpret_cast<char*>(&m_num_triangles), sizeof(m_num_triangles));
-
-    unsigned long long normal_index = 0, vertex_index = 0, rgb_index = 0;
-
-    for (uint32_t triangle = 0; triangle < m_num_triangles; triangle++) {
-        // write normals
-        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-            auto a = m_normals[normal_index++];
-            m_stl_output_file.write(reinterpret_cast<char*>(&a), sizeof(a));
+    out.write(reinterpret_cast<char*>(&m_num_triangles), sizeof(m_num_triangles));
+
+    // the triangles are packed into blocks of 50 byte records
+    // and each block is written with a single write
+    auto block_triangles = std::min<size_t>(m_num_triangles, STL_WRITE_BLOCK_TRIANGLES);
+    std::vector<char> blocks[2];
+    blocks[0].resize(block_triangles * STL_TRIANGLE_SIZE);
+
+    if (!m_overlapped_io) {
+        for (size_t first = 0; first < m_num_triangles; first += block_triangles) {
+            auto count = std::min<size_t>(block_triangles, m_num_triangles - first);
+            {
+                STL_STATS_TIME(m_stats.seconds[stl_phase_format]);
+                pack_binary(blocks[0].data(), first, count);
+            }
+            STL_STATS_TIME(m_stats.seconds[stl_phase_write]);
+            out.write(blocks[0].data(), static_cast<std::streamsize>(count * STL_TRIANGLE_SIZE));
         }
-        // write 3 vertices
-        for (auto vert = 0; vert < VERTEX_PER_TRIANGLE; vert++) {
-            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-                auto a = m_vectors[vertex_index++];
-                m_stl_output_file.write(reinterpret_cast<char*>(&a), sizeof(a));
+    }
+    else {
+        // double buffered
+        // one block is written on another thread while the next one is packed
+        blocks[1].resize(blocks[0].size());
+        std::future<void> pending;
+        auto cur = 0;
+        try {
+            for (size_t first = 0; first < m_num_triangles; first += block_triangles) {
+                auto count = std::min<size_t>(block_triangles, m_num_triangles - first);
+                {
+                    STL_STATS_TIME(m_stats.seconds[stl_phase_format]);
+                    pack_binary(blocks[cur].data(), first, count);
+                }
+                if (pending.valid()) {
+                    pending.get();
+                }
+                auto block = blocks[cur].data();
+                pending = std::async(std::launch::async, [this, &out, block, count]() {
+                    STL_STATS_TIME(m_stats.seconds[stl_phase_write]);
+                    out.write(block, static_cast<std::streamsize>(count * STL_TRIANGLE_SIZE));
+                });
+                cur ^= 1;
+            }
+            if (pending.valid()) {
+                pending.get();
             }
         }
+        catch (...) {
+            if (pending.valid()) {
+                pending.wait();
+            }
+            throw;
+        }
+    }
 
+    STL_STATS(note_peak(blocks[0].capacity() + blocks[1].capacity()));
+}
+
+// pack_binary
+// pack triangles first .. first + count - 1 into 50 byte records
+// triangle n uses color n while there are colors left
+void stl::pack_binary(char* dst, size_t first, size_t count) const
+{
+    float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+    for (auto triangle = first; triangle < first + count; ++triangle) {
         uint16_t attribute = 0;
+        auto rgb_index = triangle * AXIS_PER_VERTEX;
         if (rgb_index + 2 < m_rgb_color.size()) {
-            auto r = static_cast<uint16_t>(round(m_rgb_color[rgb_index++] * 128.0f)) & 0x0F;
-            auto g = static_cast<uint16_t>(round(m_rgb_color[rgb_index++] * 128.0f)) & 0x0F;
-            auto b = static_cast<uint16_t>(round(m_rgb_color[rgb_index++] * 128.0f)) & 0x0F;
-
-            attribute = (r << 12) | (g << 8) | (b << 4) | 0x01;
+            attribute = stl_encode_attribute(&m_rgb_color[rgb_index]);
         }
-        m_stl_output_file.write(reinterpret_cast<char*>(&attribute), sizeof(attribute));
-    }
 
-    if (m_stl_output_file.is_open()) {
-        m_stl_output_file.close();
+        stl_pack_triangle(dst, &m_normals[triangle * AXIS_PER_VERTEX], triangle_vertices(triangle, buffer), attribute);
+        dst += STL_TRIANGLE_SIZE;
     }
-    return 0;
 }
 
 // create an ascii stl 
@@ -172,18 +424,74 @@ int stl::create_stl_binary(const char* name)
 //
 int stl::create_stl_ascii(const char* name)
 {
-    long long normal_index = 0, vertex_index = 0;
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
 
     m_name = std::string(name);
-    if (!open_write_ascii()) {
+    auto opened = false;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_open]);
+        opened = open_write_ascii();
+    }
+    if (!opened) {
         cleanup();
         return -1;
     }
 
-    if (m_num_triangles * 3LL != m_normals.size() || m_vectors.size() != m_normals.size() * 3LL) {
-        m_stl_output_file << "Invalid stl data. " <<
+    auto result = 0;
+    try {
+        result = write_ascii(m_stl_output_file, m_name);
+    }
+    catch (...) {
+        m_stl_output_file.close();
+        throw;
+    }
+    if (result != 0) {
+        return result;
+    }
+
+    if (!m_stl_output_file) {
+        m_stl_output_file.close();
+        throw std::runtime_error(std::string("Unable to write stl output file ") + m_name + ".");
+    }
+
+    STL_STATS(m_stats.bytes_written = static_cast<uint64_t>(m_stl_output_file.tellp()));
+
+    if (m_stl_output_file.is_open()) {
+        m_stl_output_file.close();
+    }
+    return 0;
+}
+
+// create an ascii stl on a stream
+// name goes on the solid and endsolid lines
+int stl::create_stl_ascii(std::ostream& out, const char* name)
+{
+    STL_STATS(m_stats.clear());
+    STL_STATS_TIME(m_stats.total_seconds);
+
+    m_name = std::string(name);
+    STL_STATS(auto start = out.tellp());
+    auto result = write_ascii(out, m_name);
+    if (result != 0) {
+        return result;
+    }
+    if (!out) {
+        throw std::runtime_error("Unable to write stl output stream.");
+    }
+    STL_STATS(m_stats.bytes_written = start < 0 ? 0 : static_cast<uint64_t>(out.tellp() - start));
+    return 0;
+}
+
+// write_ascii
+// the solid, facets and endsolid of an ascii stl
+// return -1 after writing a message if the stl data does not match
+int stl::write_ascii(std::ostream& out, const std::string& name)
+{
+    if (m_num_triangles * 3LL != m_normals.size() || num_vertices() * AXIS_PER_VERTEX != m_normals.size() * 3LL) {
+        out << "Invalid stl data. " <<
             " triangles [" << m_num_triangles << "]" <<
-            " vectors [" << m_vectors.size() << "]" <<
+            " vectors [" << num_vertices() * AXIS_PER_VERTEX << "]" <<
             " normals [" << m_normals.size() << "]" <<
             " rgb_colors [" << m_rgb_color.size() << "]\n";
 
@@ -191,405 +499,958 @@ int stl::create_stl_ascii(const char* name)
         return -1;
     }
 
-    m_stl_output_file << "solid " << m_name << '\n';
-    for (auto triangle = 0u; triangle < m_num_triangles; ++triangle) {
-
-        m_stl_output_file << "facet normal";
-        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-            m_stl_output_file << ' ' << m_normals[normal_index++];
+    out << "solid " << name << '\n';
+
+    // the facets are formatted in blocks, one block per worker thread,
+    // and the blocks of a round are written in order
+    auto threads = stl_thread_count(m_num_threads);
+    auto block_facets = static_cast<size_t>(STL_ASCII_BLOCK_FACETS);
+    auto blocks = (m_num_triangles + block_facets - 1) / block_facets;
+    auto round = std::min<size_t>(threads, blocks);
+
+    std::vector<std::string> buffers[2];
+    buffers[0].resize(round);
+    buffers[1].resize(m_overlapped_io ? round : 0);
+    std::future<void> pending;
+    auto cur = 0;
+
+    auto write_round = [this, &out](std::vector<std::string>* text, size_t count) {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_write]);
+        for (size_t i = 0; i < count; ++i) {
+            out.write((*text)[i].data(), static_cast<std::streamsize>((*text)[i].size()));
         }
-        m_stl_output_file << '\n';
-
-        m_stl_output_file << " outer loop\n";
+    };
+
+    try {
+        for (size_t first = 0; first < blocks; first += round) {
+            auto count = std::min(round, blocks - first);
+            auto& text = buffers[cur];
+            {
+                STL_STATS_TIME(m_stats.seconds[stl_phase_format]);
+                stl_parallel_for(count, threads, [&](size_t index) {
+                    auto begin = (first + index) * block_facets;
+                    auto end = std::min<size_t>(begin + block_facets, m_num_triangles);
+                    format_ascii(text[index], begin, end - begin);
+                });
+            }
 
-        for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
-            m_stl_output_file << "  vertex";
-            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-                m_stl_output_file << ' ' << m_vectors[vertex_index++];
+            if (pending.valid()) {
+                pending.get();
+            }
+            if (m_overlapped_io) {
+                // write this round while the next one is formatted
+                pending = std::async(std::launch::async, write_round, &text, count);
+                cur ^= 1;
             }
-            m_stl_output_file << '\n';
+            else {
+                write_round(&text, count);
+            }
+        }
+        if (pending.valid()) {
+            pending.get();
+        }
+    }
+    catch (...) {
+        if (pending.valid()) {
+            pending.wait();
         }
-        m_stl_output_file << " endloop\n";
-        m_stl_output_file << "endfacet\n";
+        throw;
     }
-    m_stl_output_file << "endsolid " << m_name.c_str() << '\n';
 
+    out << "endsolid " << name.c_str() << '\n';
+
+#ifdef STL_ENABLE_STATS
+    uint64_t text_bytes = 0;
+    for (auto& round_text : buffers) {
+        for (auto& text : round_text) {
+            text_bytes += text.capacity();
+        }
+    }
+    note_peak(text_bytes);
+#endif
     return 0;
 }
 
-// read until end of line
-char* stl::read_line()
+// append a float in the shortest form that reads back to the same value
+static char* format_float(char* dst, char* end, float value)
 {
-    auto pos = 0ULL;
-    m_token[pos] = 0;
-
-    while (!m_stl_input_file.eof() && pos + 1 < sizeof(m_token)) {
-        char ch = m_stl_input_file.get();
-        if (m_stl_input_file.eof() || ch == '\n') {
-            break;
-        }
-        if (pos == 0 && (isspace(ch))) {
-            continue;
-        }
-        m_token[pos++] = ch;
-    }
-    m_token[pos] = 0;
-    return m_token;
+    *dst++ = ' ';
+    return std::to_chars(dst, end, value).ptr;
 }
 
-// get the token from the stl file
-char* stl::get_next_token()
+// format_ascii
+// format facets first .. first + count - 1 as ascii stl text into text
+void stl::format_ascii(std::string& text, size_t first, size_t count) const
 {
-    auto pos = 0ULL;
-    m_token[pos] = 0;
+    text.resize(count * STL_ASCII_FACET_SIZE);
+    auto dst = &text[0];
+    auto end = dst + text.size();
 
-    while (!m_stl_input_file.eof() && pos + 1 < sizeof(m_token)) {
-        auto ch = m_stl_input_file.get();
+    float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+    for (auto triangle = first; triangle < first + count; ++triangle) {
+        auto normal = &m_normals[triangle * AXIS_PER_VERTEX];
+        auto vertex = triangle_vertices(triangle, buffer);
 
-        if (m_stl_input_file.eof() || std::isspace(ch)) {
-            if (pos != 0) {
-                break;
-            }
-            else {
-                continue;
+        memcpy(dst, "facet normal", 12);
+        dst += 12;
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            dst = format_float(dst, end, normal[ax]);
+        }
+        memcpy(dst, "\n outer loop\n", 13);
+        dst += 13;
+
+        for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+            memcpy(dst, "  vertex", 8);
+            dst += 8;
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                dst = format_float(dst, end, *vertex++);
             }
+            *dst++ = '\n';
         }
-        m_token[pos++] = ch;
+        memcpy(dst, " endloop\nendfacet\n", 18);
+        dst += 18;
     }
-    m_token[pos] = 0;
-    return m_token;
+    text.resize(dst - text.data());
 }
 
 // validate_state
 // make sure we are in expected parse state
 // used in ascii stl
 // return true if in expected state
-bool stl::validate_state(const char* tok)
+bool stl::validate_state(const stl_ascii_scanner& scan, stl_ascii_scanner::keyword keyword,
+    const char* tok, sti_parse_state& state) const
 {
-    if (strcmp(m_token, tok) != 0) {
-        m_cur_state = error;
-        throw std::runtime_error(std::string(m_name) + " invalid stl file. expected [" + std::string(tok) + "] but got [" + std::string(m_token) + "].");
+    if (scan.token_keyword() != keyword) {
+        state = error;
+        throw std::runtime_error(std::string(m_name) + " invalid stl file. expected [" + std::string(tok) + "] but got [" + scan.token_string() + "].");
     }
     return true;
 }
 
+// find the next 'facet' token at or after from
+// return end if there is none
+static const char* find_facet(const char* begin, const char* from, const char* end)
+{
+    while (end - from >= FACET_NAME_LEN) {
+        from = static_cast<const char*>(memchr(from, 'f', end - from - FACET_NAME_LEN + 1));
+        if (from == nullptr) {
+            break;
+        }
+        if (memcmp(from, "facet", FACET_NAME_LEN) == 0 &&
+            (from == begin || stl_is_space(from[-1])) &&
+            (from + FACET_NAME_LEN == end || stl_is_space(from[FACET_NAME_LEN]))) {
+            return from;
+        }
+        ++from;
+    }
+    return end;
+}
+
+// count the 'facet' tokens in from .. end
+// used to size the vectors before a parse
+static size_t count_facets(const char* begin, const char* from, const char* end)
+{
+    size_t count = 0;
+    for (from = find_facet(begin, from, end); from != end; from = find_facet(begin, from + FACET_NAME_LEN, end)) {
+        ++count;
+    }
+    return count;
+}
+
 // Read an ascii stl file
-int stl::read_ascii()
+int stl::read_ascii(const char* data, size_t size)
 {
-    auto result = 0;
+    auto threads = stl_thread_count(m_num_threads);
+    if (threads > 1 && size >= 2 * STL_PARALLEL_MIN_BYTES && read_ascii_parallel(data, size, threads)) {
+        m_num_triangles = static_cast<uint32_t>(m_vectors.size() / 9);
+        return 0;
+    }
+
+    stl_ascii_scanner scan(data, data + size);
+
+    auto facets = count_facets(data, data, data + size);
+    m_normals.reserve(facets * AXIS_PER_VERTEX);
+    m_vectors.reserve(facets * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+
+    m_cur_state = solid;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_tokenize]);
+        parse_ascii(scan, m_cur_state, m_normals, m_vectors, SIZE_MAX);
+    }
+    STL_STATS(add_scan_stats(scan.m_counters));
+
+    m_num_triangles = static_cast<uint32_t>(m_vectors.size() / 9);
+    return 0;
+}
+
+// read_ascii_parallel
+// the header is parsed first, then the rest of the file is split into
+// chunks that start at a 'facet' token and each chunk is parsed on a
+// worker thread into its own buffers. The buffers are joined in order.
+//
+// a chunk must end between two facets and only the last chunk may hold
+// endsolid. If any chunk does not parse that way return false and the
+// caller parses the whole file serially, so the triangles and errors
+// are exactly those of the serial parse.
+bool stl::read_ascii_parallel(const char* data, size_t size, unsigned threads)
+{
+    // the chunks are filled on worker threads so they
+    // use the default memory resource, not the one of the stl
+    struct chunk
+    {
+        const char* begin;
+        const char* end;
+        stl_float_vector normals;
+        stl_float_vector vectors;
+        STL_STATS(stl_scan_counters counters; double seconds = 0.0;)
+    };
+
+    auto end = data + size;
+    stl_ascii_scanner scan(data, end);
+
+    // solid line (and the first facet if it is on the solid line)
+    m_cur_state = solid;
+    STL_STATS(double header_seconds = 0.0);
+    {
+        STL_STATS_TIME(header_seconds);
+        parse_ascii(scan, m_cur_state, m_normals, m_vectors, 0);
+    }
+    if (m_cur_state != facet) {
+        m_normals.clear();
+        m_vectors.clear();
+        return false;
+    }
 
-    std::string solid_Name;
-    char* tok = nullptr;
-    do {
-        if (m_read_tok) {
-            tok = get_next_token();
+    auto body = scan.position();
+    auto count = std::min<size_t>(threads * 2ULL, (end - body) / STL_PARALLEL_MIN_BYTES);
+    std::vector<chunk> chunks;
+    auto from = body;
+    for (size_t i = 1; i <= count && from < end; ++i) {
+        auto to = i == count ? end : find_facet(data, body + (end - body) * i / count, end);
+        if (to > from) {
+            chunks.emplace_back();
+            chunks.back().begin = from;
+            chunks.back().end = to;
+            from = to;
+        }
+    }
+    if (chunks.size() < 2) {
+        m_normals.clear();
+        m_vectors.clear();
+        return false;
+    }
 
-            if (tok == nullptr)
+    try {
+        stl_parallel_for(chunks.size(), threads, [&](size_t index) {
+            auto& part = chunks[index];
+            auto last = index + 1 == chunks.size();
+            stl_ascii_scanner part_scan(part.begin, part.end);
+            auto state = facet;
+
+            auto facets = count_facets(data, part.begin, part.end);
+            part.normals.reserve(facets * AXIS_PER_VERTEX);
+            part.vectors.reserve(facets * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+
+            // one facet at a time so the chunk can stop at its end
+            {
+                STL_STATS_TIME(part.seconds);
+                while (state == facet && !part_scan.at_end()) {
+                    parse_ascii(part_scan, state, part.normals, part.vectors, 1);
+                }
+            }
+            STL_STATS(part.counters = part_scan.m_counters);
+            if (state != (last ? done : facet)) {
+                throw std::runtime_error(m_name + " chunk does not end between facets.");
+            }
+        });
+    }
+    catch (...) {
+        m_normals.clear();
+        m_vectors.clear();
+        return false;
+    }
+
+    // join the chunks in order
+    auto normals_size = m_normals.size();
+    auto vectors_size = m_vectors.size();
+    for (auto& part : chunks) {
+        normals_size += part.normals.size();
+        vectors_size += part.vectors.size();
+    }
+    STL_STATS(auto capacity = m_vectors.capacity() + m_normals.capacity());
+    m_normals.reserve(normals_size);
+    m_vectors.reserve(vectors_size);
+    STL_STATS(m_stats.reallocations += m_vectors.capacity() + m_normals.capacity() != capacity ? 1 : 0);
+
+#ifdef STL_ENABLE_STATS
+    uint64_t chunk_bytes = 0;
+    add_scan_stats(scan.m_counters);
+    m_stats.seconds[stl_phase_tokenize] += header_seconds;
+    for (auto& part : chunks) {
+        chunk_bytes += (part.normals.capacity() + part.vectors.capacity()) * sizeof(float);
+        add_scan_stats(part.counters);
+        m_stats.seconds[stl_phase_tokenize] += part.seconds;
+    }
+    note_peak(size + chunk_bytes);
+#endif
+
+    for (auto& part : chunks) {
+        m_normals.insert(m_normals.end(), part.normals.begin(), part.normals.end());
+        m_vectors.insert(m_vectors.end(), part.vectors.begin(), part.vectors.end());
+        release(part.normals);
+        release(part.vectors);
+    }
+    m_cur_state = done;
+    return true;
+}
+
+// append a value to a parse vector
+// and count the reallocations for stl_stats
+static inline void append(stl_float_vector& values, float value, const stl_ascii_scanner& scan)
+{
+    static_cast<void>(scan);
+    STL_STATS(auto capacity = values.capacity());
+    values.push_back(value);
+    STL_STATS(scan.m_counters.reallocations += values.capacity() != capacity ? 1 : 0);
+}
+
+// parse_ascii
+// run the ascii parse state machine over the scanner tokens
+// and append the facets to normals and vectors
+//
+// parsing stops after max_facets facets in the facet state
+// so it can be resumed with the same state.
+// return the number of facets read
+size_t stl::parse_ascii(stl_ascii_scanner& scan, sti_parse_state& state,
+    stl_float_vector& normals, stl_float_vector& vectors, size_t max_facets) const
+{
+    size_t facets = 0;
+    auto read_tok = true;
+
+    while (state != done) {
+        if (read_tok) {
+            if (state == facet && facets >= max_facets) {
                 break;
+            }
+            scan.next_token();
         }
-        m_read_tok = true;
-        switch (m_cur_state) {
+        read_tok = true;
+
+        switch (state) {
             case error:
-                cleanup();
-                return -1;
+            case done:
+                return facets;
 
             case solid:
-                if (!validate_state("solid")) {
-                    result = -1;
-                    break;
+                validate_state(scan, stl_ascii_scanner::kw_solid, "solid", state);
+                state = facet;
+
+                // the rest of the line is the name
+                // unless it starts with facet, then the whole line is the next token
+                scan.read_line();
+                if (scan.token_starts_with("facet", FACET_NAME_LEN)) {
+                    read_tok = false;
                 }
-                m_cur_state = facet;
-                tok = read_line();
-                if (strncmp(tok, "facet", FACET_NAME_LEN) == 0) {
-                    m_read_tok = false;
-                    break;
-                }
-                solid_Name = tok;
                 break;
 
             case facet:
-                if (tok != nullptr) {
-                    if (strcmp(tok, "endsolid") == 0) {
-                        m_read_tok = false;
-                        m_cur_state = endsolid;
-                        break;
-                    }
-                }
-                if (!validate_state("facet")) {
-                    result = -1;
+                if (scan.token_keyword() == stl_ascii_scanner::kw_endsolid) {
+                    read_tok = false;
+                    state = endsolid;
                     break;
                 }
-                m_cur_state = facet_normal;
+                validate_state(scan, stl_ascii_scanner::kw_facet, "facet", state);
+                state = facet_normal;
                 break;
 
             case facet_normal:
-                if (!validate_state("normal")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = facet_vertex_x;
+                validate_state(scan, stl_ascii_scanner::kw_normal, "normal", state);
+                state = facet_vertex_x;
                 break;
 
+            // read vertex in facet (the normal for vertex)
             case facet_vertex_x:
+                append(normals, scan.token_float(), scan);
+                state = facet_vertex_y;
+                break;
+
             case facet_vertex_y:
+                append(normals, scan.token_float(), scan);
+                state = facet_vertex_z;
+                break;
+
             case facet_vertex_z:
-                read_facet_vertex();
+                append(normals, scan.token_float(), scan);
+                state = outer;
                 break;
 
             case outer:
-                if (!validate_state("outer")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = outer_loop;
+                validate_state(scan, stl_ascii_scanner::kw_outer, "outer", state);
+                state = outer_loop;
                 break;
 
             case outer_loop:
-                if (!validate_state("loop")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = vertex;
+                validate_state(scan, stl_ascii_scanner::kw_loop, "loop", state);
+                state = vertex;
                 break;
 
             case vertex:
-                if (!validate_state("vertex")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = vertex_x;
+                validate_state(scan, stl_ascii_scanner::kw_vertex, "vertex", state);
+                state = vertex_x;
                 break;
 
+            // read vertex in stl ascii file
             case vertex_x:
+                append(vectors, scan.token_float(), scan);
+                state = vertex_y;
+                break;
+
             case vertex_y:
+                append(vectors, scan.token_float(), scan);
+                state = vertex_z;
+                break;
+
             case vertex_z:
-                read_vertex();
+                append(vectors, scan.token_float(), scan);
+                scan.next_token();
+                read_tok = false;
+                state = scan.token_keyword() == stl_ascii_scanner::kw_endloop ? endloop : vertex;
                 break;
 
             case endloop:
-                if (!validate_state("endloop")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = endfacet;
+                validate_state(scan, stl_ascii_scanner::kw_endloop, "endloop", state);
+                state = endfacet;
                 break;
 
             case endfacet:
-                if (!validate_state("endfacet")) {
-                    result = -1;
-                    break;
-                }
-                m_cur_state = facet;
+                validate_state(scan, stl_ascii_scanner::kw_endfacet, "endfacet", state);
+                state = facet;
+                ++facets;
                 break;
 
             case endsolid:
-                if (!validate_state("endsolid")) {
-                    result = -1;
-                    break;
-                }
-                get_next_token();
-                m_read_tok = false;
-                tok = nullptr;
+                validate_state(scan, stl_ascii_scanner::kw_endsolid, "endsolid", state);
+                scan.next_token();
+                state = done;
                 break;
         }
-    } while (tok != nullptr);
-
-    m_num_triangles = static_cast<uint32_t>(m_vectors.size() / 9);
-    return result;
+    }
+    return facets;
 }
 
-// read vertex in facet (the normal for vertex)
-void stl::read_facet_vertex()
+// check a binary stl image against the 80 + 4 + 50 * n layout
+// return the number of triangles
+static uint32_t check_binary_layout(const std::string& name, const char* data, size_t size)
 {
-    char* ending = nullptr;
-    auto vertex = strtof(m_token, &ending);
-    m_normals.push_back(vertex);
-
-    switch (m_cur_state) {
-        case facet_vertex_x:
-            m_cur_state = facet_vertex_y;
-            break;
-
-        case facet_vertex_y:
-            m_cur_state = facet_vertex_z;
-            break;
+    if (size < STL_HEADER_SIZE + STL_COUNT_SIZE) {
+        throw std::runtime_error(name + " invalid stl file.");
+    }
 
-        case facet_vertex_z:
-            m_cur_state = outer;
-            break;
+    uint32_t num_triangles = 0;
+    memcpy(&num_triangles, data + STL_HEADER_SIZE, sizeof(num_triangles));
 
-        default:
-            m_cur_state = error;
-            m_read_tok = false;
-            throw std::runtime_error(std::string(m_name) + " invalid stl file. Expected a vertex normal value.");
+    if (STL_HEADER_SIZE + STL_COUNT_SIZE + static_cast<unsigned long long>(num_triangles) * STL_TRIANGLE_SIZE != size) {
+        throw std::runtime_error(name + " invalid stl file.");
     }
+    return num_triangles;
 }
 
-// read vertex in stl ascii file
-void stl::read_vertex()
+// decode the attribute of a binary stl triangle
+// 4 bits for each part, r in bits 8 - 11, g in 4 - 7, b in 0 - 3 and
+// bit 12 set when the color is valid
+bool stl_decode_attribute(uint16_t attribute, float rgb[3])
 {
-    char* ending = nullptr;
-    auto v = strtof(m_token, &ending);
-    m_vectors.push_back(v);
-    m_read_tok = true;
-
-    switch (m_cur_state) {
-        case vertex_x:
-            m_cur_state = vertex_y;
-            break;
+    uint16_t b = attribute & 0x000F;
+    uint16_t g = (attribute & 0x00F0) >> 4;
+    uint16_t r = (attribute & 0x0F00) >> 8;
+    auto valid = (attribute & 0x1000) >> 12;
+
+    if (valid) {
+        //  convert rgb values to range 0 - 1
+        constexpr float mask = 0x0F;
+        rgb[0] = static_cast<float>(r) / mask;
+        rgb[1] = static_cast<float>(g) / mask;
+        rgb[2] = static_cast<float>(b) / mask;
+    }
+    return valid != 0;
+}
 
-        case vertex_y:
-            m_cur_state = vertex_z;
-            break;
+// encode rgb values 0 - 1 into a binary stl attribute
+// the layout stl_decode_attribute reads, values outside 0 - 1 or nan
+// are clamped
+uint16_t stl_encode_attribute(const float rgb[3])
+{
+    constexpr float mask = 0x0F;
+    uint16_t part[3];
+    for (auto i = 0; i < 3; ++i) {
+        auto value = !(rgb[i] > 0.0f) ? 0.0f : std::min(rgb[i], 1.0f);
+        part[i] = static_cast<uint16_t>(std::lround(value * mask));
+    }
+    return static_cast<uint16_t>(0x1000 | (part[0] << 8) | (part[1] << 4) | part[2]);
+}
 
-        case vertex_z:
-            m_read_tok = true;
-            get_next_token();
-            m_read_tok = false;
-            m_cur_state = strcmp(m_token, "endloop") == 0 ? endloop : vertex;
-            break;
+// pack a triangle into a 50 byte binary stl record
+void stl_pack_triangle(char* dst, const float normal[3], const float vertices[9], uint16_t attribute)
+{
+    memcpy(dst, normal, AXIS_PER_VERTEX * sizeof(float));
+    memcpy(dst + AXIS_PER_VERTEX * sizeof(float), vertices, VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX * sizeof(float));
+    memcpy(dst + STL_TRIANGLE_SIZE - STL_ATTRIBUTE_SIZE, &attribute, sizeof(attribute));
+}
 
-        default:
-            m_cur_state = error;
-            m_read_tok = false;
-            throw std::runtime_error(std::string(m_name) + " invalid stl file. Expected a vertex value.");
+// the normal matrix of a row major 4 x 4 transform
+// rows of the inverse transpose, up to the size of the determinant
+// return the determinant, a mirroring transform has det < 0
+float stl_normal_matrix(const float matrix[16], float normal_matrix[9])
+{
+    const float* a = &matrix[0];
+    const float* b = &matrix[4];
+    const float* c = &matrix[8];
+    float rows[9] = {
+        b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0],
+        c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0],
+        a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]
+    };
+    auto det = a[0] * rows[0] + a[1] * rows[1] + a[2] * rows[2];
+    for (auto i = 0; i < 9; ++i) {
+        normal_matrix[i] = det < 0.0f ? -rows[i] : rows[i];
     }
+    return det;
 }
 
 //
 // read_binary stl
-int stl::read_binary()
+// fill the triangle data from a binary stl image
+// the vectors are sized once and filled in a single pass
+int stl::read_binary(const char* data, size_t size)
 {
-    auto result = 0;
-    if (m_size < STL_HEADER_SIZE + sizeof(m_num_triangles)) {
+    uint32_t num_triangles = 0;
+    try {
+        num_triangles = check_binary_layout(m_name, data, size);
+    }
+    catch (...) {
         cleanup();
-        throw std::runtime_error(std::string(m_name.c_str()) + " invalid stl file.");
+        throw;
     }
 
-    // read header
-    m_stl_input_file.read(reinterpret_cast<char*>(m_header), STL_HEADER_SIZE);
+    STL_STATS_TIME(m_stats.seconds[stl_phase_copy]);
 
-    // read number of triangles
-    m_stl_input_file.read(reinterpret_cast<char*>(&m_num_triangles), sizeof(m_num_triangles));
+    // read header and number of triangles
+    memcpy(m_header, data, STL_HEADER_SIZE);
+    size_binary(num_triangles);
 
-    // Check size
-    if (static_cast<long long>(STL_HEADER_SIZE + sizeof(int32_t) + static_cast<long long>(m_num_triangles * STL_TRIANGLE_SIZE)) < m_size) {
-        cleanup();
-        throw std::runtime_error(std::string(m_name.c_str()) + " invalid stl file.");
-    }
+    size_t colors = 0;
+    decode_binary(data + STL_HEADER_SIZE + STL_COUNT_SIZE, 0, m_num_triangles, colors);
 
-    for (uint32_t triangle = 0; triangle < m_num_triangles; triangle++) {
-        float a = 0;
+    // only triangles with a valid attribute have a color
+    m_rgb_color.resize(colors);
+    return 0;
+}
 
-        // read normal vector
-        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-            m_stl_input_file.read(reinterpret_cast<char*>(&a), sizeof(a));
-            m_normals.push_back(a);
-        }
+// size the vectors for num_triangles binary triangles
+void stl::size_binary(uint32_t num_triangles)
+{
+    m_num_triangles = num_triangles;
+
+    auto corners = static_cast<size_t>(m_num_triangles) * VERTEX_PER_TRIANGLE;
+    m_normals.resize(static_cast<size_t>(m_num_triangles) * AXIS_PER_VERTEX);
+    if (m_layout == stl_soa) {
+        m_x.resize(corners);
+        m_y.resize(corners);
+        m_z.resize(corners);
+    }
+    else {
+        m_vectors.resize(corners * AXIS_PER_VERTEX);
+    }
+    m_rgb_color.resize(static_cast<size_t>(m_num_triangles) * AXIS_PER_VERTEX);
+}
 
-        // read 3 vertices
-        for (auto vert = 0; vert < VERTEX_PER_TRIANGLE; vert++) {
-            // read vertex
-            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
-                m_stl_input_file.read(reinterpret_cast<char*>(&a), sizeof(a));
-                m_vectors.push_back(a);
+// decode_binary
+// copy count 50 byte records into triangles first .. first + count - 1
+// the valid colors are appended at m_rgb_color[colors]
+void stl::decode_binary(const char* record, size_t first, size_t count, size_t& colors)
+{
+    auto normals = &m_normals[first * AXIS_PER_VERTEX];
+    auto vectors = m_vectors.data() + (m_layout == stl_soa ? 0 : first * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+    auto rgb = m_rgb_color.data() + colors;
+
+    for (auto triangle = first; triangle < first + count; triangle++) {
+        // normal vector followed by the 3 vertices
+        memcpy(normals, record, AXIS_PER_VERTEX * sizeof(float));
+        normals += AXIS_PER_VERTEX;
+        if (m_layout == stl_soa) {
+            float v[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+            memcpy(v, record + AXIS_PER_VERTEX * sizeof(float), sizeof(v));
+            auto corner = triangle * VERTEX_PER_TRIANGLE;
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                m_x[corner + i] = v[i * AXIS_PER_VERTEX];
+                m_y[corner + i] = v[i * AXIS_PER_VERTEX + 1];
+                m_z[corner + i] = v[i * AXIS_PER_VERTEX + 2];
             }
         }
+        else {
+            memcpy(vectors, record + AXIS_PER_VERTEX * sizeof(float), VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX * sizeof(float));
+            vectors += VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX;
+        }
 
-        // read attribute
-        // 4 bits for each part
         uint16_t attribute = 0;
-        m_stl_input_file.read(reinterpret_cast<char*>(&attribute), sizeof(attribute));
+        memcpy(&attribute, record + STL_TRIANGLE_SIZE - STL_ATTRIBUTE_SIZE, sizeof(attribute));
+        if (stl_decode_attribute(attribute, rgb)) {
+            rgb += AXIS_PER_VERTEX;
+        }
+        record += STL_TRIANGLE_SIZE;
+    }
+    colors = rgb - m_rgb_color.data();
+}
 
-        uint16_t b = attribute & 0x000F;
-        uint16_t g = attribute & 0x00F0 >> 4;
-        uint16_t r = attribute & 0x0F00 >> 8;
-        auto valid = attribute & 0x1000 >> 12;
+// read_pipelined
+// read the file through a stl_pipe_source, the reader thread fills the
+// next buffers while the parser works on the current one. The format is
+// found from the first buffer, return false if that is not enough to
+// tell and the caller reads the file the usual way
+bool stl::read_pipelined(const char* name)
+{
+    std::unique_ptr<stl_pipe_source> source;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_open]);
+        source = std::make_unique<stl_pipe_source>(name);
+    }
+    m_size = static_cast<std::streamoff>(source->size());
+    STL_STATS(m_stats.bytes_read = source->size());
+    if (m_size < MIN_STL_LENGTH) {
+        cleanup();
+        throw std::runtime_error(m_name + " invalid stl file.");
+    }
 
-        if (valid) {
-            //  convert rgb values to range 0 - 1
-            constexpr float mask = 0x0F;
-            m_rgb_color.push_back(static_cast<float>(r) / mask);
-            m_rgb_color.push_back(static_cast<float>(g) / mask);
-            m_rgb_color.push_back(static_cast<float>(b) / mask);
+    size_t prefix_size = 0;
+    auto prefix = source->peek(prefix_size);
+    auto ascii = false;
+    {
+        STL_STATS_TIME(m_stats.seconds[stl_phase_detect]);
+        auto complete = prefix_size == source->size();
+        ascii = detect_ascii(prefix, prefix_size, source->size(), complete ? nullptr : &complete);
+        if (!complete) {
+            return false;
         }
     }
-     
-    auto pos = m_stl_input_file.tellg();
-    m_stl_input_file.close();
 
-    if (pos != m_size) {
-        throw std::runtime_error(std::string(m_name.c_str()) + " unexpected data at and of file.");
+    if (ascii) {
+        stl_ascii_scanner scan(*source);
+        m_cur_state = solid;
+        {
+            STL_STATS_TIME(m_stats.seconds[stl_phase_tokenize]);
+            parse_ascii(scan, m_cur_state, m_normals, m_vectors, SIZE_MAX);
+        }
+        STL_STATS(add_scan_stats(scan.m_counters));
+        m_num_triangles = static_cast<uint32_t>(m_vectors.size() / 9);
+        if (m_layout == stl_soa) {
+            split_vectors();
+        }
+        STL_STATS(note_peak(STL_PIPE_BUFFER_SIZE * STL_PIPE_BUFFERS + STL_SCAN_BUFFER_SIZE));
+        return true;
     }
-    return result;
+
+    uint32_t num_triangles = 0;
+    try {
+        num_triangles = check_binary_layout(m_name, prefix, m_size);
+    }
+    catch (...) {
+        cleanup();
+        throw;
+    }
+
+    STL_STATS_TIME(m_stats.seconds[stl_phase_copy]);
+    char count[STL_COUNT_SIZE];
+    source->read_full(m_header, STL_HEADER_SIZE);
+    source->read_full(count, STL_COUNT_SIZE);
+    size_binary(num_triangles);
+
+    // records are copied out of the ring in blocks so none is split
+    std::vector<char> block(std::min<size_t>(num_triangles, STL_PIPE_BLOCK_TRIANGLES) * STL_TRIANGLE_SIZE);
+    size_t colors = 0;
+    for (size_t first = 0; first < num_triangles; first += STL_PIPE_BLOCK_TRIANGLES) {
+        auto n = std::min<size_t>(STL_PIPE_BLOCK_TRIANGLES, num_triangles - first);
+        if (source->read_full(block.data(), n * STL_TRIANGLE_SIZE) != n * STL_TRIANGLE_SIZE) {
+            cleanup();
+            throw std::runtime_error(m_name + " invalid stl file.");
+        }
+        decode_binary(block.data(), first, n, colors);
+    }
+    m_rgb_color.resize(colors);
+    STL_STATS(note_peak(STL_PIPE_BUFFER_SIZE * STL_PIPE_BUFFERS + block.capacity()));
+    return true;
+}
+
+// open
+// map a binary stl file and check its layout
+bool stl_binary_view::open(const char* name)
+{
+    close();
+    m_map.open(name);
+    try {
+        m_num_triangles = check_binary_layout(std::string(name), m_map.data(), m_map.size());
+    }
+    catch (...) {
+        close();
+        throw;
+    }
+    return true;
+}
+
+// close
+// unmap the file
+void stl_binary_view::close()
+{
+    m_map.close();
+    m_num_triangles = 0;
+}
+
+// normal of a triangle
+void stl_binary_view::normal(uint32_t triangle, float n[3]) const
+{
+    memcpy(n, record(triangle), AXIS_PER_VERTEX * sizeof(float));
+}
+
+// vertex 0 - 2 of a triangle
+void stl_binary_view::vertex(uint32_t triangle, int vert, float v[3]) const
+{
+    memcpy(v, record(triangle) + (vert + 1) * AXIS_PER_VERTEX * sizeof(float), AXIS_PER_VERTEX * sizeof(float));
+}
+
+// raw attribute of a triangle
+// use stl_decode_attribute to get the color
+uint16_t stl_binary_view::attribute(uint32_t triangle) const
+{
+    uint16_t attribute = 0;
+    memcpy(&attribute, record(triangle) + STL_TRIANGLE_SIZE - STL_ATTRIBUTE_SIZE, sizeof(attribute));
+    return attribute;
 }
 
 // Calculate the normals of
 // the triangles
+// uses the best vector kernel the cpu has and
+// splits large meshes over the worker threads
 //
 void stl::calc_normals()
 {
-    auto n = m_vectors.size();
-    m_num_triangles = static_cast<uint16_t>(n) / (VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+    auto n = num_vertices() / VERTEX_PER_TRIANGLE;
+    if (n > UINT32_MAX) {
+        throw std::runtime_error("Too many triangles for a stl file.");
+    }
+    m_num_triangles = static_cast<uint32_t>(n);
 
     if (m_num_triangles < 1) {
         return;
     }
-    m_normals.clear();
-    size_t index = 0;
-    for (auto tri = 0U; tri < m_num_triangles; ++tri) {
-        auto p0x = m_vectors[index++];
-        auto p0y = m_vectors[index++];
-        auto p0z = m_vectors[index++];
-        auto p1x = m_vectors[index++];
-        auto p1y = m_vectors[index++];
-        auto p1z = m_vectors[index++];
-        auto p2x = m_vectors[index++];
-        auto p2y = m_vectors[index++];
-        auto p2z = m_vectors[index++];
+    m_normals.resize(static_cast<size_t>(m_num_triangles) * AXIS_PER_VERTEX);
+
+    stl_parallel_blocks(n, STL_NORMALS_BLOCK_TRIANGLES, stl_thread_count(m_num_threads), [&](size_t first, size_t count) {
+        if (m_layout == stl_soa) {
+            auto corner = first * VERTEX_PER_TRIANGLE;
+            stl_simd_normals_soa(&m_x[corner], &m_y[corner], &m_z[corner], &m_normals[first * AXIS_PER_VERTEX], count);
+        }
+        else {
+            stl_simd_normals(&m_vectors[first * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX], &m_normals[first * AXIS_PER_VERTEX], count);
+        }
+    });
+}
+
+// bounds
+// axis aligned bounding box of the finite vertex coordinates
+// the vertices are reduced in blocks over the worker threads, nan and
+// inf are skipped. The box is empty when an axis has no finite value
+// the mesh is not changed
+stl_aabb stl::bounds(unsigned threads) const
+{
+    constexpr auto inf = std::numeric_limits<float>::infinity();
+    stl_aabb box = { { inf, inf, inf }, { -inf, -inf, -inf } };
+
+    auto count = num_vertices();
+    if (count == 0) {
+        return box;
+    }
 
-        auto x = (p1y - p0y) * (p1z + p0z) + (p2y - p1y) * (p2z + p1z) + (p0y - p2y) * (p0z + p2z);
-        auto y = (p1z - p0z) * (p1x + p0x) + (p2z - p1z) * (p2x + p1x) + (p0z - p2z) * (p0x + p2x);
-        auto z = (p1x - p0x) * (p1y + p0y) + (p2x - p1x) * (p2y + p1y) + (p0x - p2x) * (p0y + p2y);
+    const stl_float_vector* axes[AXIS_PER_VERTEX] = { &m_x, &m_y, &m_z };
+    std::vector<stl_aabb> parts((count + STL_VERTEX_BLOCK_SIZE - 1) / STL_VERTEX_BLOCK_SIZE, box);
+    stl_parallel_blocks(count, STL_VERTEX_BLOCK_SIZE, stl_thread_count(threads), [&](size_t first, size_t n) {
+        auto& part = parts[first / STL_VERTEX_BLOCK_SIZE];
+        if (m_layout == stl_soa) {
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                stl_simd_axis_bounds(&(*axes[ax])[first], n, part.min[ax], part.max[ax]);
+            }
+        }
+        else {
+            stl_simd_bounds(&m_vectors[first * AXIS_PER_VERTEX], n, part.min, part.max);
+        }
+    });
 
-        auto distance = sqrt(x * x + y * y + z * z);
-        
-        m_normals.push_back(x / distance);
-        m_normals.push_back(y / distance);
-        m_normals.push_back(z / distance);
+    for (auto& part : parts) {
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            box.min[ax] = std::min(box.min[ax], part.min[ax]);
+            box.max[ax] = std::max(box.max[ax], part.max[ax]);
+        }
     }
+    return box;
 }
 
-// open or repopen stl file in binary mode
-bool stl::open_binary()
+// transform
+// apply an affine transform to the mesh
+// matrix is row major 4 x 4 with the translation in the last column,
+// the bottom row is not used
+//
+// normals are transformed by the inverse transpose and scaled back to
+// unit length. A mirroring transform also swaps 2 vertices of every
+// triangle so the winding still agrees with the normal.
+void stl::transform(const float matrix[16])
 {
-    return open_read_common(std::ios::binary);
+    auto threads = stl_thread_count(m_num_threads);
+    stl_parallel_blocks(num_vertices(), STL_VERTEX_BLOCK_SIZE, threads, [&](size_t first, size_t count) {
+        if (m_layout == stl_soa) {
+            stl_simd_affine_soa(&m_x[first], &m_y[first], &m_z[first], count, matrix);
+        }
+        else {
+            stl_simd_affine(&m_vectors[first * AXIS_PER_VERTEX], count, matrix);
+        }
+    });
+
+    float normal_matrix[9];
+    auto det = stl_normal_matrix(matrix, normal_matrix);
+
+    stl_parallel_blocks(m_normals.size() / AXIS_PER_VERTEX, STL_VERTEX_BLOCK_SIZE, threads, [&](size_t first, size_t count) {
+        stl_simd_linear_normalize(&m_normals[first * AXIS_PER_VERTEX], count, normal_matrix);
+    });
+
+    if (det < 0.0f) {
+        auto triangles = num_vertices() / VERTEX_PER_TRIANGLE;
+        for (size_t tri = 0; tri < triangles; ++tri) {
+            if (m_layout == stl_soa) {
+                auto corner = tri * VERTEX_PER_TRIANGLE;
+                std::swap(m_x[corner + 1], m_x[corner + 2]);
+                std::swap(m_y[corner + 1], m_y[corner + 2]);
+                std::swap(m_z[corner + 1], m_z[corner + 2]);
+            }
+            else {
+                auto v = &m_vectors[tri * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+                std::swap_ranges(v + AXIS_PER_VERTEX, v + 2 * AXIS_PER_VERTEX, v + 2 * AXIS_PER_VERTEX);
+            }
+        }
+    }
 }
 
-// open or repopen stl file in ascii mode
-bool stl::open_ascii()
+// normalizeAndCenter
+// center the mesh on the origin and scale it uniformly
+// so its largest side is normal long
+void stl::normalizeAndCenter(float normal)
 {
-    return open_read_common(static_cast<std::ios_base::openmode>(0));
+    // find min and max values for each axis to calculate center and range
+    auto box = bounds();
+    if (box.is_empty()) {
+        return;
+    }
+
+    // Calculate center of the mesh
+    float center[3];
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        center[ax] = (box.min[ax] + box.max[ax]) / 2.0f;
+    }
+
+    // Find the maximum range across all axes for uniform scaling
+    float rangeX = box.max[0] - box.min[0];
+    float rangeY = box.max[1] - box.min[1];
+    float rangeZ = box.max[2] - box.min[2];
+    float maxRange = std::max({ rangeX, rangeY, rangeZ });
+
+    if (maxRange == 0.0f) {
+        return;
+    }
+
+    // Normalize and center all vertices
+    float scale = normal / maxRange;  // Scale to fit in range
+
+    stl_parallel_blocks(num_vertices(), STL_VERTEX_BLOCK_SIZE, stl_thread_count(m_num_threads),
+        [&](size_t first, size_t count) {
+            if (m_layout == stl_soa) {
+                stl_simd_axis_scale_translate(&m_x[first], count, center[0], scale);
+                stl_simd_axis_scale_translate(&m_y[first], count, center[1], scale);
+                stl_simd_axis_scale_translate(&m_z[first], count, center[2], scale);
+            }
+            else {
+                stl_simd_scale_translate(&m_vectors[first * AXIS_PER_VERTEX], count, center, scale);
+            }
+        });
+    // calc_normals();
 }
 
-// open or repopen stl file in selected mode
-bool stl::open_read_common(std::ios_base::openmode mode)
+// to_soa
+// move the vertex positions from m_vectors to m_x, m_y and m_z
+void stl::to_soa()
 {
-    // binary file. Close it if open and reopen in selected mode
-    if (m_stl_input_file.is_open()) {
-        m_stl_input_file.close();
+    if (m_layout != stl_soa) {
+        split_vectors();
+        m_layout = stl_soa;
     }
-    m_stl_input_file.open(m_name.c_str(), static_cast<std::ios_base::openmode>(mode | std::ios::ate));
-    if (!m_stl_input_file.is_open()) {
-        throw std::runtime_error(std::string("Unable to open stl input file ") + m_name.c_str() + ".");
+}
+
+// to_interleaved
+// move the vertex positions from m_x, m_y and m_z to m_vectors
+void stl::to_interleaved()
+{
+    if (m_layout != stl_interleaved) {
+        join_vectors();
+        m_layout = stl_interleaved;
     }
-    // get the size of the file
-    m_size = m_stl_input_file.tellg();
-    if (m_size < MIN_STL_LENGTH) {
-        throw std::runtime_error(std::string(m_name.c_str()) + " invalid stl file.");
+}
+
+// split m_vectors into m_x, m_y and m_z
+void stl::split_vectors()
+{
+    auto count = m_vectors.size() / AXIS_PER_VERTEX;
+    m_x.resize(count);
+    m_y.resize(count);
+    m_z.resize(count);
+    stl_parallel_blocks(count, STL_VERTEX_BLOCK_SIZE, stl_thread_count(m_num_threads), [&](size_t first, size_t n) {
+        auto v = &m_vectors[first * AXIS_PER_VERTEX];
+        for (auto i = first; i < first + n; ++i, v += AXIS_PER_VERTEX) {
+            m_x[i] = v[0];
+            m_y[i] = v[1];
+            m_z[i] = v[2];
+        }
+    });
+    release(m_vectors);
+}
+
+// join m_x, m_y and m_z into m_vectors
+void stl::join_vectors()
+{
+    auto count = m_x.size();
+    m_vectors.resize(count * AXIS_PER_VERTEX);
+    stl_parallel_blocks(count, STL_VERTEX_BLOCK_SIZE, stl_thread_count(m_num_threads), [&](size_t first, size_t n) {
+        auto v = &m_vectors[first * AXIS_PER_VERTEX];
+        for (auto i = first; i < first + n; ++i, v += AXIS_PER_VERTEX) {
+            v[0] = m_x[i];
+            v[1] = m_y[i];
+            v[2] = m_z[i];
+        }
+    });
+    release(m_x);
+    release(m_y);
+    release(m_z);
+}
+
+// triangle_vertices
+// the 9 vertex floats of a triangle
+// points into m_vectors, or into buffer for the soa layout
+const float* stl::triangle_vertices(size_t triangle, float buffer[9]) const
+{
+    if (m_layout != stl_soa) {
+        return &m_vectors[triangle * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
     }
-    m_stl_input_file.seekg(0, std::ios::beg);
-    return true;
+    auto corner = triangle * VERTEX_PER_TRIANGLE;
+    for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+        buffer[i * AXIS_PER_VERTEX] = m_x[corner + i];
+        buffer[i * AXIS_PER_VERTEX + 1] = m_y[corner + i];
+        buffer[i * AXIS_PER_VERTEX + 2] = m_z[corner + i];
+    }
+    return buffer;
 }
 
 // open stl file in binary mode
@@ -618,25 +1479,47 @@ bool stl::open_write_common(std::ios_base::openmode mode)
     return true;
 } 
 
+#ifdef STL_ENABLE_STATS
+// add the counters of an ascii scan to m_stats
+// the float time was taken out of the parse time
+void stl::add_scan_stats(const stl_scan_counters& counters)
+{
+    m_stats.tokens += counters.tokens;
+    m_stats.floats += counters.floats;
+    m_stats.reallocations += counters.reallocations;
+    m_stats.seconds[stl_phase_float] += counters.float_seconds;
+    m_stats.seconds[stl_phase_tokenize] -= counters.float_seconds;
+}
+
+// raise peak_bytes to the vectors plus extra_bytes
+void stl::note_peak(uint64_t extra_bytes)
+{
+    auto floats = m_vectors.capacity() + m_x.capacity() + m_y.capacity() + m_z.capacity() +
+        m_normals.capacity() + m_rgb_color.capacity();
+    m_stats.peak_bytes = std::max<uint64_t>(m_stats.peak_bytes, floats * sizeof(float) + extra_bytes);
+}
+#endif
+
 // cleanup
 // close all files that are open
 // intialize member variables
 void stl::cleanup()
 {
-    if (m_stl_input_file.is_open()) {
-        m_stl_input_file.close();
-    }
     if (m_stl_output_file.is_open()) {
         m_stl_output_file.close();
     }
-    m_vectors.clear();
-    m_normals.clear();
-    m_rgb_color.clear();
+    for (auto values : { &m_vectors, &m_x, &m_y, &m_z, &m_normals, &m_rgb_color }) {
+        if (m_capacity_policy == stl_release_capacity) {
+            release(*values);
+        }
+        else {
+            values->clear();
+        }
+    }
     memset(m_header, 0, STL_HEADER_SIZE);
 
     m_num_triangles = 0;
     m_size = 0;
-    m_read_tok = true;
     m_cur_state = solid;
 }
 
@@ -7,82 +7,192 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 
 #include <fstream>
+#include <iosfwd>
+#include <memory_resource>
+#include <string>
 #include <vector>
 
+#include "mapped_file.h"
+#include "stl_ascii_scanner.h"
+#include "stl_stats.h"
+
 constexpr int STL_HEADER_SIZE = 80U;
 constexpr int STL_TRIANGLE_SIZE = 50;
-constexpr int MAX_TOKEN_LEN = 1024;
 constexpr int MIN_STL_LENGTH = 6;
 constexpr int FACET_NAME_LEN = 5;
 constexpr int VERTEX_PER_TRIANGLE = 3;
 constexpr int AXIS_PER_VERTEX = 3;
+constexpr int STL_COUNT_SIZE = 4;
+constexpr int STL_ATTRIBUTE_SIZE = 2;
+constexpr size_t STL_PARALLEL_MIN_BYTES = 1U << 20;
+constexpr size_t STL_WRITE_BLOCK_TRIANGLES = 1U << 16;
+constexpr size_t STL_ASCII_BLOCK_FACETS = 1U << 14;
+constexpr size_t STL_ASCII_FACET_SIZE = 320;
+constexpr size_t STL_NORMALS_BLOCK_TRIANGLES = 1U << 16;
+constexpr size_t STL_VERTEX_BLOCK_SIZE = 1U << 18;
+constexpr size_t STL_PIPE_BLOCK_TRIANGLES = 1U << 16;
+
+// decode a binary stl attribute into rgb values 0 - 1
+// the attribute holds 4 bits for each of r, g and b in bits 8 - 11,
+// 4 - 7 and 0 - 3, and bit 12 is set for a valid color
+// return true if the attribute holds a valid color
+bool stl_decode_attribute(uint16_t attribute, float rgb[3]);
+
+// encode rgb values 0 - 1 into a binary stl attribute
+// stl_decode_attribute gives back the values rounded to 4 bits
+uint16_t stl_encode_attribute(const float rgb[3]);
+
+// pack a triangle into a 50 byte binary stl record
+void stl_pack_triangle(char* dst, const float normal[3], const float vertices[9], uint16_t attribute);
+
+// rows of the inverse transpose of a row major 4 x 4 transform, up to
+// scale, for stl_simd_linear_normalize. Return the determinant
+float stl_normal_matrix(const float matrix[16], float normal_matrix[9]);
+
+// axis aligned bounding box
+// an empty box has min > max on an axis
+struct stl_aabb
+{
+    float min[3];
+    float max[3];
+
+    bool is_empty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+};
+
+// vector of the stl float data
+// allocated from the memory resource given to the stl
+using stl_float_vector = std::pmr::vector<float>;
+
+// what read_stl does with the memory of the previous stl
+// stl_reuse_capacity keeps it for the next stl, stl_release_capacity frees it
+enum stl_capacity_policy
+{
+    stl_reuse_capacity,
+    stl_release_capacity
+};
+
+// how read_stl uses the cache file next to a stl, see stl_cache.h
+// stl_cache_read loads a cache whose hash matches the stl and that is
+// quantized only when m_cache_quantized is set
+// stl_cache_update also writes the cache when it is missing or stale
+enum stl_cache_mode
+{
+    stl_cache_off,
+    stl_cache_read,
+    stl_cache_update
+};
+
+// layout of the vertex positions of a stl
+// stl_interleaved keeps them in m_vectors as x y z x y z ...
+// stl_soa keeps them in the separate arrays m_x, m_y and m_z
+enum stl_vertex_layout
+{
+    stl_interleaved,
+    stl_soa
+};
+
+// read only view of a binary stl file
+// the file is memory mapped and the 50 byte triangle
+// records are read in place without copying them
+class stl_binary_view
+{
+public:
+    bool open(const char* name);
+    void close();
+
+    uint32_t num_triangles() const { return m_num_triangles; }
+    const char* header() const { return m_map.data(); }
+    const char* record(uint32_t triangle) const
+    {
+        return m_map.data() + STL_HEADER_SIZE + STL_COUNT_SIZE + static_cast<size_t>(triangle) * STL_TRIANGLE_SIZE;
+    }
+
+    void normal(uint32_t triangle, float n[3]) const;
+    void vertex(uint32_t triangle, int vert, float v[3]) const;
+    uint16_t attribute(uint32_t triangle) const;
+
+private:
+    mapped_file m_map;
+    uint32_t m_num_triangles = 0;
+};
 
 class stl
 {
 public:
     uint32_t m_num_triangles;
-    std::vector<float> m_vectors;
-    std::vector<float> m_normals;
-    std::vector<float> m_rgb_color;
+    stl_float_vector m_vectors;
+
+    // vertex positions when m_layout is stl_soa, m_vectors is then empty
+    // corner c of triangle t is at index 3 * t + c
+    stl_float_vector m_x;
+    stl_float_vector m_y;
+    stl_float_vector m_z;
+
+    stl_float_vector m_normals;
+    stl_float_vector m_rgb_color;
     std::streamoff m_size;
     char m_header[STL_HEADER_SIZE] = { 0 };
 
+    // worker threads for large files, 0 = hardware concurrency, 1 = serial
+    unsigned m_num_threads = 0;
+
+    // overlap packing or parsing with file i/o on another thread
+    // read_stl then reads the file on a reader thread instead of mapping it
+    bool m_overlapped_io = false;
+
+    // layout of the vertex positions, read_stl fills this layout
+    // use to_soa or to_interleaved to change it on a filled stl
+    stl_vertex_layout m_layout = stl_interleaved;
+
+    // keep or free the vectors of the previous stl in read_stl
+    // the vectors are sized up front from the triangle count or the facets in the file
+    stl_capacity_policy m_capacity_policy = stl_reuse_capacity;
+
+    // load from and save to the indexed cache of the stl file
+    // m_cache_quantized writes 16 bit positions, which are not exact
+    stl_cache_mode m_cache_mode = stl_cache_off;
+    bool m_cache_quantized = false;
+
+    // statistics of the last read or create, see stl_stats.h
+    stl_stats m_stats;
+
+    // the vectors are allocated from resource, which is only used
+    // on the thread that calls the stl functions
     stl();
+    explicit stl(std::pmr::memory_resource* resource);
     ~stl();
 
+    std::pmr::memory_resource* resource() const { return m_vectors.get_allocator().resource(); }
+
     int read_stl(const char* name);
     int create_stl_binary(const char* name);
     int create_stl_ascii(const char* name);
+
+    // the same on memory and streams, streams are opened in binary mode
+    // data must hold the whole stl, name is used in the errors
+    int read_stl(const char* data, size_t size, const char* name = "stl data");
+    int read_stl(std::istream& in, const char* name = "stl stream");
+    int create_stl_binary(std::ostream& out);
+    int create_stl_ascii(std::ostream& out, const char* name = "stl");
     void calc_normals();
 
-    void normalizeAndCenter(float normal = 100.0)
-    {
-        // First pass: find min and max values for each axis to calculate center and range
-        float minX = m_vectors[0], maxX = m_vectors[0];
-        float minY = m_vectors[1], maxY = m_vectors[1];
-        float minZ = m_vectors[2], maxZ = m_vectors[2];
-
-        for (size_t i = 0; i < m_vectors.size(); i += 3) {
-            minX = std::min(minX, m_vectors[i]);
-            maxX = std::max(maxX, m_vectors[i]);
-
-            minY = std::min(minY, m_vectors[i + 1]);
-            maxY = std::max(maxY, m_vectors[i + 1]);
-
-            minZ = std::min(minZ, m_vectors[i + 2]);
-            maxZ = std::max(maxZ, m_vectors[i + 2]);
-        }
-
-        // Calculate center of the mesh
-        float centerX = (minX + maxX) / 2.0f;
-        float centerY = (minY + maxY) / 2.0f;
-        float centerZ = (minZ + maxZ) / 2.0f;
-
-        // Find the maximum range across all axes for uniform scaling
-        float rangeX = maxX - minX;
-        float rangeY = maxY - minY;
-        float rangeZ = maxZ - minZ;
-        float maxRange = std::max({ rangeX, rangeY, rangeZ });
-
-        if (maxRange == 0.0f) {
-            return;
-        }
-
-        // Normalize and center all vertices
-        float scale = normal / maxRange;  // Scale to fit in range
-
-        for (size_t i = 0; i < m_vectors.size(); i += 3) {
-            // Center by subtracting the center point
-            m_vectors[i] = (m_vectors[i] - centerX) * scale;
-            m_vectors[i + 1] = (m_vectors[i + 1] - centerY) * scale;
-            m_vectors[i + 2] = (m_vectors[i + 2] - centerZ) * scale;
-        }
-        // calc_normals();
-    }
+    void to_soa();
+    void to_interleaved();
+    size_t num_vertices() const { return m_layout == stl_soa ? m_x.size() : m_vectors.size() / AXIS_PER_VERTEX; }
+    const float* triangle_vertices(size_t triangle, float buffer[9]) const;
+
+    // bounds on m_num_threads threads or on threads, as the free
+    // functions that take a thread count do
+    stl_aabb bounds() const { return bounds(m_num_threads); }
+    stl_aabb bounds(unsigned threads) const;
+    void transform(const float matrix[16]);
+    void normalizeAndCenter(float normal = 100.0);
 
 private:
+    friend class stl_stream;
 
     enum sti_parse_state
     {
@@ -101,27 +211,38 @@ private:
         vertex_z,
         endloop,
         endfacet,
-        endsolid
+        endsolid,
+        done
     };
 
     std::string m_name;
-    std::ifstream m_stl_input_file;
     std::ofstream m_stl_output_file;
-    bool m_read_tok = true;
     sti_parse_state m_cur_state = solid;
-    char m_token[MAX_TOKEN_LEN] = { 0 };
 
     void cleanup();
-    int read_binary();
-    int read_ascii();
-    char* get_next_token();
-    char* read_line();
-    void read_facet_vertex();
-    void read_vertex();
-    bool validate_state(const char* msg);
-    bool open_read_common(std::ios_base::openmode mode);
-    bool open_binary();
-    bool open_ascii();
+#ifdef STL_ENABLE_STATS
+    void add_scan_stats(const stl_scan_counters& counters);
+    void note_peak(uint64_t extra_bytes);
+#endif
+    void split_vectors();
+    void join_vectors();
+    void pack_binary(char* dst, size_t first, size_t count) const;
+    void format_ascii(std::string& text, size_t first, size_t count) const;
+    void write_binary(std::ostream& out);
+    int write_ascii(std::ostream& out, const std::string& name);
+    int read_image(const char* data, size_t size);
+    int read_binary(const char* data, size_t size);
+    void size_binary(uint32_t num_triangles);
+    void decode_binary(const char* record, size_t first, size_t count, size_t& colors);
+    bool read_pipelined(const char* name);
+    int read_ascii(const char* data, size_t size);
+    bool read_ascii_parallel(const char* data, size_t size, unsigned threads);
+    size_t parse_ascii(stl_ascii_scanner& scan, sti_parse_state& state,
+        stl_float_vector& normals, stl_float_vector& vectors, size_t max_facets) const;
+    static bool is_ascii(const char* data, size_t size, bool* complete = nullptr);
+    static bool detect_ascii(const char* data, size_t size, uint64_t file_size, bool* complete = nullptr);
+    bool validate_state(const stl_ascii_scanner& scan, stl_ascii_scanner::keyword keyword,
+        const char* tok, sti_parse_state& state) const;
     bool open_write_common(std::ios_base::openmode mode);
     bool open_write_binary();
     bool open_write_ascii();
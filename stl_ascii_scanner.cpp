@@ -0,0 +1,210 @@
+// stl_ascii_scanner.cpp : tokenizer for ascii stl files
+//
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+#include "stl_ascii_scanner.h"
+
+// read from the stream
+size_t stl_istream_source::read(char* dst, size_t size)
+{
+    m_in.read(dst, static_cast<std::streamsize>(size));
+    return static_cast<size_t>(m_in.gcount());
+}
+
+// scan a range in memory
+stl_ascii_scanner::stl_ascii_scanner(const char* begin, const char* end)
+    : m_cur(begin), m_end(end), m_tok(begin)
+{
+}
+
+// scan a byte source through a read buffer
+stl_ascii_scanner::stl_ascii_scanner(stl_byte_source& source, size_t buffer_size)
+    : m_source(&source), m_buffer(buffer_size > 0 ? buffer_size : STL_SCAN_BUFFER_SIZE)
+{
+    m_cur = m_end = m_tok = m_buffer.data();
+}
+
+// refill
+// move the bytes from keep to the end of the buffer to the front
+// and read more from the source after them
+// keep and the current position are adjusted to the moved bytes
+// return false if there is nothing more to read
+bool stl_ascii_scanner::refill(const char*& keep)
+{
+    if (m_source == nullptr) {
+        return false;
+    }
+
+    auto remain = static_cast<size_t>(m_end - keep);
+    auto cur = static_cast<size_t>(m_cur - keep);
+    memmove(m_buffer.data(), keep, remain);
+
+    // a single token fills the whole buffer
+    if (remain == m_buffer.size()) {
+        m_buffer.resize(m_buffer.size() * 2);
+    }
+
+    auto count = m_source->read(m_buffer.data() + remain, m_buffer.size() - remain);
+    keep = m_buffer.data();
+    m_cur = keep + cur;
+    m_end = keep + remain + count;
+    return count > 0;
+}
+
+// set the current token and match it against the stl keywords
+void stl_ascii_scanner::set_token(const char* tok, size_t len)
+{
+    m_tok = tok;
+    m_tok_len = len;
+    m_keyword = kw_other;
+
+    switch (len) {
+        case 4:
+            if (memcmp(tok, "loop", 4) == 0) m_keyword = kw_loop;
+            break;
+
+        case 5:
+            if (memcmp(tok, "facet", 5) == 0) m_keyword = kw_facet;
+            else if (memcmp(tok, "solid", 5) == 0) m_keyword = kw_solid;
+            else if (memcmp(tok, "outer", 5) == 0) m_keyword = kw_outer;
+            break;
+
+        case 6:
+            if (memcmp(tok, "vertex", 6) == 0) m_keyword = kw_vertex;
+            else if (memcmp(tok, "normal", 6) == 0) m_keyword = kw_normal;
+            break;
+
+        case 7:
+            if (memcmp(tok, "endloop", 7) == 0) m_keyword = kw_endloop;
+            break;
+
+        case 8:
+            if (memcmp(tok, "endfacet", 8) == 0) m_keyword = kw_endfacet;
+            else if (memcmp(tok, "endsolid", 8) == 0) m_keyword = kw_endsolid;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// next_token
+// skip whitespace and read up to the next whitespace
+// the delimiter after the token is consumed
+// return false at end of input, the token is then empty
+bool stl_ascii_scanner::next_token()
+{
+    for (;;) {
+        while (m_cur < m_end && stl_is_space(*m_cur)) {
+            ++m_cur;
+        }
+        if (m_cur < m_end) {
+            break;
+        }
+        auto keep = m_cur;
+        if (!refill(keep)) {
+            set_token(m_cur, 0);
+            return false;
+        }
+    }
+
+    auto start = m_cur;
+    for (;;) {
+        while (m_cur < m_end && !stl_is_space(*m_cur)) {
+            ++m_cur;
+        }
+        if (m_cur < m_end || !refill(start)) {
+            break;
+        }
+    }
+    set_token(start, static_cast<size_t>(m_cur - start));
+    STL_STATS(++m_counters.tokens);
+
+    if (m_cur < m_end) {
+        ++m_cur;
+    }
+    return true;
+}
+
+// read_line
+// the rest of the line without leading whitespace becomes the token
+// the newline is consumed
+void stl_ascii_scanner::read_line()
+{
+    for (;;) {
+        while (m_cur < m_end && *m_cur != '\n' && stl_is_space(*m_cur)) {
+            ++m_cur;
+        }
+        if (m_cur < m_end) {
+            break;
+        }
+        auto keep = m_cur;
+        if (!refill(keep)) {
+            set_token(m_cur, 0);
+            return;
+        }
+    }
+
+    auto start = m_cur;
+    for (;;) {
+        while (m_cur < m_end && *m_cur != '\n') {
+            ++m_cur;
+        }
+        if (m_cur < m_end || !refill(start)) {
+            break;
+        }
+    }
+    set_token(start, static_cast<size_t>(m_cur - start));
+    STL_STATS(++m_counters.tokens);
+
+    if (m_cur < m_end) {
+        ++m_cur;
+    }
+}
+
+// at_end
+// skip whitespace
+// return true if there are no more tokens
+bool stl_ascii_scanner::at_end()
+{
+    for (;;) {
+        while (m_cur < m_end && stl_is_space(*m_cur)) {
+            ++m_cur;
+        }
+        if (m_cur < m_end) {
+            return false;
+        }
+        auto keep = m_cur;
+        if (!refill(keep)) {
+            return true;
+        }
+    }
+}
+
+// true if the token starts with prefix
+bool stl_ascii_scanner::token_starts_with(const char* prefix, size_t len) const
+{
+    return m_tok_len >= len && memcmp(m_tok, prefix, len) == 0;
+}
+
+// token_float
+// convert the token with from_chars
+// anything from_chars does not take completely (a leading '+', hex,
+// out of range or trailing garbage) goes through strtof so the
+// values are the same as before
+float stl_ascii_scanner::token_float() const
+{
+    STL_STATS(++m_counters.floats);
+    STL_STATS_TIME(m_counters.float_seconds);
+
+    auto value = 0.0f;
+    auto end = m_tok + m_tok_len;
+    auto result = std::from_chars(m_tok, end, value);
+    if (result.ec == std::errc() && result.ptr == end) {
+        return value;
+    }
+
+    return strtof(token_string().c_str(), nullptr);
+}
@@ -0,0 +1,100 @@
+// stl_ascii_scanner.h : tokenizer for ascii stl files
+//
+
+#ifndef STL_ASCII_SCANNER_H
+#define STL_ASCII_SCANNER_H
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "stl_stats.h"
+
+constexpr size_t STL_SCAN_BUFFER_SIZE = 1U << 20;
+
+// same characters as isspace in the "C" locale
+inline bool stl_is_space(char ch)
+{
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+// source of bytes for a buffered scanner
+class stl_byte_source
+{
+public:
+    virtual ~stl_byte_source() = default;
+
+    // read up to size bytes into dst
+    // return the number of bytes read, 0 at end of input
+    virtual size_t read(char* dst, size_t size) = 0;
+};
+
+// byte source reading from a stream
+class stl_istream_source : public stl_byte_source
+{
+public:
+    explicit stl_istream_source(std::istream& in) : m_in(in) {}
+    size_t read(char* dst, size_t size) override;
+
+private:
+    std::istream& m_in;
+};
+
+// scan whitespace separated tokens
+// either from a range in memory (a mapped file)
+// or from a byte source through a large read buffer
+//
+// a token stays valid until the next call to next_token or read_line
+class stl_ascii_scanner
+{
+public:
+    enum keyword
+    {
+        kw_other,
+        kw_solid,
+        kw_facet,
+        kw_normal,
+        kw_outer,
+        kw_loop,
+        kw_vertex,
+        kw_endloop,
+        kw_endfacet,
+        kw_endsolid
+    };
+
+    stl_ascii_scanner(const char* begin, const char* end);
+    explicit stl_ascii_scanner(stl_byte_source& source, size_t buffer_size = STL_SCAN_BUFFER_SIZE);
+
+    bool next_token();
+    void read_line();
+    bool at_end();
+    const char* position() const { return m_cur; }
+
+    const char* token() const { return m_tok; }
+    size_t token_length() const { return m_tok_len; }
+    keyword token_keyword() const { return m_keyword; }
+    std::string token_string() const { return std::string(m_tok, m_tok_len); }
+    bool token_starts_with(const char* prefix, size_t len) const;
+    float token_float() const;
+
+#ifdef STL_ENABLE_STATS
+    // tokens and floats of this scanner and the reallocations of its parser
+    mutable stl_scan_counters m_counters;
+#endif
+
+private:
+    const char* m_cur = nullptr;
+    const char* m_end = nullptr;
+    const char* m_tok = nullptr;
+    size_t m_tok_len = 0;
+    keyword m_keyword = kw_other;
+
+    stl_byte_source* m_source = nullptr;
+    std::vector<char> m_buffer;
+
+    bool refill(const char*& keep);
+    void set_token(const char* tok, size_t len);
+};
+
+#endif
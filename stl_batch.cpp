@@ -0,0 +1,51 @@
+// stl_batch.cpp : load many stl files on worker threads
+//
+#include <algorithm>
+#include <exception>
+
+#include "stl_batch.h"
+#include "stl_parallel.h"
+
+// load
+// read every file in names into m_results
+// errors are kept per file, return the number of files that failed
+size_t stl_batch_loader::load(const std::vector<std::string>& names)
+{
+    clear();
+    m_results.resize(names.size());
+    if (names.empty()) {
+        return 0;
+    }
+
+    auto threads = stl_thread_count(m_num_threads);
+    auto file_threads = std::max<size_t>(1, threads / names.size());
+
+    stl_parallel_for(names.size(), threads, [&](size_t index) {
+        auto& result = m_results[index];
+        result.name = names[index];
+        try {
+            std::unique_ptr<stl> mesh(new stl());
+            mesh->m_num_threads = static_cast<unsigned>(file_threads);
+            mesh->m_layout = m_layout;
+            mesh->m_overlapped_io = m_overlapped_io;
+            mesh->read_stl(result.name.c_str());
+            result.mesh = std::move(mesh);
+        }
+        catch (const std::exception& ex) {
+            result.error = ex.what();
+        }
+        catch (...) {
+            result.error = "Unknown error in read_stl.";
+        }
+    });
+
+    return static_cast<size_t>(std::count_if(m_results.begin(), m_results.end(),
+        [](const stl_batch_result& result) { return !result.mesh; }));
+}
+
+// clear
+// drop the results
+void stl_batch_loader::clear()
+{
+    m_results.clear();
+}
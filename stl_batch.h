@@ -0,0 +1,50 @@
+// stl_batch.h : load many stl files on worker threads
+//
+
+#ifndef STL_BATCH_H
+#define STL_BATCH_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+
+// a file loaded by stl_batch_loader
+// mesh is null and error holds the message when the file could not be read
+struct stl_batch_result
+{
+    std::string name;
+    std::unique_ptr<stl> mesh;
+    std::string error;
+};
+
+// stl_batch_loader
+// each file is read by its own stl on one of the worker threads, files
+// are handed out in order as the threads become free. With more files
+// than threads every file is read serially, with fewer the threads are
+// shared out so a few large files still use the whole machine.
+//
+//  stl_batch_loader loader;
+//  loader.load(names);
+//  for (auto& result : loader.m_results) {
+//      ...
+//  }
+class stl_batch_loader
+{
+public:
+    // one result per name, in the order of the names
+    std::vector<stl_batch_result> m_results;
+
+    // worker threads, 0 = hardware concurrency
+    unsigned m_num_threads = 0;
+
+    // settings copied to every stl before it is read
+    stl_vertex_layout m_layout = stl_interleaved;
+    bool m_overlapped_io = false;
+
+    size_t load(const std::vector<std::string>& names);
+    void clear();
+};
+
+#endif
@@ -0,0 +1,301 @@
+// stl_bench.cpp : benchmarks for the stl reader, writers and mesh functions
+//
+// Synthetic meshes (subdivided spheres and random triangle soups) are
+// generated from a fixed seed, written as binary and ascii stl files and
+// read back. The best time of each operation is reported as MB/s and
+// triangles/s and the results are written to a JSON file.
+//
+// usage: stl_bench [--max triangles] [--repeat count] [--threads count]
+//                  [--dir path] [--out results.json] [--keep]
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+#include "stl_parallel.h"
+#include "stl_simd.h"
+
+constexpr uint64_t BENCH_SEED = 0x5EED5EED2024ULL;
+constexpr size_t BENCH_SIZES[] = { 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+constexpr size_t BENCH_DEFAULT_MAX = 10000000;
+constexpr size_t BENCH_BLOCK_TRIANGLES = 1U << 16;
+
+// splitmix64, small and the same on every platform
+static uint64_t splitmix(uint64_t& state)
+{
+    auto z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// uniform float in [-1, 1)
+static float random_unit(uint64_t& state)
+{
+    return static_cast<float>(splitmix(state) >> 40) / static_cast<float>(1ULL << 23) - 1.0f;
+}
+
+// unit sphere from an octahedron with each face cut into a k x k grid
+// of triangles, 8 k^2 triangles in all
+static void make_sphere(stl& mesh, size_t triangles, unsigned threads)
+{
+    static const float corners[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    static const int faces[8][3] = { { 0, 2, 4 }, { 2, 1, 4 }, { 1, 3, 4 }, { 3, 0, 4 }, { 2, 0, 5 }, { 1, 2, 5 }, { 3, 1, 5 }, { 0, 3, 5 } };
+
+    auto k = std::max<size_t>(1, static_cast<size_t>(std::lround(std::sqrt(triangles / 8.0))));
+    mesh.m_vectors.resize(8 * k * k * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+
+    // row r of a face holds 2 r + 1 triangles and starts at triangle r^2
+    stl_parallel_for(8 * k, threads, [&](size_t task) {
+        auto face = faces[task / k];
+        auto row = task % k;
+        auto dst = &mesh.m_vectors[((task / k) * k * k + row * row) * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+
+        // point i, j of the face grid (i down from the top corner, j across)
+        auto point = [&](size_t i, size_t j, float* p) {
+            auto a = static_cast<float>(i) / k;
+            auto b = i == 0 ? 0.0f : a * static_cast<float>(j) / i;
+            float length = 0.0f;
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                p[ax] = corners[face[2]][ax] * (1.0f - a) + corners[face[0]][ax] * (a - b) + corners[face[1]][ax] * b;
+                length += p[ax] * p[ax];
+            }
+            length = std::sqrt(length);
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                p[ax] /= length;
+            }
+        };
+
+        for (size_t j = 0; j <= row; ++j) {
+            point(row, j, dst);
+            point(row + 1, j, dst + 3);
+            point(row + 1, j + 1, dst + 6);
+            dst += 9;
+            if (j < row) {
+                point(row, j, dst);
+                point(row + 1, j + 1, dst + 3);
+                point(row, j + 1, dst + 6);
+                dst += 9;
+            }
+        }
+    });
+}
+
+// small random triangles scattered through a cube
+static void make_soup(stl& mesh, size_t triangles, unsigned threads)
+{
+    mesh.m_vectors.resize(triangles * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+    stl_parallel_blocks(triangles, BENCH_BLOCK_TRIANGLES, threads, [&](size_t first, size_t count) {
+        uint64_t state = BENCH_SEED ^ (first * 0x9E3779B97F4A7C15ULL);
+        auto dst = &mesh.m_vectors[first * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+        for (size_t tri = 0; tri < count; ++tri) {
+            float center[3] = { random_unit(state) * 100.0f, random_unit(state) * 100.0f, random_unit(state) * 100.0f };
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX; ++i) {
+                *dst++ = center[i % AXIS_PER_VERTEX] + random_unit(state);
+            }
+        }
+    });
+}
+
+struct bench_result
+{
+    std::string mesh;
+    std::string operation;
+    std::string format;
+    size_t triangles;
+    uint64_t bytes;
+    double seconds;
+};
+
+static double elapsed(const std::function<void()>& task)
+{
+    auto start = std::chrono::steady_clock::now();
+    task();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// best time of repeat runs, setup runs before each one untimed
+static double best_time(int repeat, const std::function<void()>& setup, const std::function<void()>& task)
+{
+    auto best = 0.0;
+    for (auto run = 0; run < repeat; ++run) {
+        if (setup) {
+            setup();
+        }
+        auto seconds = elapsed(task);
+        if (run == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static uint64_t file_size(const std::string& name)
+{
+    std::ifstream file(name, std::ios::binary | std::ios::ate);
+    return file.is_open() ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+static const char* simd_name(stl_simd_level level)
+{
+    switch (level) {
+        case stl_simd_avx2:
+            return "avx2";
+        case stl_simd_sse:
+            return "sse";
+        default:
+            return "scalar";
+    }
+}
+
+static void write_json(const std::string& name, const std::vector<bench_result>& results, unsigned threads, int repeat)
+{
+    std::ofstream out(name, std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error(std::string("Unable to open benchmark output file ") + name + ".");
+    }
+
+    out << std::setprecision(6);
+    out << "{\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"simd\": \"" << simd_name(stl_simd_active()) << "\",\n";
+    out << "  \"repeat\": " << repeat << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        out << "    { \"mesh\": \"" << r.mesh << "\", \"operation\": \"" << r.operation <<
+            "\", \"format\": \"" << r.format << "\", \"triangles\": " << r.triangles <<
+            ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.seconds <<
+            ", \"mb_per_s\": " << r.bytes / 1.0e6 / r.seconds <<
+            ", \"triangles_per_s\": " << r.triangles / r.seconds << " }" <<
+            (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// run every benchmark on one mesh
+static void bench_mesh(const char* shape, stl& source, const std::string& dir, int repeat, unsigned threads, bool keep,
+    std::vector<bench_result>& results)
+{
+    auto triangles = source.m_vectors.size() / (VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+    auto memory = static_cast<uint64_t>(source.m_vectors.size() * sizeof(float));
+    auto base = dir + "/bench_" + shape + "_" + std::to_string(triangles);
+    auto binary = base + "_bin.stl";
+    auto ascii = base + "_ascii.stl";
+
+    auto report = [&](const char* operation, const char* format, uint64_t bytes, double seconds) {
+        results.push_back({ shape, operation, format, triangles, bytes, seconds });
+        std::cout << std::setw(8) << shape << std::setw(11) << triangles << "  " <<
+            std::left << std::setw(20) << operation << std::setw(8) << format << std::right <<
+            std::fixed << std::setprecision(1) << std::setw(10) << bytes / 1.0e6 / seconds << " MB/s" <<
+            std::setprecision(0) << std::setw(14) << triangles / seconds << " tri/s\n";
+    };
+
+    source.m_num_threads = threads;
+    report("calc_normals", "memory", memory, best_time(repeat, nullptr, [&]() { source.calc_normals(); }));
+
+    report("create_stl_binary", "binary", 84 + 50ULL * triangles,
+        best_time(repeat, nullptr, [&]() { source.create_stl_binary(binary.c_str()); }));
+    auto seconds = best_time(repeat, nullptr, [&]() { source.create_stl_ascii(ascii.c_str()); });
+    report("create_stl_ascii", "ascii", file_size(ascii), seconds);
+
+    stl mesh;
+    mesh.m_num_threads = threads;
+    report("read_stl", "binary", file_size(binary), best_time(repeat, nullptr, [&]() { mesh.read_stl(binary.c_str()); }));
+    report("read_stl", "ascii", file_size(ascii), best_time(repeat, nullptr, [&]() { mesh.read_stl(ascii.c_str()); }));
+
+    stl_float_vector loaded = mesh.m_vectors;
+    report("normalizeAndCenter", "memory", memory,
+        best_time(repeat, [&]() { mesh.m_vectors = loaded; }, [&]() { mesh.normalizeAndCenter(); }));
+
+    if (!keep) {
+        std::remove(binary.c_str());
+        std::remove(ascii.c_str());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t max_triangles = BENCH_DEFAULT_MAX;
+    auto repeat = 3;
+    unsigned threads = 0;
+    std::string dir = ".";
+    std::string out = "stl_bench.json";
+    auto keep = false;
+
+    for (auto arg = 1; arg < argc; ++arg) {
+        std::string option = argv[arg];
+        auto value = [&]() -> std::string {
+            if (arg + 1 >= argc) {
+                std::cerr << "Missing value for " << option << std::endl;
+                exit(1);
+            }
+            return argv[++arg];
+        };
+
+        if (option == "--max") {
+            max_triangles = std::stoull(value());
+        }
+        else if (option == "--repeat") {
+            repeat = std::max(1, std::stoi(value()));
+        }
+        else if (option == "--threads") {
+            threads = static_cast<unsigned>(std::stoul(value()));
+        }
+        else if (option == "--dir") {
+            dir = value();
+        }
+        else if (option == "--out") {
+            out = value();
+        }
+        else if (option == "--keep") {
+            keep = true;
+        }
+        else {
+            std::cerr << "usage: stl_bench [--max triangles] [--repeat count] [--threads count]"
+                " [--dir path] [--out results.json] [--keep]" << std::endl;
+            return 1;
+        }
+    }
+
+    threads = stl_thread_count(threads);
+    std::cout << "threads " << threads << "  simd " << simd_name(stl_simd_active()) << "\n";
+
+    std::vector<bench_result> results;
+    try {
+        for (auto size : BENCH_SIZES) {
+            if (size > max_triangles) {
+                break;
+            }
+
+            stl sphere;
+            strcpy(sphere.m_header, "stl_bench sphere");
+            make_sphere(sphere, size, threads);
+            bench_mesh("sphere", sphere, dir, repeat, threads, keep, results);
+            sphere.m_vectors.clear();
+            sphere.m_vectors.shrink_to_fit();
+
+            stl soup;
+            strcpy(soup.m_header, "stl_bench soup");
+            make_soup(soup, size, threads);
+            bench_mesh("soup", soup, dir, repeat, threads, keep, results);
+        }
+        write_json(out, results, threads, repeat);
+    } catch (const std::exception& ex) {
+        std::cerr << "Error in stl_bench: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
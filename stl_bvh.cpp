@@ -0,0 +1,545 @@
+// stl_bvh.cpp : bounding volume hierarchy over the triangles of a stl
+//
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "stl_bvh.h"
+#include "stl_parallel.h"
+#include "stl_simd.h"
+
+namespace
+{
+    constexpr auto INF = std::numeric_limits<float>::infinity();
+    constexpr size_t BLOCK_FLOATS = VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX * STL_BVH_LEAF_SIZE;
+
+    // bounds and centroid of a triangle
+    struct primitive
+    {
+        float min[3];
+        float max[3];
+        float centroid[3];
+    };
+
+    struct box
+    {
+        float min[3] = { INF, INF, INF };
+        float max[3] = { -INF, -INF, -INF };
+
+        void grow(const float lo[3], const float hi[3])
+        {
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                min[ax] = std::min(min[ax], lo[ax]);
+                max[ax] = std::max(max[ax], hi[ax]);
+            }
+        }
+
+        // half the surface area
+        float area() const
+        {
+            if (min[0] > max[0]) {
+                return 0.0f;
+            }
+            auto dx = max[0] - min[0];
+            auto dy = max[1] - min[1];
+            auto dz = max[2] - min[2];
+            return dx * dy + dy * dz + dz * dx;
+        }
+    };
+
+    // a node and the range of the triangle order it covers
+    struct range
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t depth;
+    };
+
+    // builds the nodes of one subtree
+    // the triangle order is shared, each subtree works on its own range of it
+    class bvh_builder
+    {
+    public:
+        std::vector<stl_bvh::node> m_nodes;
+
+        bvh_builder(const std::vector<primitive>& prims, uint32_t* order)
+            : m_nodes(1), m_prims(prims), m_order(order)
+        {
+        }
+
+        // build the whole subtree of r
+        void build(const range& r)
+        {
+            std::vector<range> stack(1, r);
+            while (!stack.empty()) {
+                auto cur = stack.back();
+                stack.pop_back();
+                range left, right;
+                if (split(cur, left, right)) {
+                    stack.push_back(right);
+                    stack.push_back(left);
+                }
+            }
+        }
+
+        // set the bounds of the node of r and split it in 2
+        // return false when the node is a leaf
+        bool split(const range& r, range& left, range& right)
+        {
+            box bounds, centroids;
+            for (auto i = r.begin; i < r.end; ++i) {
+                auto& prim = m_prims[m_order[i]];
+                bounds.grow(prim.min, prim.max);
+                centroids.grow(prim.centroid, prim.centroid);
+            }
+
+            auto& node = m_nodes[r.node];
+            std::copy(bounds.min, bounds.min + AXIS_PER_VERTEX, node.min);
+            std::copy(bounds.max, bounds.max + AXIS_PER_VERTEX, node.max);
+
+            auto count = r.end - r.begin;
+            if (count <= STL_BVH_LEAF_SIZE) {
+                node.first = r.begin;
+                node.count = count;
+                return false;
+            }
+
+            // deep trees fall back to median splits, which keeps the depth
+            // below STL_BVH_MAX_DEPTH for any number of triangles
+            auto mid = r.depth < STL_BVH_MAX_DEPTH - 40 ? sah_split(r, centroids) : r.begin;
+            if (mid == r.begin || mid == r.end) {
+                mid = median_split(r, centroids);
+            }
+
+            auto children = static_cast<uint32_t>(m_nodes.size());
+            m_nodes[r.node].first = children;
+            m_nodes[r.node].count = 0;
+            m_nodes.resize(m_nodes.size() + 2);
+
+            left = { children, r.begin, mid, r.depth + 1 };
+            right = { children + 1, mid, r.end, r.depth + 1 };
+            return true;
+        }
+
+    private:
+        const std::vector<primitive>& m_prims;
+        uint32_t* m_order;
+
+        // nan and values outside the bins are clamped before the cast to int,
+        // a nan or infinite centroid goes into the first or last bin
+        static int bin_of(float centroid, float min, float scale)
+        {
+            auto bin = (centroid - min) * scale;
+            if (!(bin > 0.0f)) {
+                return 0;
+            }
+            return bin < STL_BVH_BINS - 1 ? static_cast<int>(bin) : STL_BVH_BINS - 1;
+        }
+
+        // nan centroids sort after all the others
+        static bool centroid_less(float a, float b)
+        {
+            return !std::isnan(a) && (std::isnan(b) || a < b);
+        }
+
+        // binned surface area heuristic
+        // return the end of the left half, or r.begin when no split was found
+        uint32_t sah_split(const range& r, const box& centroids)
+        {
+            auto best_axis = -1;
+            auto best_bin = 0;
+            auto best_cost = INF;
+
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                auto extent = centroids.max[ax] - centroids.min[ax];
+                if (!(extent > 0.0f) || !std::isfinite(extent)) {
+                    continue;
+                }
+                auto scale = STL_BVH_BINS / extent;
+
+                box bins[STL_BVH_BINS];
+                uint32_t counts[STL_BVH_BINS] = { 0 };
+                for (auto i = r.begin; i < r.end; ++i) {
+                    auto& prim = m_prims[m_order[i]];
+                    auto bin = bin_of(prim.centroid[ax], centroids.min[ax], scale);
+                    ++counts[bin];
+                    bins[bin].grow(prim.min, prim.max);
+                }
+
+                // cost of splitting after bin i
+                float left_area[STL_BVH_BINS];
+                uint32_t left_count[STL_BVH_BINS];
+                box sweep;
+                uint32_t total = 0;
+                for (auto i = 0; i < STL_BVH_BINS - 1; ++i) {
+                    sweep.grow(bins[i].min, bins[i].max);
+                    total += counts[i];
+                    left_area[i] = sweep.area();
+                    left_count[i] = total;
+                }
+
+                sweep = box();
+                total = 0;
+                for (auto i = STL_BVH_BINS - 1; i > 0; --i) {
+                    sweep.grow(bins[i].min, bins[i].max);
+                    total += counts[i];
+                    auto cost = left_area[i - 1] * left_count[i - 1] + sweep.area() * total;
+                    if (left_count[i - 1] > 0 && total > 0 && cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = ax;
+                        best_bin = i - 1;
+                    }
+                }
+            }
+
+            if (best_axis < 0) {
+                return r.begin;
+            }
+
+            auto min = centroids.min[best_axis];
+            auto scale = STL_BVH_BINS / (centroids.max[best_axis] - min);
+            auto mid = std::partition(m_order + r.begin, m_order + r.end, [&](uint32_t tri) {
+                return bin_of(m_prims[tri].centroid[best_axis], min, scale) <= best_bin;
+            });
+            return static_cast<uint32_t>(mid - m_order);
+        }
+
+        // split in the middle of the order along the widest axis
+        uint32_t median_split(const range& r, const box& centroids)
+        {
+            auto axis = 0;
+            for (auto ax = 1; ax < AXIS_PER_VERTEX; ++ax) {
+                if (centroids.max[ax] - centroids.min[ax] > centroids.max[axis] - centroids.min[axis]) {
+                    axis = ax;
+                }
+            }
+
+            auto mid = r.begin + (r.end - r.begin) / 2;
+            std::nth_element(m_order + r.begin, m_order + mid, m_order + r.end, [&](uint32_t a, uint32_t b) {
+                return centroid_less(m_prims[a].centroid[axis], m_prims[b].centroid[axis]);
+            });
+            return mid;
+        }
+    };
+
+    // enter distance of a ray into a node
+    // nan from a ray on the plane of a side is left out
+    inline bool hit_node(const stl_bvh::node& node, const float origin[3], const float inv[3],
+        float t_min, float t_max, float& t_enter)
+    {
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            auto t0 = (node.min[ax] - origin[ax]) * inv[ax];
+            auto t1 = (node.max[ax] - origin[ax]) * inv[ax];
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        t_enter = t_min;
+        return t_min <= t_max;
+    }
+
+    inline float node_distance_squared(const stl_bvh::node& node, const float p[3])
+    {
+        auto d2 = 0.0f;
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            auto d = std::max({ node.min[ax] - p[ax], 0.0f, p[ax] - node.max[ax] });
+            d2 += d * d;
+        }
+        return d2;
+    }
+
+    inline float dot(const float a[3], const float b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // closest point to p on the triangle a b c
+    // Ericson, Real-Time Collision Detection 5.1.5
+    void closest_on_triangle(const float p[3], const float a[3], const float b[3], const float c[3], float q[3])
+    {
+        float ab[3], ac[3], ap[3], bp[3], cp[3];
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            ab[ax] = b[ax] - a[ax];
+            ac[ax] = c[ax] - a[ax];
+            ap[ax] = p[ax] - a[ax];
+            bp[ax] = p[ax] - b[ax];
+            cp[ax] = p[ax] - c[ax];
+        }
+
+        auto set = [&](const float* origin, const float* edge0, float s, const float* edge1, float t) {
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                q[ax] = origin[ax] + (edge0 ? edge0[ax] * s : 0.0f) + (edge1 ? edge1[ax] * t : 0.0f);
+            }
+        };
+
+        auto d1 = dot(ab, ap);
+        auto d2 = dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) {
+            return set(a, nullptr, 0.0f, nullptr, 0.0f);
+        }
+
+        auto d3 = dot(ab, bp);
+        auto d4 = dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) {
+            return set(b, nullptr, 0.0f, nullptr, 0.0f);
+        }
+
+        auto vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+            return set(a, ab, d1 / (d1 - d3), nullptr, 0.0f);
+        }
+
+        auto d5 = dot(ab, cp);
+        auto d6 = dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) {
+            return set(c, nullptr, 0.0f, nullptr, 0.0f);
+        }
+
+        auto vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+            return set(a, ac, d2 / (d2 - d6), nullptr, 0.0f);
+        }
+
+        auto va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+            float bc[3] = { c[0] - b[0], c[1] - b[1], c[2] - b[2] };
+            return set(b, bc, (d4 - d3) / ((d4 - d3) + (d5 - d6)), nullptr, 0.0f);
+        }
+
+        auto denom = 1.0f / (va + vb + vc);
+        set(a, ab, vb * denom, ac, vc * denom);
+    }
+}
+
+// build
+// build the hierarchy over the triangles of mesh
+// the top of the tree is split on the calling thread and the
+// subtrees below it are built on the worker threads
+// threads 0 uses the hardware concurrency
+int stl_bvh::build(const stl& mesh, unsigned threads)
+{
+    clear();
+
+    auto triangles = mesh.num_vertices() / VERTEX_PER_TRIANGLE;
+    if (triangles >= STL_BVH_NO_TRIANGLE) {
+        throw std::runtime_error("stl has too many triangles for 32 bit indices.");
+    }
+    if (triangles == 0) {
+        return 0;
+    }
+    auto n = static_cast<uint32_t>(triangles);
+    threads = stl_thread_count(threads);
+
+    std::vector<primitive> prims(n);
+    std::vector<uint32_t> order(n);
+    stl_parallel_blocks(n, STL_VERTEX_BLOCK_SIZE, threads, [&](size_t first, size_t count) {
+        float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+        for (auto tri = first; tri < first + count; ++tri) {
+            auto v = mesh.triangle_vertices(tri, buffer);
+            auto& prim = prims[tri];
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                prim.min[ax] = std::min({ v[ax], v[3 + ax], v[6 + ax] });
+                prim.max[ax] = std::max({ v[ax], v[3 + ax], v[6 + ax] });
+                prim.centroid[ax] = (v[ax] + v[3 + ax] + v[6 + ax]) / 3.0f;
+            }
+            order[tri] = static_cast<uint32_t>(tri);
+        }
+    });
+
+    // split the top of the tree until the ranges are small enough
+    // to give every thread a few subtrees
+    bvh_builder top(prims, order.data());
+    std::vector<range> tasks;
+    std::vector<range> pending(1, { 0, 0, n, 0 });
+    auto task_size = threads > 1 && n >= STL_BVH_PARALLEL_MIN_TRIANGLES ? n / (threads * 4) : n;
+    for (size_t i = 0; i < pending.size(); ++i) {
+        auto cur = pending[i];
+        range left, right;
+        if (cur.end - cur.begin <= task_size) {
+            tasks.push_back(cur);
+        }
+        else if (top.split(cur, left, right)) {
+            pending.push_back(left);
+            pending.push_back(right);
+        }
+    }
+
+    std::vector<std::vector<node>> subtrees(tasks.size());
+    stl_parallel_for(tasks.size(), threads, [&](size_t task) {
+        bvh_builder sub(prims, order.data());
+        sub.build({ 0, tasks[task].begin, tasks[task].end, tasks[task].depth });
+        subtrees[task].swap(sub.m_nodes);
+    });
+
+    // the root of a subtree takes the place of its task node and
+    // the rest of the subtree is appended
+    m_nodes.swap(top.m_nodes);
+    for (size_t task = 0; task < tasks.size(); ++task) {
+        auto& sub = subtrees[task];
+        auto base = static_cast<uint32_t>(m_nodes.size()) - 1;
+        for (auto& node : sub) {
+            if (node.count == 0) {
+                node.first += base;
+            }
+        }
+        m_nodes[tasks[task].node] = sub[0];
+        m_nodes.insert(m_nodes.end(), sub.begin() + 1, sub.end());
+        std::vector<node>().swap(sub);
+    }
+
+    // number the leaves and copy their triangles into blocks
+    std::vector<uint32_t> leaves;
+    for (uint32_t i = 0; i < m_nodes.size(); ++i) {
+        if (m_nodes[i].count > 0) {
+            leaves.push_back(i);
+        }
+    }
+    m_blocks.assign(leaves.size() * BLOCK_FLOATS, std::numeric_limits<float>::quiet_NaN());
+    m_block_triangles.assign(leaves.size() * STL_BVH_LEAF_SIZE, STL_BVH_NO_TRIANGLE);
+
+    stl_parallel_blocks(leaves.size(), STL_VERTEX_BLOCK_SIZE / STL_BVH_LEAF_SIZE, threads, [&](size_t first, size_t count) {
+        float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+        for (auto block = first; block < first + count; ++block) {
+            auto& node = m_nodes[leaves[block]];
+            auto dst = &m_blocks[block * BLOCK_FLOATS];
+            for (uint32_t lane = 0; lane < node.count; ++lane) {
+                auto tri = order[node.first + lane];
+                auto v = mesh.triangle_vertices(tri, buffer);
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX; ++i) {
+                    dst[i * STL_BVH_LEAF_SIZE + lane] = v[i];
+                }
+                m_block_triangles[block * STL_BVH_LEAF_SIZE + lane] = tri;
+            }
+            node.first = static_cast<uint32_t>(block);
+        }
+    });
+    return 0;
+}
+
+// clear
+// drop the nodes and blocks
+void stl_bvh::clear()
+{
+    m_nodes.clear();
+    m_blocks.clear();
+    m_block_triangles.clear();
+}
+
+// intersect
+// nearest triangle hit by the ray
+// return false when nothing is hit
+bool stl_bvh::intersect(const stl_ray& ray, stl_ray_hit& hit) const
+{
+    hit = { STL_BVH_NO_TRIANGLE, ray.t_max, 0.0f, 0.0f };
+
+    float inv[3];
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        inv[ax] = 1.0f / ray.direction[ax];
+    }
+
+    float enter;
+    if (m_nodes.empty() || !hit_node(m_nodes[0], ray.origin, inv, ray.t_min, hit.t, enter)) {
+        return false;
+    }
+
+    uint32_t stack[STL_BVH_MAX_DEPTH + 1];
+    auto top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        auto& node = m_nodes[stack[--top]];
+        if (node.count > 0) {
+            float t, u, v;
+            auto lane = stl_simd_intersect_block(&m_blocks[node.first * BLOCK_FLOATS], ray.origin, ray.direction,
+                ray.t_min, hit.t, t, u, v);
+            if (lane >= 0) {
+                hit = { m_block_triangles[node.first * STL_BVH_LEAF_SIZE + lane], t, u, v };
+            }
+            continue;
+        }
+
+        // the nearer child is visited first
+        float t0, t1;
+        auto hit0 = hit_node(m_nodes[node.first], ray.origin, inv, ray.t_min, hit.t, t0);
+        auto hit1 = hit_node(m_nodes[node.first + 1], ray.origin, inv, ray.t_min, hit.t, t1);
+        if (hit0 && hit1) {
+            stack[top++] = t0 <= t1 ? node.first + 1 : node.first;
+            stack[top++] = t0 <= t1 ? node.first : node.first + 1;
+        }
+        else if (hit0 || hit1) {
+            stack[top++] = hit0 ? node.first : node.first + 1;
+        }
+    }
+    return hit.triangle != STL_BVH_NO_TRIANGLE;
+}
+
+// closest_point
+// point of the mesh closest to point
+// return false when the hierarchy is empty
+bool stl_bvh::closest_point(const float point[3], stl_closest_point& closest) const
+{
+    closest = { STL_BVH_NO_TRIANGLE, { 0.0f, 0.0f, 0.0f }, INF };
+    if (m_nodes.empty()) {
+        return false;
+    }
+
+    uint32_t stack[STL_BVH_MAX_DEPTH + 1];
+    auto top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        auto& node = m_nodes[stack[--top]];
+        if (node_distance_squared(node, point) >= closest.distance_squared) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            auto block = &m_blocks[node.first * BLOCK_FLOATS];
+            for (uint32_t lane = 0; lane < node.count; ++lane) {
+                float v[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX], q[3];
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX; ++i) {
+                    v[i] = block[i * STL_BVH_LEAF_SIZE + lane];
+                }
+                closest_on_triangle(point, v, v + 3, v + 6, q);
+                float d[3] = { q[0] - point[0], q[1] - point[1], q[2] - point[2] };
+                auto d2 = dot(d, d);
+                if (d2 < closest.distance_squared) {
+                    closest.triangle = m_block_triangles[node.first * STL_BVH_LEAF_SIZE + lane];
+                    std::copy(q, q + AXIS_PER_VERTEX, closest.point);
+                    closest.distance_squared = d2;
+                }
+            }
+            continue;
+        }
+
+        // the nearer child is visited first
+        auto d0 = node_distance_squared(m_nodes[node.first], point);
+        auto d1 = node_distance_squared(m_nodes[node.first + 1], point);
+        stack[top++] = d0 <= d1 ? node.first + 1 : node.first;
+        stack[top++] = d0 <= d1 ? node.first : node.first + 1;
+    }
+    return closest.triangle != STL_BVH_NO_TRIANGLE;
+}
+
+// intersect
+// nearest hits of count rays
+void stl_bvh::intersect(const stl_ray* rays, stl_ray_hit* hits, size_t count, unsigned threads) const
+{
+    stl_parallel_blocks(count, STL_BVH_QUERY_BLOCK, stl_thread_count(threads), [&](size_t first, size_t n) {
+        for (auto i = first; i < first + n; ++i) {
+            intersect(rays[i], hits[i]);
+        }
+    });
+}
+
+// closest_points
+// closest points of count xyz points
+void stl_bvh::closest_points(const float* points, stl_closest_point* closest, size_t count, unsigned threads) const
+{
+    stl_parallel_blocks(count, STL_BVH_QUERY_BLOCK, stl_thread_count(threads), [&](size_t first, size_t n) {
+        for (auto i = first; i < first + n; ++i) {
+            closest_point(&points[i * AXIS_PER_VERTEX], closest[i]);
+        }
+    });
+}
@@ -0,0 +1,82 @@
+// stl_bvh.h : bounding volume hierarchy over the triangles of a stl
+//
+
+#ifndef STL_BVH_H
+#define STL_BVH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "stl.h"
+
+constexpr int STL_BVH_BINS = 16;
+constexpr uint32_t STL_BVH_LEAF_SIZE = 4;
+constexpr uint32_t STL_BVH_NO_TRIANGLE = 0xFFFFFFFFU;
+constexpr int STL_BVH_MAX_DEPTH = 96;
+constexpr size_t STL_BVH_PARALLEL_MIN_TRIANGLES = 1U << 14;
+constexpr size_t STL_BVH_QUERY_BLOCK = 1U << 10;
+
+// a ray hits a triangle at origin + t * direction with t_min < t < t_max
+struct stl_ray
+{
+    float origin[3];
+    float direction[3];
+    float t_min = 0.0f;
+    float t_max = std::numeric_limits<float>::infinity();
+};
+
+// triangle is STL_BVH_NO_TRIANGLE when nothing was hit
+// u and v are the barycentric coordinates of vertices 1 and 2
+struct stl_ray_hit
+{
+    uint32_t triangle;
+    float t;
+    float u;
+    float v;
+};
+
+// the point of the mesh closest to a query point
+struct stl_closest_point
+{
+    uint32_t triangle;
+    float point[3];
+    float distance_squared;
+};
+
+// stl_bvh
+// binned SAH hierarchy stored as a flat array of nodes.
+// The 2 children of a node are next to each other and every leaf
+// holds up to 4 triangles in a block laid out for stl_simd_intersect_block.
+// Triangle numbers are the triangle numbers of the stl.
+class stl_bvh
+{
+public:
+    // interior nodes have count 0 and their children at first and first + 1
+    // leaves have count triangles in block first
+    struct node
+    {
+        float min[3];
+        uint32_t first;
+        float max[3];
+        uint32_t count;
+    };
+
+    std::vector<node> m_nodes;
+    std::vector<float> m_blocks;
+    std::vector<uint32_t> m_block_triangles;
+
+    int build(const stl& mesh, unsigned threads = 0);
+    void clear();
+
+    bool intersect(const stl_ray& ray, stl_ray_hit& hit) const;
+    bool closest_point(const float point[3], stl_closest_point& closest) const;
+
+    // batched queries split over the worker threads
+    void intersect(const stl_ray* rays, stl_ray_hit* hits, size_t count, unsigned threads = 0) const;
+    void closest_points(const float* points, stl_closest_point* closest, size_t count, unsigned threads = 0) const;
+
+    size_t num_blocks() const { return m_block_triangles.size() / STL_BVH_LEAF_SIZE; }
+};
+
+#endif
@@ -0,0 +1,377 @@
+// stl_cache.cpp : indexed cache files for fast stl reloads
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "stl_cache.h"
+#include "stl_parallel.h"
+
+namespace
+{
+    const char STL_CACHE_MAGIC[8] = { 'S', 'T', 'L', 'C', 'A', 'C', 'H', 'E' };
+
+    constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64_t rotl(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    inline uint64_t read64(const char* p)
+    {
+        uint64_t value = 0;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline uint64_t mix_round(uint64_t acc, uint64_t input)
+    {
+        return rotl(acc + input * PRIME2, 31) * PRIME1;
+    }
+
+    inline uint64_t mix_merge(uint64_t acc, uint64_t value)
+    {
+        return (acc ^ mix_round(0, value)) * PRIME1 + PRIME4;
+    }
+
+    // xxhash64
+    uint64_t hash64(const char* data, size_t size, uint64_t seed)
+    {
+        auto p = data;
+        auto end = data + size;
+        uint64_t h = 0;
+
+        if (size >= 32) {
+            uint64_t v[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+            for (; end - p >= 32; p += 32) {
+                for (auto lane = 0; lane < 4; ++lane) {
+                    v[lane] = mix_round(v[lane], read64(p + lane * 8));
+                }
+            }
+            h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+            for (auto lane = 0; lane < 4; ++lane) {
+                h = mix_merge(h, v[lane]);
+            }
+        }
+        else {
+            h = seed + PRIME5;
+        }
+        h += size;
+
+        for (; end - p >= 8; p += 8) {
+            h = rotl(h ^ mix_round(0, read64(p)), 27) * PRIME1 + PRIME4;
+        }
+        if (end - p >= 4) {
+            uint32_t word = 0;
+            memcpy(&word, p, sizeof(word));
+            h = rotl(h ^ (word * PRIME1), 23) * PRIME2 + PRIME3;
+            p += 4;
+        }
+        for (; p < end; ++p) {
+            h = rotl(h ^ (static_cast<uint8_t>(*p) * PRIME5), 11) * PRIME1;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    inline uint64_t align_up(uint64_t offset)
+    {
+        return (offset + STL_CACHE_ALIGN - 1) / STL_CACHE_ALIGN * STL_CACHE_ALIGN;
+    }
+
+    // offsets of the sections after the header
+    struct cache_layout
+    {
+        uint64_t vertices;
+        uint64_t indices;
+        uint64_t normals;
+        uint64_t colors;
+        uint64_t size;
+
+        cache_layout(const stl_cache_header& header)
+        {
+            auto vertex_size = (header.flags & STL_CACHE_QUANTIZED) != 0 ? sizeof(uint16_t) : sizeof(float);
+            auto corners = static_cast<uint64_t>(header.num_triangles) * VERTEX_PER_TRIANGLE;
+            vertices = align_up(sizeof(stl_cache_header));
+            indices = align_up(vertices + static_cast<uint64_t>(header.num_vertices) * AXIS_PER_VERTEX * vertex_size);
+            normals = align_up(indices + corners * sizeof(uint32_t));
+            colors = align_up(normals + static_cast<uint64_t>(header.num_triangles) * AXIS_PER_VERTEX * sizeof(float));
+            size = colors + header.num_colors * sizeof(float);
+        }
+    };
+}
+
+// stl_content_hash
+// hash of the stl file contents, used to match a cache to its source
+uint64_t stl_content_hash(const char* data, size_t size, unsigned threads)
+{
+    std::vector<uint64_t> blocks((size + STL_CACHE_HASH_BLOCK - 1) / STL_CACHE_HASH_BLOCK);
+    stl_parallel_for(blocks.size(), stl_thread_count(threads), [&](size_t block) {
+        auto first = block * STL_CACHE_HASH_BLOCK;
+        blocks[block] = hash64(data + first, std::min(STL_CACHE_HASH_BLOCK, size - first), block);
+    });
+    return hash64(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(uint64_t), size);
+}
+
+// stl_cache_name
+// the cache of part.stl is part.stl.stlc
+std::string stl_cache_name(const char* name)
+{
+    return std::string(name) + ".stlc";
+}
+
+// open
+// map a cache file
+// return false if the file does not exist or is not a valid cache
+bool stl_cache::open(const char* name)
+{
+    close();
+    try {
+        m_map.open(name);
+    }
+    catch (const std::runtime_error&) {
+        return false;
+    }
+
+    if (m_map.size() < sizeof(stl_cache_header) || memcmp(header().magic, STL_CACHE_MAGIC, sizeof(STL_CACHE_MAGIC)) != 0 ||
+        header().version != STL_CACHE_VERSION || (header().flags & ~STL_CACHE_QUANTIZED) != 0) {
+        close();
+        return false;
+    }
+
+    cache_layout layout(header());
+    if (layout.size != m_map.size() || header().num_colors % AXIS_PER_VERTEX != 0 ||
+        header().num_colors > static_cast<uint64_t>(header().num_triangles) * AXIS_PER_VERTEX) {
+        close();
+        return false;
+    }
+
+    m_vertices = m_map.data() + layout.vertices;
+    m_indices = reinterpret_cast<const uint32_t*>(m_map.data() + layout.indices);
+    m_normals = reinterpret_cast<const float*>(m_map.data() + layout.normals);
+    m_colors = reinterpret_cast<const float*>(m_map.data() + layout.colors);
+
+    auto corners = static_cast<size_t>(num_triangles()) * VERTEX_PER_TRIANGLE;
+    if (std::any_of(m_indices, m_indices + corners, [&](uint32_t index) { return index >= num_vertices(); })) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+// close
+// unmap the file
+void stl_cache::close()
+{
+    m_map.close();
+    m_vertices = nullptr;
+    m_indices = nullptr;
+    m_normals = nullptr;
+    m_colors = nullptr;
+}
+
+// matches
+// true if the cache was made from a source with this hash and size
+bool stl_cache::matches(uint64_t source_hash, uint64_t source_size) const
+{
+    return is_open() && header().source_hash == source_hash && header().source_size == source_size;
+}
+
+// position of a welded vertex
+void stl_cache::vertex(uint32_t index, float v[3]) const
+{
+    if (!quantized()) {
+        memcpy(v, m_vertices + static_cast<size_t>(index) * AXIS_PER_VERTEX * sizeof(float), AXIS_PER_VERTEX * sizeof(float));
+        return;
+    }
+
+    uint16_t q[AXIS_PER_VERTEX];
+    memcpy(q, m_vertices + static_cast<size_t>(index) * AXIS_PER_VERTEX * sizeof(uint16_t), sizeof(q));
+    auto& h = header();
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        v[ax] = h.min[ax] + q[ax] * ((h.max[ax] - h.min[ax]) / STL_CACHE_QUANTIZE_STEPS);
+    }
+}
+
+// load
+// expand the cache into mesh in the layout of the mesh
+// the triangles, normals, colors and header are those of the source
+int stl_cache::load(stl& mesh, unsigned threads) const
+{
+    if (!is_open()) {
+        throw std::runtime_error("stl cache is not open.");
+    }
+
+    auto triangles = static_cast<size_t>(num_triangles());
+    auto corners = triangles * VERTEX_PER_TRIANGLE;
+    memcpy(mesh.m_header, header().stl_header, STL_HEADER_SIZE);
+    mesh.m_num_triangles = num_triangles();
+    mesh.m_normals.assign(m_normals, m_normals + triangles * AXIS_PER_VERTEX);
+    mesh.m_rgb_color.assign(m_colors, m_colors + header().num_colors);
+
+    auto soa = mesh.m_layout == stl_soa;
+    if (soa) {
+        mesh.m_vectors.clear();
+        mesh.m_x.resize(corners);
+        mesh.m_y.resize(corners);
+        mesh.m_z.resize(corners);
+    }
+    else {
+        mesh.m_x.clear();
+        mesh.m_y.clear();
+        mesh.m_z.clear();
+        mesh.m_vectors.resize(corners * AXIS_PER_VERTEX);
+    }
+
+    stl_parallel_blocks(corners, STL_VERTEX_BLOCK_SIZE, stl_thread_count(threads), [&](size_t first, size_t count) {
+        for (auto corner = first; corner < first + count; ++corner) {
+            float v[AXIS_PER_VERTEX];
+            vertex(m_indices[corner], v);
+            if (soa) {
+                mesh.m_x[corner] = v[0];
+                mesh.m_y[corner] = v[1];
+                mesh.m_z[corner] = v[2];
+            }
+            else {
+                memcpy(&mesh.m_vectors[corner * AXIS_PER_VERTEX], v, sizeof(v));
+            }
+        }
+    });
+    return 0;
+}
+
+// load
+// copy the welded vertices and indices into an indexed mesh
+int stl_cache::load(stl_indexed_mesh& mesh) const
+{
+    if (!is_open()) {
+        throw std::runtime_error("stl cache is not open.");
+    }
+
+    mesh.m_indices.assign(m_indices, m_indices + static_cast<size_t>(num_triangles()) * VERTEX_PER_TRIANGLE);
+    mesh.m_vertices.resize(static_cast<size_t>(num_vertices()) * AXIS_PER_VERTEX);
+    for (uint32_t index = 0; index < num_vertices(); ++index) {
+        vertex(index, &mesh.m_vertices[static_cast<size_t>(index) * AXIS_PER_VERTEX]);
+    }
+    return 0;
+}
+
+// write
+// weld the vertices of mesh and write its cache to name
+// the file is written under a temporary name and then renamed, so a
+// reader never maps half a cache. return -1 if it can not be created
+int stl_cache::write(const char* name, const stl& mesh, uint64_t source_hash, uint64_t source_size,
+    bool quantize, unsigned threads)
+{
+    stl_indexed_mesh indexed;
+    indexed.build(mesh, 0.0f, threads);
+    if (indexed.num_triangles() != mesh.m_num_triangles ||
+        mesh.m_normals.size() != static_cast<size_t>(mesh.m_num_triangles) * AXIS_PER_VERTEX) {
+        throw std::runtime_error(std::string("Invalid stl data for cache ") + name + ".");
+    }
+
+    // the quantized range is the box of the finite welded vertices. A non
+    // finite coordinate has no place in that box, so such a mesh, or one
+    // whose box is too large for a finite range, keeps the exact floats
+    float min[AXIS_PER_VERTEX] = {};
+    float max[AXIS_PER_VERTEX] = {};
+    bool seeded[AXIS_PER_VERTEX] = {};
+    auto finite = true;
+    for (size_t index = 0; index < indexed.num_vertices(); ++index) {
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            auto value = indexed.m_vertices[index * AXIS_PER_VERTEX + ax];
+            if (!std::isfinite(value)) {
+                finite = false;
+                continue;
+            }
+            if (!seeded[ax] || value < min[ax]) {
+                min[ax] = value;
+            }
+            if (!seeded[ax] || value > max[ax]) {
+                max[ax] = value;
+            }
+            seeded[ax] = true;
+        }
+    }
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        if (!std::isfinite(max[ax] - min[ax])) {
+            finite = false;
+        }
+    }
+    quantize = quantize && finite;
+
+    stl_cache_header header = {};
+    memcpy(header.magic, STL_CACHE_MAGIC, sizeof(STL_CACHE_MAGIC));
+    header.version = STL_CACHE_VERSION;
+    header.flags = quantize ? STL_CACHE_QUANTIZED : 0;
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.num_triangles = mesh.m_num_triangles;
+    header.num_vertices = static_cast<uint32_t>(indexed.num_vertices());
+    header.num_colors = mesh.m_rgb_color.size() / AXIS_PER_VERTEX * AXIS_PER_VERTEX;
+    memcpy(header.stl_header, mesh.m_header, STL_HEADER_SIZE);
+    memcpy(header.min, min, sizeof(min));
+    memcpy(header.max, max, sizeof(max));
+
+    std::vector<uint16_t> quantized;
+    if (quantize) {
+        quantized.resize(indexed.m_vertices.size());
+        for (size_t i = 0; i < quantized.size(); ++i) {
+            auto ax = i % AXIS_PER_VERTEX;
+            auto range = header.max[ax] - header.min[ax];
+            auto q = range > 0.0f ? std::round((indexed.m_vertices[i] - header.min[ax]) / range * STL_CACHE_QUANTIZE_STEPS) : 0.0f;
+            quantized[i] = static_cast<uint16_t>(!(q > 0.0f) ? 0.0f : std::min(q, STL_CACHE_QUANTIZE_STEPS));
+        }
+    }
+
+    auto temp = std::string(name) + ".tmp";
+    std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return -1;
+    }
+
+    cache_layout layout(header);
+    auto section = [&](uint64_t offset, const void* data, size_t size) {
+        static const char zeros[STL_CACHE_ALIGN] = {};
+        out.write(zeros, static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (quantize) {
+        section(layout.vertices, quantized.data(), quantized.size() * sizeof(uint16_t));
+    }
+    else {
+        section(layout.vertices, indexed.m_vertices.data(), indexed.m_vertices.size() * sizeof(float));
+    }
+    section(layout.indices, indexed.m_indices.data(), indexed.m_indices.size() * sizeof(uint32_t));
+    section(layout.normals, mesh.m_normals.data(), mesh.m_normals.size() * sizeof(float));
+    section(layout.colors, mesh.m_rgb_color.data(), header.num_colors * sizeof(float));
+    out.close();
+
+    if (!out) {
+        std::remove(temp.c_str());
+        throw std::runtime_error(std::string("Unable to write stl cache file ") + name + ".");
+    }
+
+    // rename does not replace an existing file everywhere
+    std::remove(name);
+    if (std::rename(temp.c_str(), name) != 0) {
+        std::remove(temp.c_str());
+        return -1;
+    }
+    return 0;
+}
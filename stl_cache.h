@@ -0,0 +1,92 @@
+// stl_cache.h : indexed cache files for fast stl reloads
+//
+
+#ifndef STL_CACHE_H
+#define STL_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "mapped_file.h"
+#include "stl.h"
+#include "stl_indexed_mesh.h"
+
+constexpr uint32_t STL_CACHE_VERSION = 1;
+constexpr uint32_t STL_CACHE_QUANTIZED = 1U << 0;
+constexpr size_t STL_CACHE_ALIGN = 16;
+constexpr size_t STL_CACHE_HASH_BLOCK = 1U << 22;
+constexpr float STL_CACHE_QUANTIZE_STEPS = 65535.0f;
+
+// 64 bit hash of a stl file
+// the file is hashed in blocks over the worker threads and the block
+// hashes are hashed again, the result does not depend on the threads
+uint64_t stl_content_hash(const char* data, size_t size, unsigned threads = 0);
+
+// name of the cache file of a stl, next to it
+std::string stl_cache_name(const char* name);
+
+// start of a cache file
+// the sections follow in this order, each aligned to STL_CACHE_ALIGN
+//  vertices    float[3] or uint16[3] (quantized) per welded vertex
+//  indices     uint32[3] per triangle
+//  normals     float[3] per triangle
+//  colors      float[num_colors], m_rgb_color of the stl
+struct stl_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t num_triangles;
+    uint32_t num_vertices;
+    uint64_t num_colors;
+    float min[3];
+    float max[3];
+    char stl_header[STL_HEADER_SIZE];
+};
+
+// stl_cache
+// memory mapped cache of a stl: the welded vertices, indices,
+// normals, colors and stl header plus the hash of the source file.
+// The sections are used in place, load expands them into a stl.
+// Quantized vertices are 16 bits per axis between min and max.
+class stl_cache
+{
+public:
+    bool open(const char* name);
+    void close();
+
+    bool is_open() const { return m_map.is_open(); }
+    bool matches(uint64_t source_hash, uint64_t source_size) const;
+    bool quantized() const { return (header().flags & STL_CACHE_QUANTIZED) != 0; }
+
+    const stl_cache_header& header() const { return *reinterpret_cast<const stl_cache_header*>(m_map.data()); }
+    uint32_t num_triangles() const { return header().num_triangles; }
+    uint32_t num_vertices() const { return header().num_vertices; }
+
+    // vertices is null for a quantized cache, use quantized_vertices or vertex
+    const float* vertices() const { return quantized() ? nullptr : reinterpret_cast<const float*>(m_vertices); }
+    const uint16_t* quantized_vertices() const { return quantized() ? reinterpret_cast<const uint16_t*>(m_vertices) : nullptr; }
+    const uint32_t* indices() const { return m_indices; }
+    const float* normals() const { return m_normals; }
+    const float* colors() const { return m_colors; }
+    void vertex(uint32_t index, float v[3]) const;
+
+    int load(stl& mesh, unsigned threads = 0) const;
+    int load(stl_indexed_mesh& mesh) const;
+
+    // quantize is ignored for a mesh with a non finite coordinate, whose
+    // vertices are written as exact floats
+    static int write(const char* name, const stl& mesh, uint64_t source_hash, uint64_t source_size,
+        bool quantize = false, unsigned threads = 0);
+
+private:
+    mapped_file m_map;
+    const char* m_vertices = nullptr;
+    const uint32_t* m_indices = nullptr;
+    const float* m_normals = nullptr;
+    const float* m_colors = nullptr;
+};
+
+#endif
@@ -0,0 +1,353 @@
+// stl_compact.cpp : compact storage of the positions and normals of a stl
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "stl_compact.h"
+#include "stl_simd.h"
+#include "stl_stream.h"
+
+namespace
+{
+    constexpr size_t FLOATS_PER_TRIANGLE = VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX;
+    constexpr int BITS21 = 21;
+
+    // the vertex positions of triangles first .. first + count - 1 of a
+    // stl as x y z floats, in place or copied into buffer for soa
+    const float* interleaved(const stl& mesh, size_t first, size_t count, std::vector<float>& buffer)
+    {
+        if (mesh.m_layout != stl_soa) {
+            return &mesh.m_vectors[first * FLOATS_PER_TRIANGLE];
+        }
+        buffer.resize(count * FLOATS_PER_TRIANGLE);
+        for (size_t i = 0; i < count * VERTEX_PER_TRIANGLE; ++i) {
+            auto corner = first * VERTEX_PER_TRIANGLE + i;
+            buffer[i * AXIS_PER_VERTEX] = mesh.m_x[corner];
+            buffer[i * AXIS_PER_VERTEX + 1] = mesh.m_y[corner];
+            buffer[i * AXIS_PER_VERTEX + 2] = mesh.m_z[corner];
+        }
+        return buffer.data();
+    }
+
+    // an axis of the box without a finite coordinate becomes 0 0, so
+    // the quantized positions of that axis decode to 0
+    void finite_bounds(stl_aabb& box)
+    {
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            if (box.min[ax] > box.max[ax]) {
+                box.min[ax] = box.max[ax] = 0.0f;
+            }
+        }
+    }
+}
+
+// steps
+// the quantization scale and step of each axis of the bounds
+// a flat axis has a scale and step of 0
+void stl_compact_mesh::steps(float scale[3], float step[3]) const
+{
+    auto max_value = static_cast<float>(m_format == stl_position_quantized21 ? STL_QUANTIZE21_MAX : STL_QUANTIZE16_MAX);
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        auto extent = m_bounds.max[ax] - m_bounds.min[ax];
+        auto flat = !(extent > 0.0f) || !std::isfinite(extent);
+        scale[ax] = flat ? 0.0f : max_value / extent;
+        step[ax] = flat ? 0.0f : extent / max_value;
+    }
+}
+
+// resize
+// room for triangles triangles in the format
+void stl_compact_mesh::resize(size_t triangles)
+{
+    auto corners = triangles * VERTEX_PER_TRIANGLE;
+    if (m_format == stl_position_quantized21) {
+        m_positions16.clear();
+        m_positions21.resize(corners);
+    }
+    else {
+        m_positions21.clear();
+        m_positions16.resize(corners * AXIS_PER_VERTEX);
+    }
+    m_normals.resize(triangles);
+}
+
+// encode_block
+// store count triangles at first, normals may be null to calculate them
+void stl_compact_mesh::encode_block(const float* vectors, const float* normals, size_t first, size_t count)
+{
+    std::vector<float> calculated(normals == nullptr ? STL_COMPACT_BLOCK_TRIANGLES * AXIS_PER_VERTEX : 0);
+    std::vector<uint32_t> q(m_format == stl_position_half ? 0 : STL_COMPACT_BLOCK_TRIANGLES * FLOATS_PER_TRIANGLE);
+    float scale[3];
+    float step[3];
+    steps(scale, step);
+
+    for (size_t done = 0; done < count; done += STL_COMPACT_BLOCK_TRIANGLES) {
+        auto n = std::min(STL_COMPACT_BLOCK_TRIANGLES, count - done);
+        auto v = vectors + done * FLOATS_PER_TRIANGLE;
+        auto corner = (first + done) * VERTEX_PER_TRIANGLE;
+
+        switch (m_format) {
+            case stl_position_half:
+                stl_simd_float_to_half(v, n * FLOATS_PER_TRIANGLE, &m_positions16[corner * AXIS_PER_VERTEX]);
+                break;
+
+            case stl_position_quantized16:
+                stl_simd_quantize(v, n * VERTEX_PER_TRIANGLE, m_bounds.min, scale, static_cast<float>(STL_QUANTIZE16_MAX), q.data());
+                for (size_t i = 0; i < n * FLOATS_PER_TRIANGLE; ++i) {
+                    m_positions16[corner * AXIS_PER_VERTEX + i] = static_cast<uint16_t>(q[i]);
+                }
+                break;
+
+            case stl_position_quantized21:
+                stl_simd_quantize(v, n * VERTEX_PER_TRIANGLE, m_bounds.min, scale, static_cast<float>(STL_QUANTIZE21_MAX), q.data());
+                for (size_t i = 0; i < n * VERTEX_PER_TRIANGLE; ++i) {
+                    m_positions21[corner + i] = static_cast<uint64_t>(q[i * 3]) | (static_cast<uint64_t>(q[i * 3 + 1]) << BITS21) |
+                        (static_cast<uint64_t>(q[i * 3 + 2]) << (2 * BITS21));
+                }
+                break;
+        }
+
+        auto nv = normals != nullptr ? normals + done * AXIS_PER_VERTEX : calculated.data();
+        if (normals == nullptr) {
+            stl_simd_normals(v, calculated.data(), n);
+        }
+        stl_simd_octahedral_encode(nv, n, &m_normals[first + done]);
+    }
+}
+
+// encode
+// store the triangles of a stl in format
+// the stl normals are used if it has them, else they are calculated
+int stl_compact_mesh::encode(const stl& mesh, stl_position_format format)
+{
+    clear();
+    m_format = format;
+    auto triangles = mesh.num_vertices() / VERTEX_PER_TRIANGLE;
+    if (triangles > UINT32_MAX) {
+        throw std::runtime_error("Too many triangles for a stl file.");
+    }
+    m_num_triangles = static_cast<uint32_t>(triangles);
+    memcpy(m_header, mesh.m_header, STL_HEADER_SIZE);
+    m_rgb_color.assign(mesh.m_rgb_color.begin(), mesh.m_rgb_color.end());
+    if (triangles == 0) {
+        return 0;
+    }
+
+    m_bounds = mesh.bounds(m_num_threads);
+    finite_bounds(m_bounds);
+    resize(triangles);
+    auto has_normals = mesh.m_normals.size() >= triangles * AXIS_PER_VERTEX;
+    stl_parallel_blocks(triangles, STL_COMPACT_BLOCK_TRIANGLES, stl_thread_count(m_num_threads), [&](size_t first, size_t count) {
+        std::vector<float> buffer;
+        auto v = interleaved(mesh, first, count, buffer);
+        encode_block(v, has_normals ? &mesh.m_normals[first * AXIS_PER_VERTEX] : nullptr, first, count);
+    });
+    return 0;
+}
+
+// decode
+// expand the triangles into a stl in its layout
+int stl_compact_mesh::decode(stl& mesh) const
+{
+    auto triangles = static_cast<size_t>(m_num_triangles);
+    auto corners = triangles * VERTEX_PER_TRIANGLE;
+    auto soa = mesh.m_layout == stl_soa;
+
+    memcpy(mesh.m_header, m_header, STL_HEADER_SIZE);
+    mesh.m_num_triangles = m_num_triangles;
+    mesh.m_rgb_color.assign(m_rgb_color.begin(), m_rgb_color.end());
+    mesh.m_normals.resize(triangles * AXIS_PER_VERTEX);
+    if (soa) {
+        mesh.m_vectors.clear();
+        mesh.m_x.resize(corners);
+        mesh.m_y.resize(corners);
+        mesh.m_z.resize(corners);
+    }
+    else {
+        mesh.m_x.clear();
+        mesh.m_y.clear();
+        mesh.m_z.clear();
+        mesh.m_vectors.resize(corners * AXIS_PER_VERTEX);
+    }
+
+    stl_parallel_blocks(triangles, STL_COMPACT_BLOCK_TRIANGLES, stl_thread_count(m_num_threads), [&](size_t first, size_t count) {
+        normals(first, count, &mesh.m_normals[first * AXIS_PER_VERTEX]);
+        if (!soa) {
+            vertices(first, count, &mesh.m_vectors[first * FLOATS_PER_TRIANGLE]);
+            return;
+        }
+
+        std::vector<float> buffer(std::min(count, STL_COMPACT_BLOCK_TRIANGLES) * FLOATS_PER_TRIANGLE);
+        for (auto block = first; block < first + count; block += STL_COMPACT_BLOCK_TRIANGLES) {
+            auto n = std::min(STL_COMPACT_BLOCK_TRIANGLES, first + count - block);
+            vertices(block, n, buffer.data());
+            for (size_t i = 0; i < n * VERTEX_PER_TRIANGLE; ++i) {
+                auto corner = block * VERTEX_PER_TRIANGLE + i;
+                mesh.m_x[corner] = buffer[i * AXIS_PER_VERTEX];
+                mesh.m_y[corner] = buffer[i * AXIS_PER_VERTEX + 1];
+                mesh.m_z[corner] = buffer[i * AXIS_PER_VERTEX + 2];
+            }
+        }
+    });
+    return 0;
+}
+
+// clear
+void stl_compact_mesh::clear()
+{
+    m_num_triangles = 0;
+    m_bounds = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+    m_positions16.clear();
+    m_positions21.clear();
+    m_normals.clear();
+    m_rgb_color.clear();
+    memset(m_header, 0, STL_HEADER_SIZE);
+}
+
+// bytes
+// memory used by the triangle data
+size_t stl_compact_mesh::bytes() const
+{
+    return m_positions16.capacity() * sizeof(uint16_t) + m_positions21.capacity() * sizeof(uint64_t) +
+        m_normals.capacity() * sizeof(uint32_t) + m_rgb_color.capacity() * sizeof(float);
+}
+
+// vertices
+// decode the positions of count triangles from first
+void stl_compact_mesh::vertices(size_t first, size_t count, float* vectors) const
+{
+    auto corner = first * VERTEX_PER_TRIANGLE;
+    if (m_format == stl_position_half) {
+        stl_simd_half_to_float(&m_positions16[corner * AXIS_PER_VERTEX], count * FLOATS_PER_TRIANGLE, vectors);
+        return;
+    }
+
+    float scale[3];
+    float step[3];
+    steps(scale, step);
+
+    std::vector<uint32_t> q(std::min(count, STL_COMPACT_BLOCK_TRIANGLES) * FLOATS_PER_TRIANGLE);
+    constexpr auto mask = static_cast<uint64_t>(STL_QUANTIZE21_MAX);
+    for (size_t done = 0; done < count; done += STL_COMPACT_BLOCK_TRIANGLES) {
+        auto n = std::min(STL_COMPACT_BLOCK_TRIANGLES, count - done);
+        auto c = corner + done * VERTEX_PER_TRIANGLE;
+        if (m_format == stl_position_quantized21) {
+            for (size_t i = 0; i < n * VERTEX_PER_TRIANGLE; ++i) {
+                auto packed = m_positions21[c + i];
+                q[i * 3] = static_cast<uint32_t>(packed & mask);
+                q[i * 3 + 1] = static_cast<uint32_t>((packed >> BITS21) & mask);
+                q[i * 3 + 2] = static_cast<uint32_t>((packed >> (2 * BITS21)) & mask);
+            }
+        }
+        else {
+            for (size_t i = 0; i < n * FLOATS_PER_TRIANGLE; ++i) {
+                q[i] = m_positions16[c * AXIS_PER_VERTEX + i];
+            }
+        }
+        stl_simd_dequantize(q.data(), n * VERTEX_PER_TRIANGLE, m_bounds.min, step, vectors + done * FLOATS_PER_TRIANGLE);
+    }
+}
+
+// normals
+// decode the unit normals of count triangles from first
+void stl_compact_mesh::normals(size_t first, size_t count, float* normals) const
+{
+    stl_simd_octahedral_decode(&m_normals[first], count, normals);
+}
+
+// read_stl
+// stream a stl file into the format a batch at a time
+int stl_compact_mesh::read_stl(const char* name, stl_position_format format)
+{
+    clear();
+    m_format = format;
+
+    std::vector<stl_triangle> batch;
+    std::vector<float> vectors(STL_STREAM_BATCH_SIZE * FLOATS_PER_TRIANGLE);
+    std::vector<float> normals(STL_STREAM_BATCH_SIZE * AXIS_PER_VERTEX);
+    auto unpack = [&](size_t count) {
+        for (size_t t = 0; t < count; ++t) {
+            memcpy(&vectors[t * FLOATS_PER_TRIANGLE], batch[t].vertices, sizeof(batch[t].vertices));
+            memcpy(&normals[t * AXIS_PER_VERTEX], batch[t].normal, sizeof(batch[t].normal));
+        }
+    };
+
+    // the quantized formats need the bounds of the finite coordinates
+    // before the first triangle
+    if (format != stl_position_half) {
+        constexpr auto inf = std::numeric_limits<float>::infinity();
+        m_bounds = { { inf, inf, inf }, { -inf, -inf, -inf } };
+        stl_stream in;
+        in.open(name);
+        for (size_t count; (count = in.read(batch)) > 0;) {
+            unpack(count);
+            stl_simd_bounds(vectors.data(), count * VERTEX_PER_TRIANGLE, m_bounds.min, m_bounds.max);
+        }
+        finite_bounds(m_bounds);
+    }
+
+    stl_stream in;
+    in.open(name);
+    memcpy(m_header, in.header(), STL_HEADER_SIZE);
+    size_t triangles = 0;
+    for (size_t count; (count = in.read(batch)) > 0;) {
+        if (triangles + count > UINT32_MAX) {
+            clear();
+            throw std::runtime_error(std::string(name) + " invalid stl file.");
+        }
+        unpack(count);
+        resize(triangles + count);
+        encode_block(vectors.data(), normals.data(), triangles, count);
+
+        // only triangles with a valid attribute have a color
+        for (size_t t = 0; t < count; ++t) {
+            float rgb[3];
+            if (stl_decode_attribute(batch[t].attribute, rgb)) {
+                m_rgb_color.insert(m_rgb_color.end(), rgb, rgb + AXIS_PER_VERTEX);
+            }
+        }
+        triangles += count;
+    }
+    m_num_triangles = static_cast<uint32_t>(triangles);
+    return 0;
+}
+
+// create_stl_binary
+// decode and pack the triangles a block at a time
+int stl_compact_mesh::create_stl_binary(const char* name) const
+{
+    std::ofstream out(name, std::ios::out | std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error(std::string("Unable to open stl output file ") + name + ".");
+    }
+    out.write(m_header, STL_HEADER_SIZE);
+    out.write(reinterpret_cast<const char*>(&m_num_triangles), sizeof(m_num_triangles));
+
+    std::vector<float> vectors(STL_COMPACT_BLOCK_TRIANGLES * FLOATS_PER_TRIANGLE);
+    std::vector<float> normal_block(STL_COMPACT_BLOCK_TRIANGLES * AXIS_PER_VERTEX);
+    std::vector<char> records(STL_COMPACT_BLOCK_TRIANGLES * STL_TRIANGLE_SIZE);
+    for (size_t first = 0; first < m_num_triangles; first += STL_COMPACT_BLOCK_TRIANGLES) {
+        auto count = std::min<size_t>(STL_COMPACT_BLOCK_TRIANGLES, m_num_triangles - first);
+        vertices(first, count, vectors.data());
+        normals(first, count, normal_block.data());
+        for (size_t t = 0; t < count; ++t) {
+            uint16_t attribute = 0;
+            auto rgb_index = (first + t) * AXIS_PER_VERTEX;
+            if (rgb_index + 2 < m_rgb_color.size()) {
+                attribute = stl_encode_attribute(&m_rgb_color[rgb_index]);
+            }
+            stl_pack_triangle(&records[t * STL_TRIANGLE_SIZE], &normal_block[t * AXIS_PER_VERTEX],
+                &vectors[t * FLOATS_PER_TRIANGLE], attribute);
+        }
+        out.write(records.data(), static_cast<std::streamsize>(count * STL_TRIANGLE_SIZE));
+    }
+
+    if (!out) {
+        throw std::runtime_error(std::string("Unable to write stl output file ") + name + ".");
+    }
+    return 0;
+}
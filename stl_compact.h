@@ -0,0 +1,107 @@
+// stl_compact.h : compact storage of the positions and normals of a stl
+//
+
+#ifndef STL_COMPACT_H
+#define STL_COMPACT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "stl.h"
+#include "stl_parallel.h"
+
+constexpr size_t STL_COMPACT_BLOCK_TRIANGLES = 1U << 12;
+constexpr uint32_t STL_QUANTIZE16_MAX = (1U << 16) - 1;
+constexpr uint32_t STL_QUANTIZE21_MAX = (1U << 21) - 1;
+
+// how stl_compact_mesh keeps the vertex positions
+// the quantized formats are steps of the box of the finite coordinates,
+// per axis. They have no nan or inf, a non finite coordinate is clamped
+// into the box
+enum stl_position_format
+{
+    stl_position_quantized16,   // 16 bits per axis, 6 bytes per vertex
+    stl_position_quantized21,   // 21 bits per axis in a uint64, 8 bytes per vertex
+    stl_position_half           // IEEE half floats, 6 bytes per vertex
+};
+
+// stl_compact_mesh
+// the triangles of a stl in less memory. Positions use one of the
+// stl_position_format formats and normals are octahedral 2 x 16 bit,
+// 22 to 28 bytes a triangle instead of 48. The conversions use the
+// vector kernels in stl_simd.h. A zero normal, as in "facet normal 0 0 0",
+// or one with a nan or inf component is kept as STL_OCTAHEDRAL_NONE and
+// decodes back to 0 0 0 instead of being made up or calculated from the
+// winding.
+//
+// The accessors decode triangles on the fly into float buffers in the
+// layout of stl::m_vectors and stl::m_normals, so algorithms written for
+// those arrays can run a block at a time with for_each_block, and
+// decode expands the whole mesh back into a stl.
+class stl_compact_mesh
+{
+public:
+    stl_position_format m_format = stl_position_quantized16;
+    uint32_t m_num_triangles = 0;
+    stl_aabb m_bounds = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+
+    // 3 per vertex for quantized16 and half, 1 per vertex for quantized21
+    // with x in the low bits, then y and z
+    std::vector<uint16_t> m_positions16;
+    std::vector<uint64_t> m_positions21;
+
+    // 1 per triangle, u | v << 16 or STL_OCTAHEDRAL_NONE
+    std::vector<uint32_t> m_normals;
+
+    std::vector<float> m_rgb_color;
+    char m_header[STL_HEADER_SIZE] = { 0 };
+
+    // worker threads for encode and decode, 0 = hardware concurrency
+    unsigned m_num_threads = 0;
+
+    int encode(const stl& mesh, stl_position_format format);
+    int decode(stl& mesh) const;
+    void clear();
+
+    // read a stl file in batches without the float arrays
+    // the quantized formats read the file twice, first for the bounds
+    int read_stl(const char* name, stl_position_format format);
+    int create_stl_binary(const char* name) const;
+
+    size_t bytes() const;
+
+    // decode count triangles from first, 9 floats or 3 floats each
+    void vertices(size_t first, size_t count, float* vectors) const;
+    void normals(size_t first, size_t count, float* normals) const;
+    const float* triangle_vertices(size_t triangle, float buffer[9]) const
+    {
+        vertices(triangle, 1, buffer);
+        return buffer;
+    }
+
+    // run task(first, count, vectors, normals) on decoded blocks of
+    // triangles over the worker threads
+    template <class Task>
+    void for_each_block(Task task) const
+    {
+        stl_parallel_blocks(m_num_triangles, STL_COMPACT_BLOCK_TRIANGLES, stl_thread_count(m_num_threads),
+            [&](size_t first, size_t count) {
+                std::vector<float> vectors(STL_COMPACT_BLOCK_TRIANGLES * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+                std::vector<float> normal_block(STL_COMPACT_BLOCK_TRIANGLES * AXIS_PER_VERTEX);
+                for (auto block = first; block < first + count; block += STL_COMPACT_BLOCK_TRIANGLES) {
+                    auto n = std::min(STL_COMPACT_BLOCK_TRIANGLES, first + count - block);
+                    vertices(block, n, vectors.data());
+                    normals(block, n, normal_block.data());
+                    task(block, n, static_cast<const float*>(vectors.data()), static_cast<const float*>(normal_block.data()));
+                }
+            });
+    }
+
+private:
+    void steps(float scale[3], float step[3]) const;
+    void resize(size_t triangles);
+    void encode_block(const float* vectors, const float* normals, size_t first, size_t count);
+};
+
+#endif
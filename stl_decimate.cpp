@@ -0,0 +1,721 @@
+// stl_decimate.cpp : quadric error edge collapse decimation of a stl
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+
+#include "stl_decimate.h"
+#include "stl_indexed_mesh.h"
+#include "stl_parallel.h"
+
+namespace
+{
+    constexpr uint32_t SHARED_VERTEX = 0xFFFFFFFFU;
+    constexpr uint32_t NO_PARTITION = 0xFFFFFFFEU;
+
+    // a collapse may turn a triangle by less than about 78 degrees
+    constexpr double MIN_NORMAL_COS = 0.2;
+
+    // the best point of a quadric must be this close to the edge,
+    // relative to its length, or the ends and middle are used
+    constexpr double MAX_OPTIMUM_DISTANCE = 2.0;
+
+    // symmetric 4x4 error quadric
+    // a2 ab ac ad b2 bc bd c2 cd d2 of the planes ax + by + cz + d = 0
+    struct quadric
+    {
+        double q[10];
+
+        void add_plane(double a, double b, double c, double d)
+        {
+            q[0] += a * a; q[1] += a * b; q[2] += a * c; q[3] += a * d;
+            q[4] += b * b; q[5] += b * c; q[6] += b * d;
+            q[7] += c * c; q[8] += c * d;
+            q[9] += d * d;
+        }
+
+        void add(const quadric& other)
+        {
+            for (auto i = 0; i < 10; ++i) {
+                q[i] += other.q[i];
+            }
+        }
+
+        // sum of squared distances of p to the planes
+        double error(const double p[3]) const
+        {
+            auto x = p[0];
+            auto y = p[1];
+            auto z = p[2];
+            auto e = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+                q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+                q[7] * z * z + 2.0 * q[8] * z + q[9];
+            return e > 0.0 ? e : 0.0;
+        }
+
+        // point of least error, false if the planes do not fix one
+        bool optimum(double p[3]) const
+        {
+            auto det = q[0] * (q[4] * q[7] - q[5] * q[5]) - q[1] * (q[1] * q[7] - q[5] * q[2]) +
+                q[2] * (q[1] * q[5] - q[4] * q[2]);
+            auto trace = q[0] + q[4] + q[7];
+            if (!(std::fabs(det) > 1.0e-9 * trace * trace * trace)) {
+                return false;
+            }
+
+            // Cramer's rule on A p = -b
+            auto bx = -q[3];
+            auto by = -q[6];
+            auto bz = -q[8];
+            p[0] = (bx * (q[4] * q[7] - q[5] * q[5]) - q[1] * (by * q[7] - q[5] * bz) + q[2] * (by * q[5] - q[4] * bz)) / det;
+            p[1] = (q[0] * (by * q[7] - bz * q[5]) - bx * (q[1] * q[7] - q[5] * q[2]) + q[2] * (q[1] * bz - by * q[2])) / det;
+            p[2] = (q[0] * (q[4] * bz - q[5] * by) - q[1] * (q[1] * bz - by * q[2]) + bx * (q[1] * q[5] - q[4] * q[2])) / det;
+            return std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]);
+        }
+    };
+
+    inline void cross(const double a[3], const double b[3], const double c[3], double n[3])
+    {
+        double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        n[0] = u[1] * v[2] - u[2] * v[1];
+        n[1] = u[2] * v[0] - u[0] * v[2];
+        n[2] = u[0] * v[1] - u[1] * v[0];
+    }
+
+    inline double dot(const double a[3], const double b[3])
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    // interleave the low 10 bits of x, y and z
+    inline uint32_t morton_code(uint32_t x, uint32_t y, uint32_t z)
+    {
+        auto spread = [](uint32_t v) {
+            v &= 0x3FF;
+            v = (v | (v << 16)) & 0x030000FF;
+            v = (v | (v << 8)) & 0x0300F00F;
+            v = (v | (v << 4)) & 0x030C30C3;
+            v = (v | (v << 2)) & 0x09249249;
+            return v;
+        };
+        return (spread(x) << 2) | (spread(y) << 1) | spread(z);
+    }
+
+    // candidate collapse of edge a b in the priority queue
+    // the stamps are those of a and b when it was queued
+    struct collapse
+    {
+        double cost;
+        uint32_t a;
+        uint32_t b;
+        uint32_t stamp_a;
+        uint32_t stamp_b;
+
+        bool operator>(const collapse& other) const
+        {
+            if (cost != other.cost) {
+                return cost > other.cost;
+            }
+            return a != other.a ? a > other.a : b > other.b;
+        }
+    };
+
+    // edge_collapser
+    // simplifies the triangles of 1 partition with local vertex numbers
+    // the triangles of a vertex are m_refs[m_ref_first[v] ..] and
+    // are appended again at the end of m_refs when they change
+    class edge_collapser
+    {
+    public:
+        void load(const uint32_t* indices, size_t triangles, const std::vector<float>& vertices,
+            const std::vector<uint32_t>& owner, uint32_t partition);
+        void run(size_t target, double max_error);
+        void store(std::vector<uint32_t>& indices, std::vector<float>& vertices,
+            const std::vector<uint32_t>& owner, uint32_t partition) const;
+
+    private:
+        std::vector<uint32_t> m_global;
+        std::vector<double> m_pos;
+        std::vector<quadric> m_quadrics;
+        std::vector<char> m_locked;
+        std::vector<char> m_removed;
+        std::vector<uint32_t> m_stamp;
+        std::vector<uint32_t> m_mark;
+        uint32_t m_mark_id = 0;
+
+        std::vector<uint32_t> m_tris;
+        std::vector<char> m_dead;
+        size_t m_live = 0;
+
+        std::vector<uint32_t> m_refs;
+        std::vector<uint32_t> m_ref_first;
+        std::vector<uint32_t> m_ref_count;
+
+        std::priority_queue<collapse, std::vector<collapse>, std::greater<collapse>> m_queue;
+        std::vector<uint32_t> m_neighbors;
+
+        const double* pos(uint32_t v) const { return &m_pos[static_cast<size_t>(v) * AXIS_PER_VERTEX]; }
+        void neighbors(uint32_t v, std::vector<uint32_t>& out) const;
+        bool place(uint32_t a, uint32_t b, double p[3], double& cost) const;
+        void queue_edges(uint32_t v);
+        bool can_collapse(uint32_t a, uint32_t b, const double p[3]);
+        void apply(uint32_t a, uint32_t b, const double p[3]);
+    };
+
+    // load
+    // number the vertices of the triangles and make their quadrics
+    // owner is empty when the partition is the whole mesh
+    void edge_collapser::load(const uint32_t* indices, size_t triangles, const std::vector<float>& vertices,
+        const std::vector<uint32_t>& owner, uint32_t partition)
+    {
+        auto corners = triangles * VERTEX_PER_TRIANGLE;
+        m_global.assign(indices, indices + corners);
+        std::sort(m_global.begin(), m_global.end());
+        m_global.erase(std::unique(m_global.begin(), m_global.end()), m_global.end());
+
+        auto count = m_global.size();
+        m_pos.resize(count * AXIS_PER_VERTEX);
+        for (size_t v = 0; v < count; ++v) {
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                m_pos[v * AXIS_PER_VERTEX + ax] = vertices[static_cast<size_t>(m_global[v]) * AXIS_PER_VERTEX + ax];
+            }
+        }
+
+        m_tris.resize(corners);
+        for (size_t corner = 0; corner < corners; ++corner) {
+            m_tris[corner] = static_cast<uint32_t>(std::lower_bound(m_global.begin(), m_global.end(), indices[corner]) - m_global.begin());
+        }
+        m_dead.assign(triangles, 0);
+        m_live = triangles;
+
+        m_ref_count.assign(count, 0);
+        for (auto v : m_tris) {
+            m_ref_count[v]++;
+        }
+        m_ref_first.resize(count);
+        uint32_t first = 0;
+        for (size_t v = 0; v < count; ++v) {
+            m_ref_first[v] = first;
+            first += m_ref_count[v];
+        }
+        m_refs.resize(corners);
+        m_refs.reserve(corners * 2);
+        std::vector<uint32_t> fill(m_ref_first);
+        for (size_t corner = 0; corner < corners; ++corner) {
+            m_refs[fill[m_tris[corner]]++] = static_cast<uint32_t>(corner / VERTEX_PER_TRIANGLE);
+        }
+
+        // plane quadrics, degenerate triangles have no plane
+        m_quadrics.assign(count, quadric{});
+        for (size_t t = 0; t < triangles; ++t) {
+            auto tri = &m_tris[t * VERTEX_PER_TRIANGLE];
+            double n[3];
+            cross(pos(tri[0]), pos(tri[1]), pos(tri[2]), n);
+            auto length = std::sqrt(dot(n, n));
+            if (!(length > 0.0) || !std::isfinite(length)) {
+                continue;
+            }
+            n[0] /= length;
+            n[1] /= length;
+            n[2] /= length;
+            auto d = -dot(n, pos(tri[0]));
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                m_quadrics[tri[i]].add_plane(n[0], n[1], n[2], d);
+            }
+        }
+
+        // lock the vertices shared with other partitions and those of
+        // edges that do not have exactly 2 triangles
+        m_locked.assign(count, 0);
+        m_removed.assign(count, 0);
+        m_stamp.assign(count, 0);
+        m_mark.assign(count, 0);
+        m_mark_id = 0;
+        std::vector<uint32_t> around;
+        for (uint32_t v = 0; v < count; ++v) {
+            if (!owner.empty() && owner[m_global[v]] != partition) {
+                m_locked[v] = 1;
+                continue;
+            }
+            around.clear();
+            for (uint32_t r = 0; r < m_ref_count[v]; ++r) {
+                auto tri = &m_tris[static_cast<size_t>(m_refs[m_ref_first[v] + r]) * VERTEX_PER_TRIANGLE];
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                    if (tri[i] != v) {
+                        around.push_back(tri[i]);
+                    }
+                }
+            }
+            std::sort(around.begin(), around.end());
+            for (size_t i = 0; i < around.size();) {
+                auto j = i;
+                while (j < around.size() && around[j] == around[i]) {
+                    j++;
+                }
+                if (j - i != 2) {
+                    m_locked[v] = 1;
+                    break;
+                }
+                i = j;
+            }
+        }
+
+        m_queue = decltype(m_queue)();
+        for (uint32_t v = 0; v < count; ++v) {
+            queue_edges(v);
+        }
+    }
+
+    // the distinct vertices that share a live triangle with v
+    void edge_collapser::neighbors(uint32_t v, std::vector<uint32_t>& out) const
+    {
+        out.clear();
+        for (uint32_t r = 0; r < m_ref_count[v]; ++r) {
+            auto t = m_refs[m_ref_first[v] + r];
+            if (m_dead[t]) {
+                continue;
+            }
+            auto tri = &m_tris[static_cast<size_t>(t) * VERTEX_PER_TRIANGLE];
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                if (tri[i] != v) {
+                    out.push_back(tri[i]);
+                }
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // place
+    // where a and b go when the edge collapses into a and the error
+    // a locked vertex stays where it is
+    bool edge_collapser::place(uint32_t a, uint32_t b, double p[3], double& cost) const
+    {
+        if (m_locked[a] && m_locked[b]) {
+            return false;
+        }
+
+        quadric q = m_quadrics[a];
+        q.add(m_quadrics[b]);
+
+        auto pa = pos(a);
+        auto pb = pos(b);
+        if (m_locked[a] || m_locked[b]) {
+            auto fixed = m_locked[a] ? pa : pb;
+            memcpy(p, fixed, AXIS_PER_VERTEX * sizeof(double));
+            cost = q.error(p);
+            return true;
+        }
+
+        double mid[3] = { (pa[0] + pb[0]) * 0.5, (pa[1] + pb[1]) * 0.5, (pa[2] + pb[2]) * 0.5 };
+        if (q.optimum(p)) {
+            double e[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+            double d[3] = { p[0] - mid[0], p[1] - mid[1], p[2] - mid[2] };
+            if (dot(d, d) <= MAX_OPTIMUM_DISTANCE * MAX_OPTIMUM_DISTANCE * dot(e, e)) {
+                cost = q.error(p);
+                return true;
+            }
+        }
+
+        // the best of the ends and the middle
+        const double* candidates[3] = { pa, pb, mid };
+        cost = std::numeric_limits<double>::max();
+        for (auto candidate : candidates) {
+            auto error = q.error(candidate);
+            if (error < cost) {
+                cost = error;
+                memcpy(p, candidate, AXIS_PER_VERTEX * sizeof(double));
+            }
+        }
+        return true;
+    }
+
+    // queue_edges
+    // queue the edges of v to its higher numbered neighbors, or to
+    // all of them after v changed
+    void edge_collapser::queue_edges(uint32_t v)
+    {
+        neighbors(v, m_neighbors);
+        for (auto w : m_neighbors) {
+            if (m_stamp[v] == 0 && w < v) {
+                continue;
+            }
+            double p[3];
+            double cost = 0.0;
+            if (place(v, w, p, cost)) {
+                m_queue.push({ cost, v, w, m_stamp[v], m_stamp[w] });
+            }
+        }
+    }
+
+    // can_collapse
+    // a and b may only share the vertices opposite their shared edge and
+    // no other triangle of a or b may flip or become degenerate
+    bool edge_collapser::can_collapse(uint32_t a, uint32_t b, const double p[3])
+    {
+        if (++m_mark_id == 0) {
+            std::fill(m_mark.begin(), m_mark.end(), 0);
+            m_mark_id = 1;
+        }
+        neighbors(a, m_neighbors);
+        for (auto w : m_neighbors) {
+            m_mark[w] = m_mark_id;
+        }
+
+        size_t shared = 0;
+        for (uint32_t r = 0; r < m_ref_count[a]; ++r) {
+            auto t = m_refs[m_ref_first[a] + r];
+            auto tri = &m_tris[static_cast<size_t>(t) * VERTEX_PER_TRIANGLE];
+            if (!m_dead[t] && (tri[0] == b || tri[1] == b || tri[2] == b)) {
+                shared++;
+            }
+        }
+
+        neighbors(b, m_neighbors);
+        size_t common = 0;
+        for (auto w : m_neighbors) {
+            if (w != a && m_mark[w] == m_mark_id) {
+                common++;
+            }
+        }
+        if (common != shared) {
+            return false;
+        }
+
+        const uint32_t ends[2] = { a, b };
+        for (auto v : ends) {
+            for (uint32_t r = 0; r < m_ref_count[v]; ++r) {
+                auto t = m_refs[m_ref_first[v] + r];
+                auto tri = &m_tris[static_cast<size_t>(t) * VERTEX_PER_TRIANGLE];
+                if (m_dead[t] || tri[0] == (v == a ? b : a) || tri[1] == (v == a ? b : a) || tri[2] == (v == a ? b : a)) {
+                    continue;
+                }
+                const double* before[3] = { pos(tri[0]), pos(tri[1]), pos(tri[2]) };
+                const double* after[3] = { before[0], before[1], before[2] };
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                    if (tri[i] == v) {
+                        after[i] = p;
+                    }
+                }
+                double n0[3];
+                double n1[3];
+                cross(before[0], before[1], before[2], n0);
+                cross(after[0], after[1], after[2], n1);
+                auto l0 = dot(n0, n0);
+                auto l1 = dot(n1, n1);
+                if (l0 > 0.0 && (!(l1 > 0.0) || dot(n0, n1) < MIN_NORMAL_COS * std::sqrt(l0 * l1))) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // apply
+    // move a to p and give it the triangles of b
+    // the triangles of the edge are removed
+    void edge_collapser::apply(uint32_t a, uint32_t b, const double p[3])
+    {
+        auto first = static_cast<uint32_t>(m_refs.size());
+        const uint32_t ends[2] = { a, b };
+        for (auto v : ends) {
+            for (uint32_t r = 0; r < m_ref_count[v]; ++r) {
+                auto t = m_refs[m_ref_first[v] + r];
+                if (m_dead[t]) {
+                    continue;
+                }
+                auto tri = &m_tris[static_cast<size_t>(t) * VERTEX_PER_TRIANGLE];
+                auto has_a = tri[0] == a || tri[1] == a || tri[2] == a;
+                auto has_b = tri[0] == b || tri[1] == b || tri[2] == b;
+                if (has_a && has_b) {
+                    m_dead[t] = 1;
+                    m_live--;
+                    continue;
+                }
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                    if (tri[i] == b) {
+                        tri[i] = a;
+                    }
+                }
+                m_refs.push_back(t);
+            }
+        }
+        m_ref_first[a] = first;
+        m_ref_count[a] = static_cast<uint32_t>(m_refs.size()) - first;
+        m_ref_count[b] = 0;
+
+        memcpy(&m_pos[static_cast<size_t>(a) * AXIS_PER_VERTEX], p, AXIS_PER_VERTEX * sizeof(double));
+        m_quadrics[a].add(m_quadrics[b]);
+        m_removed[b] = 1;
+        m_stamp[a]++;
+        queue_edges(a);
+    }
+
+    // run
+    // collapse the cheapest edges until target triangles are left
+    void edge_collapser::run(size_t target, double max_error)
+    {
+        while (m_live > target && !m_queue.empty()) {
+            auto next = m_queue.top();
+            m_queue.pop();
+            if (next.cost > max_error) {
+                break;
+            }
+            if (m_removed[next.a] || m_removed[next.b] ||
+                m_stamp[next.a] != next.stamp_a || m_stamp[next.b] != next.stamp_b) {
+                continue;
+            }
+
+            // collapse into the locked end, if any
+            auto a = next.a;
+            auto b = next.b;
+            if (m_locked[b]) {
+                std::swap(a, b);
+            }
+            double p[3];
+            double cost = 0.0;
+            if (!place(a, b, p, cost) || !can_collapse(a, b, p)) {
+                continue;
+            }
+            apply(a, b, p);
+        }
+        m_queue = decltype(m_queue)();
+    }
+
+    // store
+    // append the live triangles with global vertex numbers and write
+    // back the vertices that belong to the partition
+    void edge_collapser::store(std::vector<uint32_t>& indices, std::vector<float>& vertices,
+        const std::vector<uint32_t>& owner, uint32_t partition) const
+    {
+        indices.clear();
+        indices.reserve(m_live * VERTEX_PER_TRIANGLE);
+        for (size_t t = 0; t < m_dead.size(); ++t) {
+            if (m_dead[t]) {
+                continue;
+            }
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                indices.push_back(m_global[m_tris[t * VERTEX_PER_TRIANGLE + i]]);
+            }
+        }
+
+        for (size_t v = 0; v < m_global.size(); ++v) {
+            if (m_removed[v] || (!owner.empty() && owner[m_global[v]] != partition)) {
+                continue;
+            }
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                vertices[static_cast<size_t>(m_global[v]) * AXIS_PER_VERTEX + ax] = static_cast<float>(m_pos[v * AXIS_PER_VERTEX + ax]);
+            }
+        }
+    }
+}
+
+// stl_lod_name
+// insert _lod<level> before the extension
+std::string stl_lod_name(const char* name, size_t level)
+{
+    std::string result(name);
+    auto extension = result.find_last_of('.');
+    auto slash = result.find_last_of("/\\");
+    if (extension == std::string::npos || (slash != std::string::npos && extension < slash)) {
+        extension = result.size();
+    }
+    return result.insert(extension, "_lod" + std::to_string(level));
+}
+
+// build
+// weld the stl into the vertices and triangles to simplify
+int stl_decimator::build(const stl& mesh, float epsilon)
+{
+    clear();
+
+    stl_indexed_mesh indexed;
+    indexed.build(mesh, epsilon, m_num_threads);
+    m_vertices = std::move(indexed.m_vertices);
+    m_indices = std::move(indexed.m_indices);
+    memcpy(m_header, mesh.m_header, STL_HEADER_SIZE);
+
+    if (num_triangles() >= 2 * m_partition_triangles) {
+        sort_triangles();
+    }
+    return 0;
+}
+
+// clear
+void stl_decimator::clear()
+{
+    m_vertices.clear();
+    m_indices.clear();
+    memset(m_header, 0, STL_HEADER_SIZE);
+}
+
+// sort_triangles
+// put the triangles in Morton order of their centers so the
+// partitions cut from the order are compact
+void stl_decimator::sort_triangles()
+{
+    auto triangles = num_triangles();
+    float min[3] = { m_vertices[0], m_vertices[1], m_vertices[2] };
+    float max[3] = { min[0], min[1], min[2] };
+    for (size_t v = 0; v < m_vertices.size(); v += AXIS_PER_VERTEX) {
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            min[ax] = std::min(min[ax], m_vertices[v + ax]);
+            max[ax] = std::max(max[ax], m_vertices[v + ax]);
+        }
+    }
+
+    double scale[3];
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        auto extent = static_cast<double>(max[ax]) - min[ax];
+        scale[ax] = extent > 0.0 ? 1023.0 / extent : 0.0;
+    }
+
+    std::vector<uint64_t> keys(triangles);
+    stl_parallel_blocks(triangles, STL_VERTEX_BLOCK_SIZE, stl_thread_count(m_num_threads), [&](size_t first, size_t count) {
+        for (auto t = first; t < first + count; ++t) {
+            uint32_t cell[3];
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                double center = 0.0;
+                for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                    center += m_vertices[static_cast<size_t>(m_indices[t * VERTEX_PER_TRIANGLE + i]) * AXIS_PER_VERTEX + ax];
+                }
+                auto c = (center / VERTEX_PER_TRIANGLE - min[ax]) * scale[ax];
+                cell[ax] = c > 0.0 ? static_cast<uint32_t>(std::min(c, 1023.0)) : 0;
+            }
+            keys[t] = (static_cast<uint64_t>(morton_code(cell[0], cell[1], cell[2])) << 32) | t;
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> sorted(m_indices.size());
+    for (size_t t = 0; t < triangles; ++t) {
+        auto from = static_cast<size_t>(keys[t] & 0xFFFFFFFFU) * VERTEX_PER_TRIANGLE;
+        memcpy(&sorted[t * VERTEX_PER_TRIANGLE], &m_indices[from], VERTEX_PER_TRIANGLE * sizeof(uint32_t));
+    }
+    m_indices.swap(sorted);
+}
+
+// simplify
+// partitioned passes while the mesh is large, then 1 pass over the
+// whole mesh if the target has not been reached
+size_t stl_decimator::simplify(size_t target_triangles, double max_error)
+{
+    for (auto pass = 0; pass < STL_DECIMATE_PASSES && num_triangles() > target_triangles; ++pass) {
+        auto partitions = m_partition_triangles > 0 ? num_triangles() / m_partition_triangles : 0;
+        if (partitions < 2) {
+            break;
+        }
+        auto before = num_triangles();
+        simplify_pass(target_triangles, max_error, partitions, (pass & 1) != 0);
+        if (num_triangles() == before) {
+            break;
+        }
+    }
+
+    if (num_triangles() > target_triangles) {
+        simplify_pass(target_triangles, max_error, 1, false);
+    }
+    return num_triangles();
+}
+
+// simplify_pass
+// cut the triangles into partitions and simplify them on the worker
+// threads, each removes its share of the triangles above target
+void stl_decimator::simplify_pass(size_t target, double max_error, size_t partitions, bool shifted)
+{
+    auto triangles = num_triangles();
+    auto size = (triangles + partitions - 1) / partitions;
+
+    std::vector<size_t> cuts(1, 0);
+    for (auto cut = shifted ? size / 2 : size; cut < triangles; cut += size) {
+        cuts.push_back(cut);
+    }
+    cuts.push_back(triangles);
+    partitions = cuts.size() - 1;
+
+    // the vertices used by more than 1 partition are locked
+    std::vector<uint32_t> owner;
+    if (partitions > 1) {
+        owner.assign(m_vertices.size() / AXIS_PER_VERTEX, NO_PARTITION);
+        for (size_t part = 0; part < partitions; ++part) {
+            for (auto corner = cuts[part] * VERTEX_PER_TRIANGLE; corner < cuts[part + 1] * VERTEX_PER_TRIANGLE; ++corner) {
+                auto& o = owner[m_indices[corner]];
+                o = o == NO_PARTITION || o == part ? static_cast<uint32_t>(part) : SHARED_VERTEX;
+            }
+        }
+    }
+
+    std::vector<std::vector<uint32_t>> results(partitions);
+    stl_parallel_for(partitions, stl_thread_count(m_num_threads), [&](size_t part) {
+        auto count = cuts[part + 1] - cuts[part];
+        auto remove = static_cast<size_t>(static_cast<double>(count) * static_cast<double>(triangles - target) / static_cast<double>(triangles));
+
+        edge_collapser collapser;
+        collapser.load(&m_indices[cuts[part] * VERTEX_PER_TRIANGLE], count, m_vertices, owner, static_cast<uint32_t>(part));
+        collapser.run(count - std::min(remove, count), max_error);
+        collapser.store(results[part], m_vertices, owner, static_cast<uint32_t>(part));
+    });
+
+    m_indices.clear();
+    for (auto& result : results) {
+        m_indices.insert(m_indices.end(), result.begin(), result.end());
+    }
+}
+
+// to_stl
+// copy the triangles into a stl in its layout and calculate the normals
+int stl_decimator::to_stl(stl& mesh) const
+{
+    auto triangles = num_triangles();
+    auto corners = triangles * VERTEX_PER_TRIANGLE;
+    memcpy(mesh.m_header, m_header, STL_HEADER_SIZE);
+    mesh.m_num_triangles = static_cast<uint32_t>(triangles);
+    mesh.m_rgb_color.clear();
+
+    auto soa = mesh.m_layout == stl_soa;
+    if (soa) {
+        mesh.m_vectors.clear();
+        mesh.m_x.resize(corners);
+        mesh.m_y.resize(corners);
+        mesh.m_z.resize(corners);
+    }
+    else {
+        mesh.m_x.clear();
+        mesh.m_y.clear();
+        mesh.m_z.clear();
+        mesh.m_vectors.resize(corners * AXIS_PER_VERTEX);
+    }
+
+    for (size_t corner = 0; corner < corners; ++corner) {
+        auto v = &m_vertices[static_cast<size_t>(m_indices[corner]) * AXIS_PER_VERTEX];
+        if (soa) {
+            mesh.m_x[corner] = v[0];
+            mesh.m_y[corner] = v[1];
+            mesh.m_z[corner] = v[2];
+        }
+        else {
+            memcpy(&mesh.m_vectors[corner * AXIS_PER_VERTEX], v, AXIS_PER_VERTEX * sizeof(float));
+        }
+    }
+    mesh.calc_normals();
+    return 0;
+}
+
+// write_lods
+// each level is simplified from the one before it
+int stl_decimator::write_lods(const char* name, const std::vector<size_t>& targets, double max_error)
+{
+    auto levels = 0;
+    stl lod;
+    lod.m_num_threads = m_num_threads;
+    for (auto target : targets) {
+        simplify(target, max_error);
+        to_stl(lod);
+        lod.create_stl_binary(stl_lod_name(name, ++levels).c_str());
+    }
+    return levels;
+}
@@ -0,0 +1,72 @@
+// stl_decimate.h : quadric error edge collapse decimation of a stl
+//
+
+#ifndef STL_DECIMATE_H
+#define STL_DECIMATE_H
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+
+constexpr size_t STL_DECIMATE_PARTITION_TRIANGLES = 1U << 18;
+constexpr int STL_DECIMATE_PASSES = 4;
+
+// name of level of detail level of a stl
+// the lod 1 of part.stl is part_lod1.stl
+std::string stl_lod_name(const char* name, size_t level);
+
+// stl_decimator
+// reduces a stl with quadric error edge collapses (Garland and Heckbert).
+// Every vertex gets the quadric of the planes of its triangles and the
+// edge whose collapse adds the least error is taken from a priority
+// queue. The vertex that is kept moves to the point of least error.
+// Collapses that flip a triangle or make an edge non manifold are
+// skipped, the vertices of boundary and non manifold edges stay put.
+//
+// Meshes of more than 2 partitions are sorted in Morton order and cut
+// into partitions of m_partition_triangles, which are simplified on the
+// worker threads with the vertices they share locked. The cuts move by
+// half a partition between passes so the locked vertices can collapse in
+// the next pass. The quadrics are made again from the triangles at the
+// start of each pass. The partitions do not depend on the thread count,
+// so neither does the result.
+//
+// simplify can be called again with a smaller target, each level of
+// detail then starts from the last one. The colors of the stl are lost.
+class stl_decimator
+{
+public:
+    std::vector<float> m_vertices;
+    std::vector<uint32_t> m_indices;
+    char m_header[STL_HEADER_SIZE] = { 0 };
+
+    // worker threads for the partitions, 0 = hardware concurrency, 1 = serial
+    unsigned m_num_threads = 0;
+    size_t m_partition_triangles = STL_DECIMATE_PARTITION_TRIANGLES;
+
+    int build(const stl& mesh, float epsilon = 0.0f);
+    void clear();
+
+    // collapse edges until target_triangles are left or the next
+    // collapse adds more than max_error, a sum of squared plane distances
+    // return the number of triangles left
+    size_t simplify(size_t target_triangles, double max_error = std::numeric_limits<double>::max());
+
+    size_t num_triangles() const { return m_indices.size() / VERTEX_PER_TRIANGLE; }
+    int to_stl(stl& mesh) const;
+
+    // simplify to each target in turn and write every level with
+    // create_stl_binary to stl_lod_name(name, level), level 1 first
+    // return the number of levels written
+    int write_lods(const char* name, const std::vector<size_t>& targets,
+        double max_error = std::numeric_limits<double>::max());
+
+private:
+    void sort_triangles();
+    void simplify_pass(size_t target, double max_error, size_t partitions, bool shifted);
+};
+
+#endif
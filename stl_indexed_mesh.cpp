@@ -0,0 +1,306 @@
+// stl_indexed_mesh.cpp : indexed triangle mesh built from stl data
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "stl_indexed_mesh.h"
+#include "stl_parallel.h"
+
+namespace
+{
+    constexpr uint32_t EMPTY_CORNER = 0xFFFFFFFFU;
+
+    // weld key of a vertex
+    // either the bits of xyz or the grid cell of xyz
+    struct weld_key
+    {
+        uint64_t axis[AXIS_PER_VERTEX];
+        uint32_t raw;
+
+        bool operator==(const weld_key& other) const
+        {
+            return axis[0] == other.axis[0] && axis[1] == other.axis[1] &&
+                axis[2] == other.axis[2] && raw == other.raw;
+        }
+    };
+
+    // make the key of the vertex at p
+    // scale is 1 / epsilon, or 0 to weld exact positions
+    // values that have no grid cell (nan, inf, huge) keep their bits
+    inline weld_key make_key(const float* p, float scale)
+    {
+        weld_key key = { { 0, 0, 0 }, 0 };
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            uint32_t bits = 0;
+            memcpy(&bits, &p[ax], sizeof(bits));
+            auto cell = std::floor(static_cast<double>(p[ax]) * scale);
+            if (scale != 0.0f && std::fabs(cell) < 4.0e18) {
+                key.axis[ax] = static_cast<uint64_t>(static_cast<int64_t>(cell));
+            }
+            else {
+                key.axis[ax] = bits;
+                key.raw |= 1U << ax;
+            }
+        }
+        return key;
+    }
+
+    inline uint64_t hash_key(const weld_key& key)
+    {
+        uint64_t h = 0x9E3779B97F4A7C15ULL ^ key.raw;
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            h = (h ^ key.axis[ax]) * 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 32;
+        }
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 29);
+    }
+
+    // open addressing table from weld key to vertex id
+    // an entry holds the first corner with the key and its id,
+    // the key itself is made again from the corner when comparing
+    class weld_table
+    {
+    public:
+        weld_table(const float* positions, float scale, size_t expected)
+            : m_positions(positions), m_scale(scale)
+        {
+            size_t capacity = 16;
+            while (capacity < expected * 2) {
+                capacity *= 2;
+            }
+            m_entries.assign(capacity, { EMPTY_CORNER, 0 });
+            m_mask = capacity - 1;
+        }
+
+        // return the id of the key
+        // a new key is added with corner and id
+        uint32_t find_or_insert(const weld_key& key, uint64_t hash, uint32_t corner, uint32_t id, bool& inserted)
+        {
+            if ((m_size + 1) * 2 > m_entries.size()) {
+                grow();
+            }
+
+            for (auto slot = hash & m_mask;; slot = (slot + 1) & m_mask) {
+                auto& entry = m_entries[slot];
+                if (entry.corner == EMPTY_CORNER) {
+                    entry = { corner, id };
+                    ++m_size;
+                    inserted = true;
+                    return id;
+                }
+                if (make_key(&m_positions[entry.corner * static_cast<size_t>(AXIS_PER_VERTEX)], m_scale) == key) {
+                    inserted = false;
+                    return entry.id;
+                }
+            }
+        }
+
+    private:
+        struct entry
+        {
+            uint32_t corner;
+            uint32_t id;
+        };
+
+        const float* m_positions;
+        float m_scale;
+        std::vector<entry> m_entries;
+        size_t m_mask = 0;
+        size_t m_size = 0;
+
+        void grow()
+        {
+            std::vector<entry> old(m_entries.size() * 2, { EMPTY_CORNER, 0 });
+            old.swap(m_entries);
+            m_mask = m_entries.size() - 1;
+
+            for (auto& e : old) {
+                if (e.corner == EMPTY_CORNER) {
+                    continue;
+                }
+                auto hash = hash_key(make_key(&m_positions[e.corner * static_cast<size_t>(AXIS_PER_VERTEX)], m_scale));
+                auto slot = hash & m_mask;
+                while (m_entries[slot].corner != EMPTY_CORNER) {
+                    slot = (slot + 1) & m_mask;
+                }
+                m_entries[slot] = e;
+            }
+        }
+    };
+}
+
+// build
+// weld the vertices of the stl triangles
+// epsilon 0 welds exact positions only
+// threads 0 uses the hardware concurrency
+int stl_indexed_mesh::build(const stl& mesh, float epsilon, unsigned threads)
+{
+    clear();
+
+    auto corners = (mesh.num_vertices() / VERTEX_PER_TRIANGLE) * VERTEX_PER_TRIANGLE;
+    if (corners >= EMPTY_CORNER) {
+        throw std::runtime_error("stl has too many vertices for 32 bit indices.");
+    }
+    if (corners == 0) {
+        return 0;
+    }
+
+    // the soa layout is welded from an interleaved copy
+    std::vector<float> interleaved;
+    auto positions = mesh.m_vectors.data();
+    if (mesh.m_layout == stl_soa) {
+        interleaved.resize(corners * AXIS_PER_VERTEX);
+        for (size_t corner = 0; corner < corners; ++corner) {
+            interleaved[corner * AXIS_PER_VERTEX] = mesh.m_x[corner];
+            interleaved[corner * AXIS_PER_VERTEX + 1] = mesh.m_y[corner];
+            interleaved[corner * AXIS_PER_VERTEX + 2] = mesh.m_z[corner];
+        }
+        positions = interleaved.data();
+    }
+
+    threads = stl_thread_count(threads);
+    if (threads > 1 && corners >= STL_WELD_PARALLEL_MIN_CORNERS) {
+        build_parallel(positions, corners, epsilon > 0.0f ? epsilon : 0.0f, threads);
+    }
+    else {
+        build_serial(positions, corners, epsilon > 0.0f ? epsilon : 0.0f);
+    }
+    return 0;
+}
+
+// build_serial
+// one hash table over all the corners
+void stl_indexed_mesh::build_serial(const float* positions, size_t corners, float epsilon)
+{
+    auto scale = epsilon > 0.0f ? 1.0f / epsilon : 0.0f;
+    weld_table table(positions, scale, corners / 4);
+
+    m_indices.resize(corners);
+    for (size_t corner = 0; corner < corners; ++corner) {
+        auto p = &positions[corner * AXIS_PER_VERTEX];
+        auto key = make_key(p, scale);
+        auto inserted = false;
+        auto id = table.find_or_insert(key, hash_key(key), static_cast<uint32_t>(corner),
+            static_cast<uint32_t>(num_vertices()), inserted);
+        if (inserted) {
+            m_vertices.insert(m_vertices.end(), p, p + AXIS_PER_VERTEX);
+        }
+        m_indices[corner] = id;
+    }
+}
+
+// build_parallel
+// the corners are split into shards by the top bits of their hash
+// and each shard is welded on its own with its own table.
+// Vertex ids are then handed out in order of first appearance,
+// so the result is the same as build_serial.
+void stl_indexed_mesh::build_parallel(const float* positions, size_t corners, float epsilon, unsigned threads)
+{
+    auto scale = epsilon > 0.0f ? 1.0f / epsilon : 0.0f;
+
+    auto shard_bits = 1U;
+    while ((1U << shard_bits) < threads * 4U && shard_bits < 8U) {
+        ++shard_bits;
+    }
+    auto shards = size_t(1) << shard_bits;
+    auto chunks = static_cast<size_t>(threads) * 4;
+    auto chunk_size = (corners + chunks - 1) / chunks;
+    chunks = (corners + chunk_size - 1) / chunk_size;
+
+    // shard of each corner and the number of corners per chunk and shard
+    std::vector<uint8_t> shard_of(corners);
+    std::vector<size_t> offsets(chunks * shards, 0);
+    stl_parallel_for(chunks, threads, [&](size_t chunk) {
+        auto count = &offsets[chunk * shards];
+        auto end = std::min(corners, (chunk + 1) * chunk_size);
+        for (auto corner = chunk * chunk_size; corner < end; ++corner) {
+            auto shard = static_cast<uint8_t>(hash_key(make_key(&positions[corner * AXIS_PER_VERTEX], scale)) >> (64 - shard_bits));
+            shard_of[corner] = shard;
+            ++count[shard];
+        }
+    });
+
+    // the corners of a shard are listed in increasing order
+    std::vector<size_t> shard_begin(shards + 1, 0);
+    size_t offset = 0;
+    for (size_t shard = 0; shard < shards; ++shard) {
+        shard_begin[shard] = offset;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            auto count = offsets[chunk * shards + shard];
+            offsets[chunk * shards + shard] = offset;
+            offset += count;
+        }
+    }
+    shard_begin[shards] = offset;
+
+    std::vector<uint32_t> order(corners);
+    stl_parallel_for(chunks, threads, [&](size_t chunk) {
+        auto next = &offsets[chunk * shards];
+        auto end = std::min(corners, (chunk + 1) * chunk_size);
+        for (auto corner = chunk * chunk_size; corner < end; ++corner) {
+            order[next[shard_of[corner]]++] = static_cast<uint32_t>(corner);
+        }
+    });
+    std::vector<uint8_t>().swap(shard_of);
+
+    // first corner with the same key for every corner
+    std::vector<uint32_t> first(corners);
+    stl_parallel_for(shards, threads, [&](size_t shard) {
+        auto begin = shard_begin[shard];
+        auto end = shard_begin[shard + 1];
+        weld_table table(positions, scale, (end - begin) / 4);
+        for (auto i = begin; i < end; ++i) {
+            auto corner = order[i];
+            auto key = make_key(&positions[corner * static_cast<size_t>(AXIS_PER_VERTEX)], scale);
+            auto inserted = false;
+            first[corner] = table.find_or_insert(key, hash_key(key), corner, corner, inserted);
+        }
+    });
+
+    // number the first corners in order, the ids go into order
+    std::vector<uint32_t> chunk_ids(chunks + 1, 0);
+    stl_parallel_for(chunks, threads, [&](size_t chunk) {
+        uint32_t count = 0;
+        auto end = std::min(corners, (chunk + 1) * chunk_size);
+        for (auto corner = chunk * chunk_size; corner < end; ++corner) {
+            count += first[corner] == corner ? 1 : 0;
+        }
+        chunk_ids[chunk + 1] = count;
+    });
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        chunk_ids[chunk + 1] += chunk_ids[chunk];
+    }
+
+    m_vertices.resize(static_cast<size_t>(chunk_ids[chunks]) * AXIS_PER_VERTEX);
+    stl_parallel_for(chunks, threads, [&](size_t chunk) {
+        auto id = chunk_ids[chunk];
+        auto end = std::min(corners, (chunk + 1) * chunk_size);
+        for (auto corner = chunk * chunk_size; corner < end; ++corner) {
+            if (first[corner] == corner) {
+                memcpy(&m_vertices[id * static_cast<size_t>(AXIS_PER_VERTEX)], &positions[corner * AXIS_PER_VERTEX],
+                    AXIS_PER_VERTEX * sizeof(float));
+                order[corner] = id++;
+            }
+        }
+    });
+
+    // a first corner always comes before the corners welded to it
+    m_indices.resize(corners);
+    stl_parallel_for(chunks, threads, [&](size_t chunk) {
+        auto end = std::min(corners, (chunk + 1) * chunk_size);
+        for (auto corner = chunk * chunk_size; corner < end; ++corner) {
+            m_indices[corner] = order[first[corner]];
+        }
+    });
+}
+
+// clear
+// drop the vertices and indices
+void stl_indexed_mesh::clear()
+{
+    m_vertices.clear();
+    m_indices.clear();
+}
@@ -0,0 +1,39 @@
+// stl_indexed_mesh.h : indexed triangle mesh built from stl data
+//
+
+#ifndef STL_INDEXED_MESH_H
+#define STL_INDEXED_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stl.h"
+
+constexpr size_t STL_WELD_PARALLEL_MIN_CORNERS = 1U << 18;
+
+// stl_indexed_mesh
+// each distinct vertex is stored once in m_vertices (xyz)
+// and every triangle is 3 indices into it in m_indices
+//
+// vertices are welded when their positions are bit for bit equal,
+// or with an epsilon when they fall into the same cell of a grid
+// with cells epsilon wide. Vertices keep the order in which they
+// first appear in the stl and the position of the first one is used.
+class stl_indexed_mesh
+{
+public:
+    std::vector<float> m_vertices;
+    std::vector<uint32_t> m_indices;
+
+    int build(const stl& mesh, float epsilon = 0.0f, unsigned threads = 0);
+    void clear();
+
+    size_t num_vertices() const { return m_vertices.size() / AXIS_PER_VERTEX; }
+    size_t num_triangles() const { return m_indices.size() / VERTEX_PER_TRIANGLE; }
+
+private:
+    void build_serial(const float* positions, size_t corners, float epsilon);
+    void build_parallel(const float* positions, size_t corners, float epsilon, unsigned threads);
+};
+
+#endif
@@ -0,0 +1,153 @@
+// stl_merge.cpp : merge stl files into one binary stl
+//
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+#include "stl_merge.h"
+#include "stl_parallel.h"
+#include "stl_simd.h"
+#include "stl_stream.h"
+
+namespace
+{
+    constexpr size_t FLOATS_PER_TRIANGLE = VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX;
+    constexpr uint64_t RECORDS_OFFSET = STL_HEADER_SIZE + STL_COUNT_SIZE;
+
+    // what opening a part found out
+    struct part_info
+    {
+        bool binary;
+        uint32_t triangles;     // binary only
+        uint64_t offset;        // binary only
+    };
+
+    // transform a batch and pack it into 50 byte records
+    void pack_batch(const std::vector<stl_triangle>& batch, size_t count, const float matrix[16],
+        const float normal_matrix[9], bool mirror, std::vector<float>& vectors, std::vector<float>& normals, std::vector<char>& records)
+    {
+        vectors.resize(count * FLOATS_PER_TRIANGLE);
+        normals.resize(count * AXIS_PER_VERTEX);
+        records.resize(count * STL_TRIANGLE_SIZE);
+        for (size_t t = 0; t < count; ++t) {
+            memcpy(&vectors[t * FLOATS_PER_TRIANGLE], batch[t].vertices, sizeof(batch[t].vertices));
+            memcpy(&normals[t * AXIS_PER_VERTEX], batch[t].normal, sizeof(batch[t].normal));
+        }
+
+        stl_simd_affine(vectors.data(), count * VERTEX_PER_TRIANGLE, matrix);
+        stl_simd_linear_normalize(normals.data(), count, normal_matrix);
+
+        for (size_t t = 0; t < count; ++t) {
+            auto v = &vectors[t * FLOATS_PER_TRIANGLE];
+            if (mirror) {
+                std::swap_ranges(v + AXIS_PER_VERTEX, v + 2 * AXIS_PER_VERTEX, v + 2 * AXIS_PER_VERTEX);
+            }
+            stl_pack_triangle(&records[t * STL_TRIANGLE_SIZE], &normals[t * AXIS_PER_VERTEX], v, batch[t].attribute);
+        }
+    }
+}
+
+// stl_merge
+// open every part to place the binary ones, then read, transform and
+// write the parts in parallel, each worker with its own output handle
+uint64_t stl_merge(const std::vector<stl_merge_part>& parts, const char* name, const char* header, unsigned threads)
+{
+    threads = stl_thread_count(threads);
+
+    std::vector<part_info> info(parts.size());
+    stl_parallel_for(parts.size(), threads, [&](size_t index) {
+        stl_stream in;
+        in.open(parts[index].name.c_str());
+        info[index].binary = in.is_binary();
+        info[index].triangles = in.triangles_remaining();
+    });
+
+    uint64_t binary_triangles = 0;
+    for (auto& part : info) {
+        part.offset = RECORDS_OFFSET + binary_triangles * STL_TRIANGLE_SIZE;
+        binary_triangles += part.triangles;
+    }
+    if (binary_triangles > UINT32_MAX) {
+        throw std::runtime_error("Too many triangles for a stl file.");
+    }
+
+    // ascii parts first, their size is not known, then the largest binary parts
+    std::vector<size_t> order(parts.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (info[a].binary != info[b].binary) {
+            return !info[a].binary;
+        }
+        return info[a].triangles > info[b].triangles;
+    });
+
+    {
+        std::ofstream out(name, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error(std::string("Unable to open stl output file ") + name + ".");
+        }
+        char buffer[STL_HEADER_SIZE + STL_COUNT_SIZE] = { 0 };
+        if (header != nullptr) {
+            memcpy(buffer, header, strnlen(header, STL_HEADER_SIZE));
+        }
+        out.write(buffer, sizeof(buffer));
+        if (!out) {
+            throw std::runtime_error(std::string("Unable to write stl output file ") + name + ".");
+        }
+    }
+
+    std::atomic<uint64_t> tail{ RECORDS_OFFSET + binary_triangles * STL_TRIANGLE_SIZE };
+    std::atomic<uint64_t> ascii_triangles{ 0 };
+    stl_parallel_for(parts.size(), threads, [&](size_t task) {
+        auto index = order[task];
+        auto& part = parts[index];
+
+        stl_stream in;
+        in.open(part.name.c_str());
+        if (in.is_binary() != info[index].binary || (in.is_binary() && in.triangles_remaining() != info[index].triangles)) {
+            throw std::runtime_error(part.name + " changed while merging.");
+        }
+
+        std::fstream out(name, std::ios::in | std::ios::out | std::ios::binary);
+        if (!out.is_open()) {
+            throw std::runtime_error(std::string("Unable to open stl output file ") + name + ".");
+        }
+
+        float normal_matrix[9];
+        auto mirror = stl_normal_matrix(part.matrix, normal_matrix) < 0.0f;
+
+        std::vector<stl_triangle> batch;
+        std::vector<float> vectors;
+        std::vector<float> normals;
+        std::vector<char> records;
+        auto offset = info[index].offset;
+        for (size_t count; (count = in.read(batch)) > 0;) {
+            pack_batch(batch, count, part.matrix, normal_matrix, mirror, vectors, normals, records);
+            if (!info[index].binary) {
+                if (ascii_triangles.fetch_add(count) + count + binary_triangles > UINT32_MAX) {
+                    throw std::runtime_error("Too many triangles for a stl file.");
+                }
+                offset = tail.fetch_add(records.size());
+            }
+            out.seekp(static_cast<std::streamoff>(offset));
+            out.write(records.data(), static_cast<std::streamsize>(records.size()));
+            offset += records.size();
+            if (!out) {
+                throw std::runtime_error(std::string("Unable to write stl output file ") + name + ".");
+            }
+        }
+    });
+
+    auto triangles = binary_triangles + ascii_triangles.load();
+    std::fstream out(name, std::ios::in | std::ios::out | std::ios::binary);
+    auto count = static_cast<uint32_t>(triangles);
+    out.seekp(STL_HEADER_SIZE);
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    if (!out) {
+        throw std::runtime_error(std::string("Unable to write stl output file ") + name + ".");
+    }
+    return triangles;
+}
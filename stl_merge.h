@@ -0,0 +1,41 @@
+// stl_merge.h : merge stl files into one binary stl
+//
+
+#ifndef STL_MERGE_H
+#define STL_MERGE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+
+// a file to merge and where to place it
+// matrix is row major 4 x 4 as for stl::transform
+struct stl_merge_part
+{
+    std::string name;
+    float matrix[16] = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+};
+
+// stl_merge
+// read the parts on up to threads threads, transform them the way
+// stl::transform does and write them to a binary stl. header may be
+// null for an empty header, it is copied up to its terminating 0 or
+// STL_HEADER_SIZE characters and padded with 0.
+//
+// The triangle counts in the headers of the binary parts give each of
+// them a fixed place in the output, in the order of parts, so every
+// part is written as soon as it is read and no part waits for another.
+// Ascii parts follow the binary ones, each batch where an atomic tail
+// has reserved room for it, so their order depends on the threads.
+// Attributes are copied unchanged and the triangle count is written
+// last. Return the number of triangles written.
+uint64_t stl_merge(const std::vector<stl_merge_part>& parts, const char* name, const char* header = nullptr, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,110 @@
+// stl_metrics.cpp : volume, area, centroid and inertia of a stl
+//
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "stl_metrics.h"
+#include "stl_parallel.h"
+#include "stl_simd.h"
+
+namespace
+{
+    // Neumaier summation
+    struct neumaier_sum
+    {
+        double sum = 0.0;
+        double carry = 0.0;
+
+        void add(double value)
+        {
+            auto t = sum + value;
+            if (std::fabs(sum) >= std::fabs(value)) {
+                carry += (sum - t) + value;
+            }
+            else {
+                carry += (value - t) + sum;
+            }
+            sum = t;
+        }
+
+        double value() const { return sum + carry; }
+    };
+}
+
+// stl_compute_metrics
+// volume, area, centroid and inertia in one pass over the triangles
+stl_metrics stl_compute_metrics(const stl& mesh, unsigned threads)
+{
+    stl_metrics metrics;
+    memset(&metrics, 0, sizeof(metrics));
+
+    auto box = mesh.bounds(threads);
+    auto triangles = mesh.num_vertices() / VERTEX_PER_TRIANGLE;
+    if (box.is_empty() || triangles == 0) {
+        return metrics;
+    }
+
+    // the middle of the box keeps the terms small on meshes far from 0
+    double origin[3];
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        origin[ax] = (static_cast<double>(box.min[ax]) + box.max[ax]) / 2.0;
+    }
+
+    auto blocks = (triangles + STL_METRICS_BLOCK_TRIANGLES - 1) / STL_METRICS_BLOCK_TRIANGLES;
+    std::vector<double> sums(blocks * STL_MASS_TERMS);
+    stl_parallel_blocks(triangles, STL_METRICS_BLOCK_TRIANGLES, stl_thread_count(threads), [&](size_t first, size_t count) {
+        // a single thread gets all the triangles at once
+        for (auto block = first; block < first + count; block += STL_METRICS_BLOCK_TRIANGLES) {
+            auto n = std::min(STL_METRICS_BLOCK_TRIANGLES, first + count - block);
+            auto dst = &sums[block / STL_METRICS_BLOCK_TRIANGLES * STL_MASS_TERMS];
+            if (mesh.m_layout == stl_soa) {
+                std::vector<float> vectors(n * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+                for (size_t tri = 0; tri < n; ++tri) {
+                    mesh.triangle_vertices(block + tri, &vectors[tri * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX]);
+                }
+                stl_simd_mass_terms(vectors.data(), n, origin, dst);
+            }
+            else {
+                stl_simd_mass_terms(&mesh.m_vectors[block * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX], n, origin, dst);
+            }
+        }
+    });
+
+    neumaier_sum total[STL_MASS_TERMS];
+    for (size_t block = 0; block < blocks; ++block) {
+        for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+            total[k].add(sums[block * STL_MASS_TERMS + k]);
+        }
+    }
+
+    metrics.volume = total[0].value() / 6.0;
+    metrics.area = total[1].value() / 2.0;
+    if (metrics.volume == 0.0) {
+        return metrics;
+    }
+
+    // centroid relative to the origin
+    double c[3];
+    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+        c[ax] = total[2 + ax].value() / 24.0 / metrics.volume;
+        metrics.centroid[ax] = origin[ax] + c[ax];
+    }
+
+    // second moments about the origin, then moved to the centroid
+    static const int pairs[6][2] = { { 0, 0 }, { 1, 1 }, { 2, 2 }, { 0, 1 }, { 1, 2 }, { 2, 0 } };
+    double m[3][3];
+    for (auto k = 0; k < 6; ++k) {
+        auto i = pairs[k][0];
+        auto j = pairs[k][1];
+        m[i][j] = m[j][i] = total[5 + k].value() / 120.0 - metrics.volume * c[i] * c[j];
+    }
+
+    auto trace = m[0][0] + m[1][1] + m[2][2];
+    for (auto i = 0; i < 3; ++i) {
+        for (auto j = 0; j < 3; ++j) {
+            metrics.inertia[i][j] = (i == j ? trace : 0.0) - m[i][j];
+        }
+    }
+    return metrics;
+}
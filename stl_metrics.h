@@ -0,0 +1,34 @@
+// stl_metrics.h : volume, area, centroid and inertia of a stl
+//
+
+#ifndef STL_METRICS_H
+#define STL_METRICS_H
+
+#include "stl.h"
+
+constexpr size_t STL_METRICS_BLOCK_TRIANGLES = 1U << 16;
+
+// mass properties of a closed stl as a solid of density 1
+// the volume is negative when the normals point inwards, the centroid
+// and inertia are then those of the negative mass. A mesh with no
+// volume has a centroid and inertia of 0.
+struct stl_metrics
+{
+    double volume;
+    double area;
+    double centroid[3];
+
+    // inertia tensor about the centroid
+    // the diagonal holds Ixx Iyy Izz, the rest the products of inertia
+    double inertia[3][3];
+};
+
+// stl_compute_metrics
+// every triangle adds the signed tetrahedron it forms with the middle
+// of the bounding box. The sums of each block of triangles are computed
+// with the vector kernels on the worker threads and the blocks are added
+// in order with Neumaier summation, so the result does not depend on
+// the thread count
+stl_metrics stl_compute_metrics(const stl& mesh, unsigned threads = 0);
+
+#endif
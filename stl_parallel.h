@@ -0,0 +1,96 @@
+// stl_parallel.h : worker threads for the stl algorithms
+//
+
+#ifndef STL_PARALLEL_H
+#define STL_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// number of worker threads to use
+// 0 picks the hardware concurrency
+inline unsigned stl_thread_count(unsigned requested)
+{
+    if (requested != 0) {
+        return requested;
+    }
+    auto hardware = std::thread::hardware_concurrency();
+    return hardware != 0 ? hardware : 1;
+}
+
+// stl_parallel_for
+// run task(index) for index 0 .. count - 1 on up to threads threads
+// the calling thread is one of the workers and tasks are handed out in order
+// if tasks throw, the exception of the lowest index is rethrown
+// after all the workers are done
+template <class Task>
+void stl_parallel_for(size_t count, unsigned threads, Task task)
+{
+    std::vector<std::exception_ptr> errors(count);
+    std::atomic<size_t> next{ 0 };
+
+    auto worker = [&]() {
+        for (;;) {
+            auto index = next++;
+            if (index >= count) {
+                break;
+            }
+            try {
+                task(index);
+            }
+            catch (...) {
+                errors[index] = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    auto workers = std::min<size_t>(std::max(threads, 1U), count);
+    for (size_t i = 1; i < workers; ++i) {
+        // run with the threads we have if no more can be started
+        try {
+            pool.emplace_back(worker);
+        }
+        catch (const std::system_error&) {
+            break;
+        }
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// stl_parallel_blocks
+// split count items into blocks of block_size and run task(first, count)
+// for each block on up to threads threads
+// a single block or a single thread runs task(0, count) on the calling thread
+template <class Task>
+void stl_parallel_blocks(size_t count, size_t block_size, unsigned threads, Task task)
+{
+    auto blocks = (count + block_size - 1) / block_size;
+    if (threads < 2 || blocks < 2) {
+        if (count > 0) {
+            task(size_t(0), count);
+        }
+        return;
+    }
+
+    stl_parallel_for(blocks, threads, [&](size_t block) {
+        auto first = block * block_size;
+        task(first, std::min(block_size, count - first));
+    });
+}
+
+#endif
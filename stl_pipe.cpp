@@ -0,0 +1,154 @@
+// stl_pipe.cpp : read a file on a reader thread through a ring of buffers
+//
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "stl_pipe.h"
+
+// class constructor
+// open the file and start the reader thread
+stl_pipe_source::stl_pipe_source(const char* name, size_t buffer_size, size_t buffers)
+{
+    m_file.open(name, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!m_file.is_open()) {
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+    m_size = static_cast<uint64_t>(m_file.tellg());
+    m_file.seekg(0, std::ios::beg);
+
+    // a small file gets small buffers
+    buffer_size = static_cast<size_t>(std::max<uint64_t>(std::min<uint64_t>(buffer_size, m_size), 1));
+    m_slots.resize(std::max<size_t>(buffers, 2));
+    for (auto& buffer : m_slots) {
+        buffer.data.resize(buffer_size);
+    }
+    m_reader = std::thread(&stl_pipe_source::run, this);
+}
+
+stl_pipe_source::~stl_pipe_source()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_freed.notify_all();
+    m_reader.join();
+}
+
+// run
+// the reader thread, fill the slots in ring order
+// a short slot marks the end of the file
+void stl_pipe_source::run()
+{
+    size_t next = 0;
+    for (;;) {
+        auto& buffer = m_slots[next];
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_freed.wait(lock, [&]() { return m_stop || !buffer.full; });
+            if (m_stop) {
+                return;
+            }
+        }
+
+        size_t count = 0;
+        try {
+            m_file.read(buffer.data.data(), static_cast<std::streamsize>(buffer.data.size()));
+            count = static_cast<size_t>(m_file.gcount());
+            if (m_file.bad()) {
+                throw std::runtime_error("Unable to read stl input file.");
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_error = std::current_exception();
+            m_done = true;
+            m_filled.notify_all();
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        buffer.size = count;
+        buffer.full = true;
+        if (count < buffer.data.size()) {
+            m_done = true;
+        }
+        m_filled.notify_all();
+        if (m_done) {
+            return;
+        }
+        next = (next + 1) % m_slots.size();
+    }
+}
+
+// wait_current
+// wait until the current slot is read, move on to the next one when the
+// current one is used up. return false at the end of the file
+bool stl_pipe_source::wait_current()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        auto& buffer = m_slots[m_cur];
+        m_filled.wait(lock, [&]() { return buffer.full || m_done; });
+        if (!buffer.full) {
+            if (m_error) {
+                std::rethrow_exception(m_error);
+            }
+            return false;
+        }
+        if (m_offset < buffer.size) {
+            return true;
+        }
+        if (buffer.size < buffer.data.size()) {
+            return false;
+        }
+
+        // hand the slot back to the reader
+        buffer.full = false;
+        m_offset = 0;
+        m_cur = (m_cur + 1) % m_slots.size();
+        m_freed.notify_all();
+    }
+}
+
+// peek
+// the unread bytes of the current buffer, size 0 at the end of the file
+const char* stl_pipe_source::peek(size_t& size)
+{
+    if (!wait_current()) {
+        size = 0;
+        return nullptr;
+    }
+    size = m_slots[m_cur].size - m_offset;
+    return m_slots[m_cur].data.data() + m_offset;
+}
+
+// read
+// copy up to size bytes, at most the rest of the current buffer
+size_t stl_pipe_source::read(char* dst, size_t size)
+{
+    size_t available = 0;
+    auto src = peek(available);
+    auto count = std::min(size, available);
+    if (count > 0) {
+        memcpy(dst, src, count);
+        m_offset += count;
+    }
+    return count;
+}
+
+// read_full
+// copy size bytes or up to the end of the file
+size_t stl_pipe_source::read_full(char* dst, size_t size)
+{
+    size_t total = 0;
+    while (total < size) {
+        auto count = read(dst + total, size - total);
+        if (count == 0) {
+            break;
+        }
+        total += count;
+    }
+    return total;
+}
@@ -0,0 +1,69 @@
+// stl_pipe.h : read a file on a reader thread through a ring of buffers
+//
+
+#ifndef STL_PIPE_H
+#define STL_PIPE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "stl_ascii_scanner.h"
+
+constexpr size_t STL_PIPE_BUFFER_SIZE = 1U << 22;
+constexpr size_t STL_PIPE_BUFFERS = 4;
+
+// stl_pipe_source
+// a reader thread fills a ring of large buffers from the file while
+// the consumer works through the buffers already read, so the disk
+// and the parser run at the same time. The consumer reads the bytes
+// in file order with read, peek shows the current buffer without
+// using it up.
+class stl_pipe_source : public stl_byte_source
+{
+public:
+    explicit stl_pipe_source(const char* name, size_t buffer_size = STL_PIPE_BUFFER_SIZE, size_t buffers = STL_PIPE_BUFFERS);
+    ~stl_pipe_source() override;
+
+    stl_pipe_source(const stl_pipe_source&) = delete;
+    stl_pipe_source& operator=(const stl_pipe_source&) = delete;
+
+    uint64_t size() const { return m_size; }
+    const char* peek(size_t& size);
+    size_t read(char* dst, size_t size) override;
+    size_t read_full(char* dst, size_t size);
+
+private:
+    struct slot
+    {
+        std::vector<char> data;
+        size_t size = 0;
+        bool full = false;
+    };
+
+    std::ifstream m_file;
+    uint64_t m_size = 0;
+    std::vector<slot> m_slots;
+
+    // consumer position
+    size_t m_cur = 0;
+    size_t m_offset = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_filled;
+    std::condition_variable m_freed;
+    bool m_done = false;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+    std::thread m_reader;
+
+    void run();
+    bool wait_current();
+};
+
+#endif
@@ -0,0 +1,1842 @@
+// stl_simd.cpp : vector kernels for the stl algorithms
+//
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "stl_simd.h"
+
+#ifdef STL_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// functions using AVX2 are compiled for AVX2 on their own
+// and only called when the cpu supports it
+#if defined(STL_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define STL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define STL_TARGET_AVX2
+#endif
+
+// find the best level the cpu supports
+static stl_simd_level detect_level()
+{
+#ifdef STL_SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    auto max_leaf = info[0];
+
+    __cpuid(info, 1);
+    auto sse2 = (info[3] & (1 << 26)) != 0;
+    auto osxsave = (info[2] & (1 << 27)) != 0;
+    auto avx = (info[2] & (1 << 28)) != 0;
+
+    // the os must save the ymm registers
+    auto ymm = osxsave && avx && (_xgetbv(0) & 6) == 6;
+
+    auto avx2 = false;
+    if (max_leaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2 && ymm) {
+        return stl_simd_avx2;
+    }
+    if (sse2) {
+        return stl_simd_sse;
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return stl_simd_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return stl_simd_sse;
+    }
+#endif
+#endif
+    return stl_simd_scalar;
+}
+
+static std::atomic<int> simd_limit{ stl_simd_avx2 };
+
+// the level used by the kernels
+stl_simd_level stl_simd_active()
+{
+    static const auto cpu_level = detect_level();
+    return static_cast<stl_simd_level>(std::min(static_cast<int>(cpu_level), simd_limit.load()));
+}
+
+// limit the level used by the kernels
+void stl_simd_limit(stl_simd_level level)
+{
+    simd_limit = level;
+}
+
+//
+// normals
+//
+// The normal is the sum over the edges (Newell's method) divided by its length.
+// It is the right hand normal, the triangle is counter clockwise seen from
+// the side it points to, as the stl format expects for outward normals.
+// The vector versions do the same float operations in the same order.
+//
+
+static void normals_scalar(const float* vectors, float* normals, size_t count)
+{
+    for (size_t tri = 0; tri < count; ++tri) {
+        auto p0x = vectors[0];
+        auto p0y = vectors[1];
+        auto p0z = vectors[2];
+        auto p1x = vectors[3];
+        auto p1y = vectors[4];
+        auto p1z = vectors[5];
+        auto p2x = vectors[6];
+        auto p2y = vectors[7];
+        auto p2z = vectors[8];
+
+        auto x = (p0y - p1y) * (p1z + p0z) + (p1y - p2y) * (p2z + p1z) + (p2y - p0y) * (p0z + p2z);
+        auto y = (p0z - p1z) * (p1x + p0x) + (p1z - p2z) * (p2x + p1x) + (p2z - p0z) * (p0x + p2x);
+        auto z = (p0x - p1x) * (p1y + p0y) + (p1x - p2x) * (p2y + p1y) + (p2x - p0x) * (p0y + p2y);
+
+        auto distance = std::sqrt(x * x + y * y + z * z);
+
+        normals[0] = x / distance;
+        normals[1] = y / distance;
+        normals[2] = z / distance;
+
+        vectors += 9;
+        normals += 3;
+    }
+}
+
+// triangles first .. count - 1 of separate x, y and z arrays
+static void normals_soa_scalar(const float* const axis[3], size_t first, float* normals, size_t count)
+{
+    for (auto tri = first; tri < count; ++tri) {
+        float v[9];
+        for (auto i = 0; i < 9; ++i) {
+            v[i] = axis[i % 3][tri * 3 + i / 3];
+        }
+        normals_scalar(v, normals + tri * 3, 1);
+    }
+}
+
+#ifdef STL_SIMD_X86
+
+// normals of the 4 triangles in p (p0 xyz, p1 xyz, p2 xyz)
+static void newell_sse(const __m128 p[9], float* normals)
+{
+    auto x = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_sub_ps(p[1], p[4]), _mm_add_ps(p[5], p[2])),
+        _mm_mul_ps(_mm_sub_ps(p[4], p[7]), _mm_add_ps(p[8], p[5]))),
+        _mm_mul_ps(_mm_sub_ps(p[7], p[1]), _mm_add_ps(p[2], p[8])));
+    auto y = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_sub_ps(p[2], p[5]), _mm_add_ps(p[3], p[0])),
+        _mm_mul_ps(_mm_sub_ps(p[5], p[8]), _mm_add_ps(p[6], p[3]))),
+        _mm_mul_ps(_mm_sub_ps(p[8], p[2]), _mm_add_ps(p[0], p[6])));
+    auto z = _mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(_mm_sub_ps(p[0], p[3]), _mm_add_ps(p[4], p[1])),
+        _mm_mul_ps(_mm_sub_ps(p[3], p[6]), _mm_add_ps(p[7], p[4]))),
+        _mm_mul_ps(_mm_sub_ps(p[6], p[0]), _mm_add_ps(p[1], p[7])));
+
+    auto distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+
+    float nx[4], ny[4], nz[4];
+    _mm_storeu_ps(nx, _mm_div_ps(x, distance));
+    _mm_storeu_ps(ny, _mm_div_ps(y, distance));
+    _mm_storeu_ps(nz, _mm_div_ps(z, distance));
+
+    for (auto i = 0; i < 4; ++i) {
+        normals[i * 3] = nx[i];
+        normals[i * 3 + 1] = ny[i];
+        normals[i * 3 + 2] = nz[i];
+    }
+}
+
+// 4 triangles at a time
+static void normals_sse(const float* vectors, float* normals, size_t count)
+{
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        auto v = vectors + tri * 9;
+        __m128 p[9];
+        for (auto i = 0; i < 9; ++i) {
+            p[i] = _mm_set_ps(v[27 + i], v[18 + i], v[9 + i], v[i]);
+        }
+        newell_sse(p, normals + tri * 3);
+    }
+    normals_scalar(vectors + tri * 9, normals + tri * 3, count - tri);
+}
+
+static void normals_soa_sse(const float* const axis[3], float* normals, size_t count)
+{
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        __m128 p[9];
+        for (auto i = 0; i < 9; ++i) {
+            auto v = axis[i % 3] + tri * 3 + i / 3;
+            p[i] = _mm_set_ps(v[9], v[6], v[3], v[0]);
+        }
+        newell_sse(p, normals + tri * 3);
+    }
+    normals_soa_scalar(axis, tri, normals, count);
+}
+
+// normals of the 8 triangles in p (p0 xyz, p1 xyz, p2 xyz)
+STL_TARGET_AVX2
+static void newell_avx2(const __m256 p[9], float* normals)
+{
+    auto x = _mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_sub_ps(p[1], p[4]), _mm256_add_ps(p[5], p[2])),
+        _mm256_mul_ps(_mm256_sub_ps(p[4], p[7]), _mm256_add_ps(p[8], p[5]))),
+        _mm256_mul_ps(_mm256_sub_ps(p[7], p[1]), _mm256_add_ps(p[2], p[8])));
+    auto y = _mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_sub_ps(p[2], p[5]), _mm256_add_ps(p[3], p[0])),
+        _mm256_mul_ps(_mm256_sub_ps(p[5], p[8]), _mm256_add_ps(p[6], p[3]))),
+        _mm256_mul_ps(_mm256_sub_ps(p[8], p[2]), _mm256_add_ps(p[0], p[6])));
+    auto z = _mm256_add_ps(_mm256_add_ps(
+        _mm256_mul_ps(_mm256_sub_ps(p[0], p[3]), _mm256_add_ps(p[4], p[1])),
+        _mm256_mul_ps(_mm256_sub_ps(p[3], p[6]), _mm256_add_ps(p[7], p[4]))),
+        _mm256_mul_ps(_mm256_sub_ps(p[6], p[0]), _mm256_add_ps(p[1], p[7])));
+
+    auto distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+
+    alignas(32) float nx[8];
+    alignas(32) float ny[8];
+    alignas(32) float nz[8];
+    _mm256_store_ps(nx, _mm256_div_ps(x, distance));
+    _mm256_store_ps(ny, _mm256_div_ps(y, distance));
+    _mm256_store_ps(nz, _mm256_div_ps(z, distance));
+
+    for (auto i = 0; i < 8; ++i) {
+        normals[i * 3] = nx[i];
+        normals[i * 3 + 1] = ny[i];
+        normals[i * 3 + 2] = nz[i];
+    }
+}
+
+// 8 triangles at a time
+STL_TARGET_AVX2
+static void normals_avx2(const float* vectors, float* normals, size_t count)
+{
+    const auto index = _mm256_setr_epi32(0, 9, 18, 27, 36, 45, 54, 63);
+
+    size_t tri = 0;
+    for (; tri + 8 <= count; tri += 8) {
+        auto v = vectors + tri * 9;
+        __m256 p[9];
+        for (auto i = 0; i < 9; ++i) {
+            p[i] = _mm256_i32gather_ps(v + i, index, 4);
+        }
+        newell_avx2(p, normals + tri * 3);
+    }
+    normals_scalar(vectors + tri * 9, normals + tri * 3, count - tri);
+}
+
+STL_TARGET_AVX2
+static void normals_soa_avx2(const float* const axis[3], float* normals, size_t count)
+{
+    const auto index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    size_t tri = 0;
+    for (; tri + 8 <= count; tri += 8) {
+        __m256 p[9];
+        for (auto i = 0; i < 9; ++i) {
+            p[i] = _mm256_i32gather_ps(axis[i % 3] + tri * 3 + i / 3, index, 4);
+        }
+        newell_avx2(p, normals + tri * 3);
+    }
+    normals_soa_scalar(axis, tri, normals, count);
+}
+
+#endif
+
+// unit normals of count triangles
+void stl_simd_normals(const float* vectors, float* normals, size_t count)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            normals_avx2(vectors, normals, count);
+            break;
+
+        case stl_simd_sse:
+            normals_sse(vectors, normals, count);
+            break;
+#endif
+        default:
+            normals_scalar(vectors, normals, count);
+            break;
+    }
+}
+
+// unit normals of count triangles with separate x, y and z arrays
+void stl_simd_normals_soa(const float* x, const float* y, const float* z, float* normals, size_t count)
+{
+    const float* const axis[3] = { x, y, z };
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            normals_soa_avx2(axis, normals, count);
+            break;
+
+        case stl_simd_sse:
+            normals_soa_sse(axis, normals, count);
+            break;
+#endif
+        default:
+            normals_soa_scalar(axis, 0, normals, count);
+            break;
+    }
+}
+
+//
+// bounds and transforms of xyz points
+//
+// The points are interleaved, so a run of vector registers holds the
+// axes in a repeating pattern: lane l of register r holds axis
+// (lanes * r + l) % 3. The per axis values are laid out the same way.
+//
+
+// per axis values laid out in the lane pattern of 3 registers of lanes floats
+static void axis_pattern(const float value[3], float* pattern, int lanes)
+{
+    for (auto i = 0; i < 3 * lanes; ++i) {
+        pattern[i] = value[i % 3];
+    }
+}
+
+// nan and inf coordinates are skipped
+static void bounds_scalar(const float* xyz, size_t count, float min[3], float max[3])
+{
+    for (size_t i = 0; i < count; ++i, xyz += 3) {
+        for (auto ax = 0; ax < 3; ++ax) {
+            if (std::isfinite(xyz[ax])) {
+                min[ax] = std::min(min[ax], xyz[ax]);
+                max[ax] = std::max(max[ax], xyz[ax]);
+            }
+        }
+    }
+}
+
+static void scale_translate_scalar(float* xyz, size_t count, const float center[3], float scale)
+{
+    for (size_t i = 0; i < count; ++i, xyz += 3) {
+        for (auto ax = 0; ax < 3; ++ax) {
+            xyz[ax] = (xyz[ax] - center[ax]) * scale;
+        }
+    }
+}
+
+static void affine_scalar(float* xyz, size_t count, const float m[12])
+{
+    for (size_t i = 0; i < count; ++i, xyz += 3) {
+        auto x = xyz[0];
+        auto y = xyz[1];
+        auto z = xyz[2];
+        xyz[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+        xyz[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+        xyz[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+    }
+}
+
+static void linear_normalize_scalar(float* xyz, size_t count, const float m[9])
+{
+    for (size_t i = 0; i < count; ++i, xyz += 3) {
+        auto x = m[0] * xyz[0] + m[1] * xyz[1] + m[2] * xyz[2];
+        auto y = m[3] * xyz[0] + m[4] * xyz[1] + m[5] * xyz[2];
+        auto z = m[6] * xyz[0] + m[7] * xyz[1] + m[8] * xyz[2];
+        auto length = std::sqrt(x * x + y * y + z * z);
+        if (length > 0.0f) {
+            x = x / length;
+            y = y / length;
+            z = z / length;
+        }
+        xyz[0] = x;
+        xyz[1] = y;
+        xyz[2] = z;
+    }
+}
+
+#ifdef STL_SIMD_X86
+
+// nan for the lanes that are not finite
+// min and max return their second operand when either is nan, so
+// min(finite_or_nan(v), m) skips the nan and inf lanes of v
+static inline __m128 finite_or_nan_sse(__m128 v)
+{
+    auto magnitude = _mm_and_ps(v, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+    return _mm_or_ps(v, _mm_cmpnlt_ps(magnitude, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+}
+
+STL_TARGET_AVX2
+static inline __m256 finite_or_nan_avx2(__m256 v)
+{
+    auto magnitude = _mm256_and_ps(v, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF)));
+    return _mm256_or_ps(v, _mm256_cmp_ps(magnitude, _mm256_set1_ps(std::numeric_limits<float>::infinity()), _CMP_NLT_UQ));
+}
+
+// 4 points (3 registers) at a time
+static void bounds_sse(const float* xyz, size_t count, float min[3], float max[3])
+{
+    float lo[12], hi[12];
+    axis_pattern(min, lo, 4);
+    axis_pattern(max, hi, 4);
+    __m128 vmin[3], vmax[3];
+    for (auto r = 0; r < 3; ++r) {
+        vmin[r] = _mm_loadu_ps(lo + r * 4);
+        vmax[r] = _mm_loadu_ps(hi + r * 4);
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto p = xyz + i * 3;
+        for (auto r = 0; r < 3; ++r) {
+            auto v = finite_or_nan_sse(_mm_loadu_ps(p + r * 4));
+            vmin[r] = _mm_min_ps(v, vmin[r]);
+            vmax[r] = _mm_max_ps(v, vmax[r]);
+        }
+    }
+
+    for (auto r = 0; r < 3; ++r) {
+        _mm_storeu_ps(lo + r * 4, vmin[r]);
+        _mm_storeu_ps(hi + r * 4, vmax[r]);
+    }
+    for (auto l = 0; l < 12; ++l) {
+        min[l % 3] = std::min(min[l % 3], lo[l]);
+        max[l % 3] = std::max(max[l % 3], hi[l]);
+    }
+    bounds_scalar(xyz + i * 3, count - i, min, max);
+}
+
+static void scale_translate_sse(float* xyz, size_t count, const float center[3], float scale)
+{
+    float c[12];
+    axis_pattern(center, c, 4);
+    __m128 vc[3];
+    for (auto r = 0; r < 3; ++r) {
+        vc[r] = _mm_loadu_ps(c + r * 4);
+    }
+    auto vs = _mm_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto p = xyz + i * 3;
+        for (auto r = 0; r < 3; ++r) {
+            _mm_storeu_ps(p + r * 4, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(p + r * 4), vc[r]), vs));
+        }
+    }
+    scale_translate_scalar(xyz + i * 3, count - i, center, scale);
+}
+
+static void affine_sse(float* xyz, size_t count, const float m[12])
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto p = xyz + i * 3;
+        auto x = _mm_set_ps(p[9], p[6], p[3], p[0]);
+        auto y = _mm_set_ps(p[10], p[7], p[4], p[1]);
+        auto z = _mm_set_ps(p[11], p[8], p[5], p[2]);
+
+        float out[3][4];
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 4;
+            auto v = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(row[0]), x),
+                _mm_mul_ps(_mm_set1_ps(row[1]), y)),
+                _mm_mul_ps(_mm_set1_ps(row[2]), z)),
+                _mm_set1_ps(row[3]));
+            _mm_storeu_ps(out[ax], v);
+        }
+        for (auto l = 0; l < 4; ++l) {
+            p[l * 3] = out[0][l];
+            p[l * 3 + 1] = out[1][l];
+            p[l * 3 + 2] = out[2][l];
+        }
+    }
+    affine_scalar(xyz + i * 3, count - i, m);
+}
+
+static void linear_normalize_sse(float* xyz, size_t count, const float m[9])
+{
+    auto zero = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto p = xyz + i * 3;
+        auto x = _mm_set_ps(p[9], p[6], p[3], p[0]);
+        auto y = _mm_set_ps(p[10], p[7], p[4], p[1]);
+        auto z = _mm_set_ps(p[11], p[8], p[5], p[2]);
+
+        __m128 v[3];
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 3;
+            v[ax] = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(row[0]), x),
+                _mm_mul_ps(_mm_set1_ps(row[1]), y)),
+                _mm_mul_ps(_mm_set1_ps(row[2]), z));
+        }
+        auto length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], v[0]), _mm_mul_ps(v[1], v[1])), _mm_mul_ps(v[2], v[2])));
+        auto scaled = _mm_cmpgt_ps(length, zero);
+
+        float out[3][4];
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto n = _mm_or_ps(_mm_and_ps(scaled, _mm_div_ps(v[ax], length)), _mm_andnot_ps(scaled, v[ax]));
+            _mm_storeu_ps(out[ax], n);
+        }
+        for (auto l = 0; l < 4; ++l) {
+            p[l * 3] = out[0][l];
+            p[l * 3 + 1] = out[1][l];
+            p[l * 3 + 2] = out[2][l];
+        }
+    }
+    linear_normalize_scalar(xyz + i * 3, count - i, m);
+}
+
+// 8 points (3 registers) at a time
+STL_TARGET_AVX2
+static void bounds_avx2(const float* xyz, size_t count, float min[3], float max[3])
+{
+    float lo[24], hi[24];
+    axis_pattern(min, lo, 8);
+    axis_pattern(max, hi, 8);
+    __m256 vmin[3], vmax[3];
+    for (auto r = 0; r < 3; ++r) {
+        vmin[r] = _mm256_loadu_ps(lo + r * 8);
+        vmax[r] = _mm256_loadu_ps(hi + r * 8);
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto p = xyz + i * 3;
+        for (auto r = 0; r < 3; ++r) {
+            auto v = finite_or_nan_avx2(_mm256_loadu_ps(p + r * 8));
+            vmin[r] = _mm256_min_ps(v, vmin[r]);
+            vmax[r] = _mm256_max_ps(v, vmax[r]);
+        }
+    }
+
+    for (auto r = 0; r < 3; ++r) {
+        _mm256_storeu_ps(lo + r * 8, vmin[r]);
+        _mm256_storeu_ps(hi + r * 8, vmax[r]);
+    }
+    for (auto l = 0; l < 24; ++l) {
+        min[l % 3] = std::min(min[l % 3], lo[l]);
+        max[l % 3] = std::max(max[l % 3], hi[l]);
+    }
+    bounds_scalar(xyz + i * 3, count - i, min, max);
+}
+
+STL_TARGET_AVX2
+static void scale_translate_avx2(float* xyz, size_t count, const float center[3], float scale)
+{
+    float c[24];
+    axis_pattern(center, c, 8);
+    __m256 vc[3];
+    for (auto r = 0; r < 3; ++r) {
+        vc[r] = _mm256_loadu_ps(c + r * 8);
+    }
+    auto vs = _mm256_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto p = xyz + i * 3;
+        for (auto r = 0; r < 3; ++r) {
+            _mm256_storeu_ps(p + r * 8, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(p + r * 8), vc[r]), vs));
+        }
+    }
+    scale_translate_scalar(xyz + i * 3, count - i, center, scale);
+}
+
+STL_TARGET_AVX2
+static void affine_avx2(float* xyz, size_t count, const float m[12])
+{
+    const auto index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto p = xyz + i * 3;
+        auto x = _mm256_i32gather_ps(p, index, 4);
+        auto y = _mm256_i32gather_ps(p + 1, index, 4);
+        auto z = _mm256_i32gather_ps(p + 2, index, 4);
+
+        alignas(32) float out[3][8];
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 4;
+            auto v = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(row[0]), x),
+                _mm256_mul_ps(_mm256_set1_ps(row[1]), y)),
+                _mm256_mul_ps(_mm256_set1_ps(row[2]), z)),
+                _mm256_set1_ps(row[3]));
+            _mm256_store_ps(out[ax], v);
+        }
+        for (auto l = 0; l < 8; ++l) {
+            p[l * 3] = out[0][l];
+            p[l * 3 + 1] = out[1][l];
+            p[l * 3 + 2] = out[2][l];
+        }
+    }
+    affine_scalar(xyz + i * 3, count - i, m);
+}
+
+STL_TARGET_AVX2
+static void linear_normalize_avx2(float* xyz, size_t count, const float m[9])
+{
+    const auto index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    auto zero = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto p = xyz + i * 3;
+        auto x = _mm256_i32gather_ps(p, index, 4);
+        auto y = _mm256_i32gather_ps(p + 1, index, 4);
+        auto z = _mm256_i32gather_ps(p + 2, index, 4);
+
+        __m256 v[3];
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 3;
+            v[ax] = _mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(row[0]), x),
+                _mm256_mul_ps(_mm256_set1_ps(row[1]), y)),
+                _mm256_mul_ps(_mm256_set1_ps(row[2]), z));
+        }
+        auto length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v[0], v[0]), _mm256_mul_ps(v[1], v[1])), _mm256_mul_ps(v[2], v[2])));
+        auto scaled = _mm256_cmp_ps(length, zero, _CMP_GT_OQ);
+
+        alignas(32) float out[3][8];
+        for (auto ax = 0; ax < 3; ++ax) {
+            _mm256_store_ps(out[ax], _mm256_blendv_ps(v[ax], _mm256_div_ps(v[ax], length), scaled));
+        }
+        for (auto l = 0; l < 8; ++l) {
+            p[l * 3] = out[0][l];
+            p[l * 3 + 1] = out[1][l];
+            p[l * 3 + 2] = out[2][l];
+        }
+    }
+    linear_normalize_scalar(xyz + i * 3, count - i, m);
+}
+
+#endif
+
+// min and max of each axis
+void stl_simd_bounds(const float* xyz, size_t count, float min[3], float max[3])
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            bounds_avx2(xyz, count, min, max);
+            break;
+
+        case stl_simd_sse:
+            bounds_sse(xyz, count, min, max);
+            break;
+#endif
+        default:
+            bounds_scalar(xyz, count, min, max);
+            break;
+    }
+}
+
+// (p - center) * scale
+void stl_simd_scale_translate(float* xyz, size_t count, const float center[3], float scale)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            scale_translate_avx2(xyz, count, center, scale);
+            break;
+
+        case stl_simd_sse:
+            scale_translate_sse(xyz, count, center, scale);
+            break;
+#endif
+        default:
+            scale_translate_scalar(xyz, count, center, scale);
+            break;
+    }
+}
+
+// p = M * p + t
+void stl_simd_affine(float* xyz, size_t count, const float matrix[12])
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            affine_avx2(xyz, count, matrix);
+            break;
+
+        case stl_simd_sse:
+            affine_sse(xyz, count, matrix);
+            break;
+#endif
+        default:
+            affine_scalar(xyz, count, matrix);
+            break;
+    }
+}
+
+// n = M * n scaled to unit length
+void stl_simd_linear_normalize(float* xyz, size_t count, const float matrix[9])
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            linear_normalize_avx2(xyz, count, matrix);
+            break;
+
+        case stl_simd_sse:
+            linear_normalize_sse(xyz, count, matrix);
+            break;
+#endif
+        default:
+            linear_normalize_scalar(xyz, count, matrix);
+            break;
+    }
+}
+
+//
+// bounds and transforms of separate x, y and z arrays
+//
+// Each axis is contiguous, so the registers are simply filled
+// with consecutive values of one axis.
+//
+
+// nan and inf values are skipped
+static void axis_bounds_scalar(const float* v, size_t count, float& min, float& max)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (std::isfinite(v[i])) {
+            min = std::min(min, v[i]);
+            max = std::max(max, v[i]);
+        }
+    }
+}
+
+static void axis_scale_translate_scalar(float* v, size_t count, float center, float scale)
+{
+    for (size_t i = 0; i < count; ++i) {
+        v[i] = (v[i] - center) * scale;
+    }
+}
+
+static void affine_soa_scalar(float* x, float* y, float* z, size_t count, const float m[12])
+{
+    for (size_t i = 0; i < count; ++i) {
+        auto px = x[i];
+        auto py = y[i];
+        auto pz = z[i];
+        x[i] = m[0] * px + m[1] * py + m[2] * pz + m[3];
+        y[i] = m[4] * px + m[5] * py + m[6] * pz + m[7];
+        z[i] = m[8] * px + m[9] * py + m[10] * pz + m[11];
+    }
+}
+
+#ifdef STL_SIMD_X86
+
+static void axis_bounds_sse(const float* v, size_t count, float& min, float& max)
+{
+    auto vmin = _mm_set1_ps(min);
+    auto vmax = _mm_set1_ps(max);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto p = finite_or_nan_sse(_mm_loadu_ps(v + i));
+        vmin = _mm_min_ps(p, vmin);
+        vmax = _mm_max_ps(p, vmax);
+    }
+
+    float lo[4], hi[4];
+    _mm_storeu_ps(lo, vmin);
+    _mm_storeu_ps(hi, vmax);
+    for (auto l = 0; l < 4; ++l) {
+        min = std::min(min, lo[l]);
+        max = std::max(max, hi[l]);
+    }
+    axis_bounds_scalar(v + i, count - i, min, max);
+}
+
+static void axis_scale_translate_sse(float* v, size_t count, float center, float scale)
+{
+    auto vc = _mm_set1_ps(center);
+    auto vs = _mm_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(v + i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v + i), vc), vs));
+    }
+    axis_scale_translate_scalar(v + i, count - i, center, scale);
+}
+
+static void affine_soa_sse(float* x, float* y, float* z, size_t count, const float m[12])
+{
+    float* axis[3] = { x, y, z };
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto px = _mm_loadu_ps(x + i);
+        auto py = _mm_loadu_ps(y + i);
+        auto pz = _mm_loadu_ps(z + i);
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 4;
+            _mm_storeu_ps(axis[ax] + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_set1_ps(row[0]), px),
+                _mm_mul_ps(_mm_set1_ps(row[1]), py)),
+                _mm_mul_ps(_mm_set1_ps(row[2]), pz)),
+                _mm_set1_ps(row[3])));
+        }
+    }
+    affine_soa_scalar(x + i, y + i, z + i, count - i, m);
+}
+
+STL_TARGET_AVX2
+static void axis_bounds_avx2(const float* v, size_t count, float& min, float& max)
+{
+    auto vmin = _mm256_set1_ps(min);
+    auto vmax = _mm256_set1_ps(max);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto p = finite_or_nan_avx2(_mm256_loadu_ps(v + i));
+        vmin = _mm256_min_ps(p, vmin);
+        vmax = _mm256_max_ps(p, vmax);
+    }
+
+    alignas(32) float lo[8];
+    alignas(32) float hi[8];
+    _mm256_store_ps(lo, vmin);
+    _mm256_store_ps(hi, vmax);
+    for (auto l = 0; l < 8; ++l) {
+        min = std::min(min, lo[l]);
+        max = std::max(max, hi[l]);
+    }
+    axis_bounds_scalar(v + i, count - i, min, max);
+}
+
+STL_TARGET_AVX2
+static void axis_scale_translate_avx2(float* v, size_t count, float center, float scale)
+{
+    auto vc = _mm256_set1_ps(center);
+    auto vs = _mm256_set1_ps(scale);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(v + i, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(v + i), vc), vs));
+    }
+    axis_scale_translate_scalar(v + i, count - i, center, scale);
+}
+
+STL_TARGET_AVX2
+static void affine_soa_avx2(float* x, float* y, float* z, size_t count, const float m[12])
+{
+    float* axis[3] = { x, y, z };
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto px = _mm256_loadu_ps(x + i);
+        auto py = _mm256_loadu_ps(y + i);
+        auto pz = _mm256_loadu_ps(z + i);
+        for (auto ax = 0; ax < 3; ++ax) {
+            auto row = m + ax * 4;
+            _mm256_storeu_ps(axis[ax] + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(_mm256_set1_ps(row[0]), px),
+                _mm256_mul_ps(_mm256_set1_ps(row[1]), py)),
+                _mm256_mul_ps(_mm256_set1_ps(row[2]), pz)),
+                _mm256_set1_ps(row[3])));
+        }
+    }
+    affine_soa_scalar(x + i, y + i, z + i, count - i, m);
+}
+
+#endif
+
+// min and max of one axis
+void stl_simd_axis_bounds(const float* v, size_t count, float& min, float& max)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            axis_bounds_avx2(v, count, min, max);
+            break;
+
+        case stl_simd_sse:
+            axis_bounds_sse(v, count, min, max);
+            break;
+#endif
+        default:
+            axis_bounds_scalar(v, count, min, max);
+            break;
+    }
+}
+
+// (v - center) * scale
+void stl_simd_axis_scale_translate(float* v, size_t count, float center, float scale)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            axis_scale_translate_avx2(v, count, center, scale);
+            break;
+
+        case stl_simd_sse:
+            axis_scale_translate_sse(v, count, center, scale);
+            break;
+#endif
+        default:
+            axis_scale_translate_scalar(v, count, center, scale);
+            break;
+    }
+}
+
+// p = M * p + t with separate x, y and z arrays
+void stl_simd_affine_soa(float* x, float* y, float* z, size_t count, const float matrix[12])
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            affine_soa_avx2(x, y, z, count, matrix);
+            break;
+
+        case stl_simd_sse:
+            affine_soa_sse(x, y, z, count, matrix);
+            break;
+#endif
+        default:
+            affine_soa_scalar(x, y, z, count, matrix);
+            break;
+    }
+}
+
+//
+// ray and triangle
+//
+// Moller Trumbore, two sided. The conditions are written so a nan
+// anywhere makes a miss.
+//
+
+static int intersect_block_scalar(const float* block, const float o[3], const float d[3],
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+    auto hit = -1;
+    for (auto l = 0; l < 4; ++l) {
+        auto p0x = block[l], p0y = block[4 + l], p0z = block[8 + l];
+        auto e1x = block[12 + l] - p0x, e1y = block[16 + l] - p0y, e1z = block[20 + l] - p0z;
+        auto e2x = block[24 + l] - p0x, e2y = block[28 + l] - p0y, e2z = block[32 + l] - p0z;
+
+        auto px = d[1] * e2z - d[2] * e2y;
+        auto py = d[2] * e2x - d[0] * e2z;
+        auto pz = d[0] * e2y - d[1] * e2x;
+        auto det = e1x * px + e1y * py + e1z * pz;
+        auto inv = 1.0f / det;
+
+        auto sx = o[0] - p0x, sy = o[1] - p0y, sz = o[2] - p0z;
+        auto lu = (sx * px + sy * py + sz * pz) * inv;
+
+        auto qx = sy * e1z - sz * e1y;
+        auto qy = sz * e1x - sx * e1z;
+        auto qz = sx * e1y - sy * e1x;
+        auto lv = (d[0] * qx + d[1] * qy + d[2] * qz) * inv;
+        auto lt = (e2x * qx + e2y * qy + e2z * qz) * inv;
+
+        if (det != 0.0f && lu >= 0.0f && lu <= 1.0f && lv >= 0.0f && lu + lv <= 1.0f && lt > t_min && lt < t_max) {
+            t_max = lt;
+            t = lt;
+            u = lu;
+            v = lv;
+            hit = l;
+        }
+    }
+    return hit;
+}
+
+#ifdef STL_SIMD_X86
+
+static int intersect_block_sse(const float* block, const float o[3], const float d[3],
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+    __m128 p[9];
+    for (auto i = 0; i < 9; ++i) {
+        p[i] = _mm_loadu_ps(block + i * 4);
+    }
+    auto dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+
+    auto e1x = _mm_sub_ps(p[3], p[0]), e1y = _mm_sub_ps(p[4], p[1]), e1z = _mm_sub_ps(p[5], p[2]);
+    auto e2x = _mm_sub_ps(p[6], p[0]), e2y = _mm_sub_ps(p[7], p[1]), e2z = _mm_sub_ps(p[8], p[2]);
+
+    auto px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    auto py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    auto pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    auto det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    auto inv = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    auto sx = _mm_sub_ps(_mm_set1_ps(o[0]), p[0]);
+    auto sy = _mm_sub_ps(_mm_set1_ps(o[1]), p[1]);
+    auto sz = _mm_sub_ps(_mm_set1_ps(o[2]), p[2]);
+    auto lu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv);
+
+    auto qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    auto qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    auto qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    auto lv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv);
+    auto lt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv);
+
+    auto zero = _mm_setzero_ps();
+    auto one = _mm_set1_ps(1.0f);
+    auto valid = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpord_ps(det, det));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(lu, zero), _mm_cmple_ps(lu, one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(lv, zero), _mm_cmple_ps(_mm_add_ps(lu, lv), one)));
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(lt, _mm_set1_ps(t_min)), _mm_cmplt_ps(lt, _mm_set1_ps(t_max))));
+
+    auto mask = _mm_movemask_ps(valid);
+    if (mask == 0) {
+        return -1;
+    }
+
+    float at[4], au[4], av[4];
+    _mm_storeu_ps(at, lt);
+    _mm_storeu_ps(au, lu);
+    _mm_storeu_ps(av, lv);
+    auto hit = -1;
+    for (auto l = 0; l < 4; ++l) {
+        if ((mask & (1 << l)) && at[l] < t_max) {
+            t_max = at[l];
+            t = at[l];
+            u = au[l];
+            v = av[l];
+            hit = l;
+        }
+    }
+    return hit;
+}
+
+#endif
+
+// nearest hit of a ray with a block of 4 triangles
+// the AVX2 level uses the SSE version, a block is 4 wide
+int stl_simd_intersect_block(const float* block, const float origin[3], const float direction[3],
+    float t_min, float t_max, float& t, float& u, float& v)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+        case stl_simd_sse:
+            return intersect_block_sse(block, origin, direction, t_min, t_max, t, u, v);
+#endif
+        default:
+            return intersect_block_scalar(block, origin, direction, t_min, t_max, t, u, v);
+    }
+}
+
+//
+// mass terms
+//
+// The terms of a triangle are computed in double from its corners
+// relative to the origin. Triangle i is added to lane i % 4 with Kahan
+// summation and the lanes are added in order at the end, so every
+// version does the same double operations in the same order.
+//
+
+static void mass_terms_one(const float* v, const double o[3], double t[STL_MASS_TERMS])
+{
+    auto ax = v[0] - o[0], ay = v[1] - o[1], az = v[2] - o[2];
+    auto bx = v[3] - o[0], by = v[4] - o[1], bz = v[5] - o[2];
+    auto cx = v[6] - o[0], cy = v[7] - o[1], cz = v[8] - o[2];
+
+    // 6 x signed volume of the tetrahedron origin a b c
+    auto d = (ax * (by * cz - bz * cy) + ay * (bz * cx - bx * cz)) + az * (bx * cy - by * cx);
+
+    // 2 x area
+    auto e1x = bx - ax, e1y = by - ay, e1z = bz - az;
+    auto e2x = cx - ax, e2y = cy - ay, e2z = cz - az;
+    auto nx = e1y * e2z - e1z * e2y;
+    auto ny = e1z * e2x - e1x * e2z;
+    auto nz = e1x * e2y - e1y * e2x;
+    auto area = std::sqrt((nx * nx + ny * ny) + nz * nz);
+
+    auto sx = (ax + bx) + cx, sy = (ay + by) + cy, sz = (az + bz) + cz;
+
+    t[0] = d;
+    t[1] = area;
+    t[2] = d * sx;
+    t[3] = d * sy;
+    t[4] = d * sz;
+    t[5] = d * (((ax * ax + bx * bx) + cx * cx) + sx * sx);
+    t[6] = d * (((ay * ay + by * by) + cy * cy) + sy * sy);
+    t[7] = d * (((az * az + bz * bz) + cz * cz) + sz * sz);
+    t[8] = d * (((ax * ay + bx * by) + cx * cy) + sx * sy);
+    t[9] = d * (((ay * az + by * bz) + cy * cz) + sy * sz);
+    t[10] = d * (((az * ax + bz * bx) + cz * cx) + sz * sx);
+}
+
+// Kahan sums of 4 lanes
+struct mass_lanes
+{
+    double sum[STL_MASS_TERMS][4];
+    double carry[STL_MASS_TERMS][4];
+};
+
+// add triangles first .. count - 1 to their lanes and add up the lanes
+static void mass_terms_finish(const float* vectors, size_t first, size_t count, const double o[3],
+    mass_lanes& lanes, double sums[STL_MASS_TERMS])
+{
+    for (auto tri = first; tri < count; ++tri) {
+        double t[STL_MASS_TERMS];
+        mass_terms_one(vectors + tri * 9, o, t);
+        auto l = tri % 4;
+        for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+            auto y = t[k] - lanes.carry[k][l];
+            auto s = lanes.sum[k][l] + y;
+            lanes.carry[k][l] = (s - lanes.sum[k][l]) - y;
+            lanes.sum[k][l] = s;
+        }
+    }
+
+    for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+        auto total = 0.0;
+        for (auto l = 0; l < 4; ++l) {
+            total += lanes.sum[k][l] - lanes.carry[k][l];
+        }
+        sums[k] = total;
+    }
+}
+
+static void mass_terms_scalar(const float* vectors, size_t count, const double o[3], double sums[STL_MASS_TERMS])
+{
+    mass_lanes lanes = {};
+    mass_terms_finish(vectors, 0, count, o, lanes, sums);
+}
+
+#ifdef STL_SIMD_X86
+
+// d * (ai aj + bi bj + ci cj + si sj)
+static inline __m128d moment_sse(__m128d d, __m128d ai, __m128d aj, __m128d bi, __m128d bj,
+    __m128d ci, __m128d cj, __m128d si, __m128d sj)
+{
+    return _mm_mul_pd(d, _mm_add_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ai, aj), _mm_mul_pd(bi, bj)),
+        _mm_mul_pd(ci, cj)), _mm_mul_pd(si, sj)));
+}
+
+// terms of the 2 triangles in p (a xyz, b xyz, c xyz)
+static void mass_terms_sse(const __m128d p[9], const __m128d o[3], __m128d sum[STL_MASS_TERMS], __m128d carry[STL_MASS_TERMS])
+{
+    auto ax = _mm_sub_pd(p[0], o[0]), ay = _mm_sub_pd(p[1], o[1]), az = _mm_sub_pd(p[2], o[2]);
+    auto bx = _mm_sub_pd(p[3], o[0]), by = _mm_sub_pd(p[4], o[1]), bz = _mm_sub_pd(p[5], o[2]);
+    auto cx = _mm_sub_pd(p[6], o[0]), cy = _mm_sub_pd(p[7], o[1]), cz = _mm_sub_pd(p[8], o[2]);
+
+    auto d = _mm_add_pd(_mm_add_pd(
+        _mm_mul_pd(ax, _mm_sub_pd(_mm_mul_pd(by, cz), _mm_mul_pd(bz, cy))),
+        _mm_mul_pd(ay, _mm_sub_pd(_mm_mul_pd(bz, cx), _mm_mul_pd(bx, cz)))),
+        _mm_mul_pd(az, _mm_sub_pd(_mm_mul_pd(bx, cy), _mm_mul_pd(by, cx))));
+
+    auto e1x = _mm_sub_pd(bx, ax), e1y = _mm_sub_pd(by, ay), e1z = _mm_sub_pd(bz, az);
+    auto e2x = _mm_sub_pd(cx, ax), e2y = _mm_sub_pd(cy, ay), e2z = _mm_sub_pd(cz, az);
+    auto nx = _mm_sub_pd(_mm_mul_pd(e1y, e2z), _mm_mul_pd(e1z, e2y));
+    auto ny = _mm_sub_pd(_mm_mul_pd(e1z, e2x), _mm_mul_pd(e1x, e2z));
+    auto nz = _mm_sub_pd(_mm_mul_pd(e1x, e2y), _mm_mul_pd(e1y, e2x));
+    auto area = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(nx, nx), _mm_mul_pd(ny, ny)), _mm_mul_pd(nz, nz)));
+
+    auto sx = _mm_add_pd(_mm_add_pd(ax, bx), cx);
+    auto sy = _mm_add_pd(_mm_add_pd(ay, by), cy);
+    auto sz = _mm_add_pd(_mm_add_pd(az, bz), cz);
+
+    __m128d t[STL_MASS_TERMS] = {
+        d, area, _mm_mul_pd(d, sx), _mm_mul_pd(d, sy), _mm_mul_pd(d, sz),
+        moment_sse(d, ax, ax, bx, bx, cx, cx, sx, sx),
+        moment_sse(d, ay, ay, by, by, cy, cy, sy, sy),
+        moment_sse(d, az, az, bz, bz, cz, cz, sz, sz),
+        moment_sse(d, ax, ay, bx, by, cx, cy, sx, sy),
+        moment_sse(d, ay, az, by, bz, cy, cz, sy, sz),
+        moment_sse(d, az, ax, bz, bx, cz, cx, sz, sx)
+    };
+
+    for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+        auto y = _mm_sub_pd(t[k], carry[k]);
+        auto s = _mm_add_pd(sum[k], y);
+        carry[k] = _mm_sub_pd(_mm_sub_pd(s, sum[k]), y);
+        sum[k] = s;
+    }
+}
+
+// 4 triangles at a time, lanes 0 1 and lanes 2 3 in separate registers
+static void mass_terms_sse2(const float* vectors, size_t count, const double o[3], double sums[STL_MASS_TERMS])
+{
+    __m128d sum[2][STL_MASS_TERMS], carry[2][STL_MASS_TERMS];
+    for (auto h = 0; h < 2; ++h) {
+        for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+            sum[h][k] = carry[h][k] = _mm_setzero_pd();
+        }
+    }
+    __m128d vo[3] = { _mm_set1_pd(o[0]), _mm_set1_pd(o[1]), _mm_set1_pd(o[2]) };
+
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        for (auto h = 0; h < 2; ++h) {
+            auto v = vectors + (tri + h * 2) * 9;
+            __m128d p[9];
+            for (auto i = 0; i < 9; ++i) {
+                p[i] = _mm_set_pd(v[9 + i], v[i]);
+            }
+            mass_terms_sse(p, vo, sum[h], carry[h]);
+        }
+    }
+
+    mass_lanes lanes;
+    for (auto h = 0; h < 2; ++h) {
+        for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+            _mm_storeu_pd(&lanes.sum[k][h * 2], sum[h][k]);
+            _mm_storeu_pd(&lanes.carry[k][h * 2], carry[h][k]);
+        }
+    }
+    mass_terms_finish(vectors, tri, count, o, lanes, sums);
+}
+
+STL_TARGET_AVX2
+static inline __m256d moment_avx2(__m256d d, __m256d ai, __m256d aj, __m256d bi, __m256d bj,
+    __m256d ci, __m256d cj, __m256d si, __m256d sj)
+{
+    return _mm256_mul_pd(d, _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ai, aj), _mm256_mul_pd(bi, bj)),
+        _mm256_mul_pd(ci, cj)), _mm256_mul_pd(si, sj)));
+}
+
+// terms of the 4 triangles in p (a xyz, b xyz, c xyz)
+STL_TARGET_AVX2
+static void mass_terms_avx2(const __m256d p[9], const __m256d o[3], __m256d sum[STL_MASS_TERMS], __m256d carry[STL_MASS_TERMS])
+{
+    auto ax = _mm256_sub_pd(p[0], o[0]), ay = _mm256_sub_pd(p[1], o[1]), az = _mm256_sub_pd(p[2], o[2]);
+    auto bx = _mm256_sub_pd(p[3], o[0]), by = _mm256_sub_pd(p[4], o[1]), bz = _mm256_sub_pd(p[5], o[2]);
+    auto cx = _mm256_sub_pd(p[6], o[0]), cy = _mm256_sub_pd(p[7], o[1]), cz = _mm256_sub_pd(p[8], o[2]);
+
+    auto d = _mm256_add_pd(_mm256_add_pd(
+        _mm256_mul_pd(ax, _mm256_sub_pd(_mm256_mul_pd(by, cz), _mm256_mul_pd(bz, cy))),
+        _mm256_mul_pd(ay, _mm256_sub_pd(_mm256_mul_pd(bz, cx), _mm256_mul_pd(bx, cz)))),
+        _mm256_mul_pd(az, _mm256_sub_pd(_mm256_mul_pd(bx, cy), _mm256_mul_pd(by, cx))));
+
+    auto e1x = _mm256_sub_pd(bx, ax), e1y = _mm256_sub_pd(by, ay), e1z = _mm256_sub_pd(bz, az);
+    auto e2x = _mm256_sub_pd(cx, ax), e2y = _mm256_sub_pd(cy, ay), e2z = _mm256_sub_pd(cz, az);
+    auto nx = _mm256_sub_pd(_mm256_mul_pd(e1y, e2z), _mm256_mul_pd(e1z, e2y));
+    auto ny = _mm256_sub_pd(_mm256_mul_pd(e1z, e2x), _mm256_mul_pd(e1x, e2z));
+    auto nz = _mm256_sub_pd(_mm256_mul_pd(e1x, e2y), _mm256_mul_pd(e1y, e2x));
+    auto area = _mm256_sqrt_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(nx, nx), _mm256_mul_pd(ny, ny)), _mm256_mul_pd(nz, nz)));
+
+    auto sx = _mm256_add_pd(_mm256_add_pd(ax, bx), cx);
+    auto sy = _mm256_add_pd(_mm256_add_pd(ay, by), cy);
+    auto sz = _mm256_add_pd(_mm256_add_pd(az, bz), cz);
+
+    __m256d t[STL_MASS_TERMS] = {
+        d, area, _mm256_mul_pd(d, sx), _mm256_mul_pd(d, sy), _mm256_mul_pd(d, sz),
+        moment_avx2(d, ax, ax, bx, bx, cx, cx, sx, sx),
+        moment_avx2(d, ay, ay, by, by, cy, cy, sy, sy),
+        moment_avx2(d, az, az, bz, bz, cz, cz, sz, sz),
+        moment_avx2(d, ax, ay, bx, by, cx, cy, sx, sy),
+        moment_avx2(d, ay, az, by, bz, cy, cz, sy, sz),
+        moment_avx2(d, az, ax, bz, bx, cz, cx, sz, sx)
+    };
+
+    for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+        auto y = _mm256_sub_pd(t[k], carry[k]);
+        auto s = _mm256_add_pd(sum[k], y);
+        carry[k] = _mm256_sub_pd(_mm256_sub_pd(s, sum[k]), y);
+        sum[k] = s;
+    }
+}
+
+// 4 triangles at a time
+STL_TARGET_AVX2
+static void mass_terms_avx2(const float* vectors, size_t count, const double o[3], double sums[STL_MASS_TERMS])
+{
+    const auto index = _mm_setr_epi32(0, 9, 18, 27);
+
+    __m256d sum[STL_MASS_TERMS], carry[STL_MASS_TERMS];
+    for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+        sum[k] = carry[k] = _mm256_setzero_pd();
+    }
+    __m256d vo[3] = { _mm256_set1_pd(o[0]), _mm256_set1_pd(o[1]), _mm256_set1_pd(o[2]) };
+
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        auto v = vectors + tri * 9;
+        __m256d p[9];
+        for (auto i = 0; i < 9; ++i) {
+            p[i] = _mm256_cvtps_pd(_mm_i32gather_ps(v + i, index, 4));
+        }
+        mass_terms_avx2(p, vo, sum, carry);
+    }
+
+    mass_lanes lanes;
+    for (auto k = 0; k < STL_MASS_TERMS; ++k) {
+        _mm256_storeu_pd(lanes.sum[k], sum[k]);
+        _mm256_storeu_pd(lanes.carry[k], carry[k]);
+    }
+    mass_terms_finish(vectors, tri, count, o, lanes, sums);
+}
+
+#endif
+
+// compensated mass sums of count triangles
+void stl_simd_mass_terms(const float* vectors, size_t count, const double origin[3], double sums[STL_MASS_TERMS])
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            mass_terms_avx2(vectors, count, origin, sums);
+            break;
+
+        case stl_simd_sse:
+            mass_terms_sse2(vectors, count, origin, sums);
+            break;
+#endif
+        default:
+            mass_terms_scalar(vectors, count, origin, sums);
+            break;
+    }
+}
+
+//
+// compact storage
+//
+// Positions are quantized as (p - min) * scale, clamped to 0 .. max_value
+// with nan going to 0, and rounded to nearest even. Half floats are made
+// with integer operations and round to nearest even. Normals are stored
+// as the 2 x 16 bit snorm point of the octahedron |x| + |y| + |z| = 1
+// with the lower half folded over. The vector versions do the same
+// float operations in the same order.
+//
+
+static void quantize_scalar(const float* xyz, size_t count, const float min[3], const float scale[3], float max_value, uint32_t* q)
+{
+    for (size_t i = 0; i < count * 3; ++i) {
+        auto ax = i % 3;
+        auto v = (xyz[i] - min[ax]) * scale[ax];
+        v = v > 0.0f ? v : 0.0f;
+        v = v < max_value ? v : max_value;
+        q[i] = static_cast<uint32_t>(std::nearbyint(v));
+    }
+}
+
+static void dequantize_scalar(const uint32_t* q, size_t count, const float min[3], const float step[3], float* xyz)
+{
+    for (size_t i = 0; i < count * 3; ++i) {
+        auto ax = i % 3;
+        xyz[i] = min[ax] + static_cast<float>(static_cast<int32_t>(q[i])) * step[ax];
+    }
+}
+
+static void float_to_half_scalar(const float* values, size_t count, uint16_t* half)
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t f = 0;
+        memcpy(&f, &values[i], sizeof(f));
+        auto sign = f & 0x80000000U;
+        f ^= sign;
+
+        uint32_t h = 0;
+        if (f >= 0x47800000U) {
+            // too large for a half, inf or nan
+            h = f > 0x7F800000U ? 0x7E00U : 0x7C00U;
+        }
+        else if (f < 0x38800000U) {
+            // half subnormals come out of adding 0.5
+            float x = 0.0f;
+            memcpy(&x, &f, sizeof(x));
+            x += 0.5f;
+            memcpy(&h, &x, sizeof(h));
+            h -= 0x3F000000U;
+        }
+        else {
+            // rebias the exponent and round the mantissa
+            h = (f + 0xC8000FFFU + ((f >> 13) & 1U)) >> 13;
+        }
+        half[i] = static_cast<uint16_t>(h | (sign >> 16));
+    }
+}
+
+static void half_to_float_scalar(const uint16_t* half, size_t count, float* values)
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t h = half[i];
+        auto f = (h & 0x7FFFU) << 13;
+        auto exp = f & 0x0F800000U;
+        f += 0x38000000U;
+        if (exp == 0x0F800000U) {
+            // inf and nan
+            f += 0x38000000U;
+        }
+        else if (exp == 0) {
+            // zero and subnormals
+            f += 0x00800000U;
+            float x = 0.0f;
+            memcpy(&x, &f, sizeof(x));
+            x -= 6.103515625e-05f;
+            memcpy(&f, &x, sizeof(f));
+        }
+        f |= (h & 0x8000U) << 16;
+        memcpy(&values[i], &f, sizeof(f));
+    }
+}
+
+static inline float sign_not_zero(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+static void octahedral_encode_scalar(const float* normals, size_t count, uint32_t* packed)
+{
+    for (size_t tri = 0; tri < count; ++tri) {
+        auto n = normals + tri * 3;
+        auto l1 = (std::fabs(n[0]) + std::fabs(n[1])) + std::fabs(n[2]);
+        if (!(l1 > 0.0f) || !(l1 < std::numeric_limits<float>::infinity())) {
+            packed[tri] = STL_OCTAHEDRAL_NONE;
+            continue;
+        }
+        auto u = n[0] / l1;
+        auto v = n[1] / l1;
+        if (n[2] < 0.0f) {
+            auto fu = (1.0f - std::fabs(v)) * sign_not_zero(u);
+            auto fv = (1.0f - std::fabs(u)) * sign_not_zero(v);
+            u = fu;
+            v = fv;
+        }
+        u = u > -1.0f ? u : -1.0f;
+        u = u < 1.0f ? u : 1.0f;
+        v = v > -1.0f ? v : -1.0f;
+        v = v < 1.0f ? v : 1.0f;
+        auto qu = static_cast<uint32_t>(static_cast<int32_t>(std::nearbyint(u * 32767.0f)));
+        auto qv = static_cast<uint32_t>(static_cast<int32_t>(std::nearbyint(v * 32767.0f)));
+        packed[tri] = (qu & 0xFFFFU) | (qv << 16);
+    }
+}
+
+static void octahedral_decode_scalar(const uint32_t* packed, size_t count, float* normals)
+{
+    for (size_t tri = 0; tri < count; ++tri) {
+        if (packed[tri] == STL_OCTAHEDRAL_NONE) {
+            normals[tri * 3] = 0.0f;
+            normals[tri * 3 + 1] = 0.0f;
+            normals[tri * 3 + 2] = 0.0f;
+            continue;
+        }
+        auto u = static_cast<float>(static_cast<int16_t>(packed[tri] & 0xFFFFU)) / 32767.0f;
+        auto v = static_cast<float>(static_cast<int16_t>(packed[tri] >> 16)) / 32767.0f;
+        auto au = std::fabs(u);
+        auto av = std::fabs(v);
+        auto z = (1.0f - au) - av;
+        auto x = u;
+        auto y = v;
+        if (z < 0.0f) {
+            x = (1.0f - av) * sign_not_zero(u);
+            y = (1.0f - au) * sign_not_zero(v);
+        }
+        auto length = std::sqrt((x * x + y * y) + z * z);
+        normals[tri * 3] = x / length;
+        normals[tri * 3 + 1] = y / length;
+        normals[tri * 3 + 2] = z / length;
+    }
+}
+
+#ifdef STL_SIMD_X86
+
+static inline __m128i select_si128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// 4 points at a time, the 3 registers hold x0 y0 z0 x1, y1 z1 x2 y2, z2 x3 y3 z3
+static void quantize_sse(const float* xyz, size_t count, const float min[3], const float scale[3], float max_value, uint32_t* q)
+{
+    float mins[12];
+    float scales[12];
+    axis_pattern(min, mins, 4);
+    axis_pattern(scale, scales, 4);
+    const auto zero = _mm_setzero_ps();
+    const auto top = _mm_set1_ps(max_value);
+
+    size_t point = 0;
+    for (; point + 4 <= count; point += 4) {
+        for (auto r = 0; r < 3; ++r) {
+            auto v = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xyz + point * 3 + r * 4), _mm_loadu_ps(mins + r * 4)), _mm_loadu_ps(scales + r * 4));
+            v = _mm_min_ps(_mm_max_ps(v, zero), top);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(q + point * 3 + r * 4), _mm_cvtps_epi32(v));
+        }
+    }
+    quantize_scalar(xyz + point * 3, count - point, min, scale, max_value, q + point * 3);
+}
+
+static void dequantize_sse(const uint32_t* q, size_t count, const float min[3], const float step[3], float* xyz)
+{
+    float mins[12];
+    float steps[12];
+    axis_pattern(min, mins, 4);
+    axis_pattern(step, steps, 4);
+
+    size_t point = 0;
+    for (; point + 4 <= count; point += 4) {
+        for (auto r = 0; r < 3; ++r) {
+            auto v = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q + point * 3 + r * 4)));
+            _mm_storeu_ps(xyz + point * 3 + r * 4, _mm_add_ps(_mm_loadu_ps(mins + r * 4), _mm_mul_ps(v, _mm_loadu_ps(steps + r * 4))));
+        }
+    }
+    dequantize_scalar(q + point * 3, count - point, min, step, xyz + point * 3);
+}
+
+static void float_to_half_sse(const float* values, size_t count, uint16_t* half)
+{
+    const auto sign_bit = _mm_set1_epi32(static_cast<int>(0x80000000U));
+    const auto rebias = _mm_set1_epi32(static_cast<int>(0xC8000FFFU));
+    const auto magic = _mm_set1_epi32(0x3F000000);
+    const auto one = _mm_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto f = _mm_castps_si128(_mm_loadu_ps(values + i));
+        auto sign = _mm_and_si128(f, sign_bit);
+        f = _mm_xor_si128(f, sign);
+
+        auto large = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x477FFFFF));
+        auto nan = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x7F800000));
+        auto special = select_si128(nan, _mm_set1_epi32(0x7E00), _mm_set1_epi32(0x7C00));
+
+        auto small = _mm_cmplt_epi32(f, _mm_set1_epi32(0x38800000));
+        auto subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), _mm_castsi128_ps(magic))), magic);
+
+        auto odd = _mm_and_si128(_mm_srli_epi32(f, 13), one);
+        auto normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(f, rebias), odd), 13);
+
+        auto h = select_si128(large, special, select_si128(small, subnormal, normal));
+        h = _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+
+        // sign extend so the signed pack keeps the 16 bits
+        h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(half + i), _mm_packs_epi32(h, h));
+    }
+    float_to_half_scalar(values + i, count - i, half + i);
+}
+
+static void half_to_float_sse(const uint16_t* half, size_t count, float* values)
+{
+    const auto exp_mask = _mm_set1_epi32(0x0F800000);
+    const auto rebias = _mm_set1_epi32(0x38000000);
+    const auto magic = _mm_set1_ps(6.103515625e-05f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto h = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(half + i)), _mm_setzero_si128());
+        auto f = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7FFF)), 13);
+        auto exp = _mm_and_si128(f, exp_mask);
+        f = _mm_add_epi32(f, rebias);
+
+        auto special = _mm_cmpeq_epi32(exp, exp_mask);
+        f = _mm_add_epi32(f, _mm_and_si128(special, rebias));
+
+        auto small = _mm_cmpeq_epi32(exp, _mm_setzero_si128());
+        auto subnormal = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(f, _mm_set1_epi32(0x00800000))), magic));
+        f = select_si128(small, subnormal, f);
+
+        f = _mm_or_si128(f, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16));
+        _mm_storeu_ps(values + i, _mm_castsi128_ps(f));
+    }
+    half_to_float_scalar(half + i, count - i, values + i);
+}
+
+static inline __m128 sign_not_zero_sse(__m128 v)
+{
+    auto mask = _mm_cmpge_ps(v, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(mask, _mm_set1_ps(1.0f)), _mm_andnot_ps(mask, _mm_set1_ps(-1.0f)));
+}
+
+static void octahedral_encode_sse(const float* normals, size_t count, uint32_t* packed)
+{
+    const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps(1.0f);
+    const auto inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        auto n = normals + tri * 3;
+        auto x = _mm_setr_ps(n[0], n[3], n[6], n[9]);
+        auto y = _mm_setr_ps(n[1], n[4], n[7], n[10]);
+        auto z = _mm_setr_ps(n[2], n[5], n[8], n[11]);
+
+        auto l1 = _mm_add_ps(_mm_add_ps(_mm_and_ps(x, abs_mask), _mm_and_ps(y, abs_mask)), _mm_and_ps(z, abs_mask));
+        auto valid = _mm_and_ps(_mm_cmpgt_ps(l1, zero), _mm_cmplt_ps(l1, inf));
+        auto u = _mm_and_ps(valid, _mm_div_ps(x, l1));
+        auto v = _mm_and_ps(valid, _mm_div_ps(y, l1));
+
+        auto fold = _mm_and_ps(valid, _mm_cmplt_ps(z, zero));
+        auto fu = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(v, abs_mask)), sign_not_zero_sse(u));
+        auto fv = _mm_mul_ps(_mm_sub_ps(one, _mm_and_ps(u, abs_mask)), sign_not_zero_sse(v));
+        u = _mm_or_ps(_mm_and_ps(fold, fu), _mm_andnot_ps(fold, u));
+        v = _mm_or_ps(_mm_and_ps(fold, fv), _mm_andnot_ps(fold, v));
+
+        u = _mm_min_ps(_mm_max_ps(u, _mm_set1_ps(-1.0f)), one);
+        v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), one);
+        auto qu = _mm_cvtps_epi32(_mm_mul_ps(u, _mm_set1_ps(32767.0f)));
+        auto qv = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(32767.0f)));
+        auto p = _mm_or_si128(_mm_and_si128(qu, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(qv, 16));
+        auto keep = _mm_castps_si128(valid);
+        p = _mm_or_si128(_mm_and_si128(keep, p), _mm_andnot_si128(keep, _mm_set1_epi32(static_cast<int>(STL_OCTAHEDRAL_NONE))));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + tri), p);
+    }
+    octahedral_encode_scalar(normals + tri * 3, count - tri, packed + tri);
+}
+
+static void octahedral_decode_sse(const uint32_t* packed, size_t count, float* normals)
+{
+    const auto abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const auto one = _mm_set1_ps(1.0f);
+    const auto snorm = _mm_set1_ps(32767.0f);
+
+    size_t tri = 0;
+    for (; tri + 4 <= count; tri += 4) {
+        auto p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + tri));
+        auto u = _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(p, 16), 16)), snorm);
+        auto v = _mm_div_ps(_mm_cvtepi32_ps(_mm_srai_epi32(p, 16)), snorm);
+        auto au = _mm_and_ps(u, abs_mask);
+        auto av = _mm_and_ps(v, abs_mask);
+        auto z = _mm_sub_ps(_mm_sub_ps(one, au), av);
+
+        auto fold = _mm_cmplt_ps(z, _mm_setzero_ps());
+        auto fx = _mm_mul_ps(_mm_sub_ps(one, av), sign_not_zero_sse(u));
+        auto fy = _mm_mul_ps(_mm_sub_ps(one, au), sign_not_zero_sse(v));
+        auto x = _mm_or_ps(_mm_and_ps(fold, fx), _mm_andnot_ps(fold, u));
+        auto y = _mm_or_ps(_mm_and_ps(fold, fy), _mm_andnot_ps(fold, v));
+
+        auto length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        auto none = _mm_castsi128_ps(_mm_cmpeq_epi32(p, _mm_set1_epi32(static_cast<int>(STL_OCTAHEDRAL_NONE))));
+        float nx[4], ny[4], nz[4];
+        _mm_storeu_ps(nx, _mm_andnot_ps(none, _mm_div_ps(x, length)));
+        _mm_storeu_ps(ny, _mm_andnot_ps(none, _mm_div_ps(y, length)));
+        _mm_storeu_ps(nz, _mm_andnot_ps(none, _mm_div_ps(z, length)));
+        for (auto i = 0; i < 4; ++i) {
+            normals[(tri + i) * 3] = nx[i];
+            normals[(tri + i) * 3 + 1] = ny[i];
+            normals[(tri + i) * 3 + 2] = nz[i];
+        }
+    }
+    octahedral_decode_scalar(packed + tri, count - tri, normals + tri * 3);
+}
+
+STL_TARGET_AVX2
+static inline __m256i select_si256(__m256i mask, __m256i a, __m256i b)
+{
+    return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+}
+
+// 8 points at a time in 3 registers
+STL_TARGET_AVX2
+static void quantize_avx2(const float* xyz, size_t count, const float min[3], const float scale[3], float max_value, uint32_t* q)
+{
+    float mins[24];
+    float scales[24];
+    axis_pattern(min, mins, 8);
+    axis_pattern(scale, scales, 8);
+    const auto zero = _mm256_setzero_ps();
+    const auto top = _mm256_set1_ps(max_value);
+
+    size_t point = 0;
+    for (; point + 8 <= count; point += 8) {
+        for (auto r = 0; r < 3; ++r) {
+            auto v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(xyz + point * 3 + r * 8), _mm256_loadu_ps(mins + r * 8)), _mm256_loadu_ps(scales + r * 8));
+            v = _mm256_min_ps(_mm256_max_ps(v, zero), top);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(q + point * 3 + r * 8), _mm256_cvtps_epi32(v));
+        }
+    }
+    quantize_scalar(xyz + point * 3, count - point, min, scale, max_value, q + point * 3);
+}
+
+STL_TARGET_AVX2
+static void dequantize_avx2(const uint32_t* q, size_t count, const float min[3], const float step[3], float* xyz)
+{
+    float mins[24];
+    float steps[24];
+    axis_pattern(min, mins, 8);
+    axis_pattern(step, steps, 8);
+
+    size_t point = 0;
+    for (; point + 8 <= count; point += 8) {
+        for (auto r = 0; r < 3; ++r) {
+            auto v = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(q + point * 3 + r * 8)));
+            _mm256_storeu_ps(xyz + point * 3 + r * 8, _mm256_add_ps(_mm256_loadu_ps(mins + r * 8), _mm256_mul_ps(v, _mm256_loadu_ps(steps + r * 8))));
+        }
+    }
+    dequantize_scalar(q + point * 3, count - point, min, step, xyz + point * 3);
+}
+
+STL_TARGET_AVX2
+static void float_to_half_avx2(const float* values, size_t count, uint16_t* half)
+{
+    const auto sign_bit = _mm256_set1_epi32(static_cast<int>(0x80000000U));
+    const auto rebias = _mm256_set1_epi32(static_cast<int>(0xC8000FFFU));
+    const auto magic = _mm256_set1_epi32(0x3F000000);
+    const auto one = _mm256_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto f = _mm256_castps_si256(_mm256_loadu_ps(values + i));
+        auto sign = _mm256_and_si256(f, sign_bit);
+        f = _mm256_xor_si256(f, sign);
+
+        auto large = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(0x477FFFFF));
+        auto nan = _mm256_cmpgt_epi32(f, _mm256_set1_epi32(0x7F800000));
+        auto special = select_si256(nan, _mm256_set1_epi32(0x7E00), _mm256_set1_epi32(0x7C00));
+
+        auto small = _mm256_cmpgt_epi32(_mm256_set1_epi32(0x38800000), f);
+        auto subnormal = _mm256_sub_epi32(_mm256_castps_si256(_mm256_add_ps(_mm256_castsi256_ps(f), _mm256_castsi256_ps(magic))), magic);
+
+        auto odd = _mm256_and_si256(_mm256_srli_epi32(f, 13), one);
+        auto normal = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(f, rebias), odd), 13);
+
+        auto h = select_si256(large, special, select_si256(small, subnormal, normal));
+        h = _mm256_or_si256(h, _mm256_srli_epi32(sign, 16));
+
+        // the pack works on 128 bit lanes, put the 2 halves together
+        h = _mm256_srai_epi32(_mm256_slli_epi32(h, 16), 16);
+        h = _mm256_permute4x64_epi64(_mm256_packs_epi32(h, h), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(half + i), _mm256_castsi256_si128(h));
+    }
+    float_to_half_scalar(values + i, count - i, half + i);
+}
+
+STL_TARGET_AVX2
+static void half_to_float_avx2(const uint16_t* half, size_t count, float* values)
+{
+    const auto exp_mask = _mm256_set1_epi32(0x0F800000);
+    const auto rebias = _mm256_set1_epi32(0x38000000);
+    const auto magic = _mm256_set1_ps(6.103515625e-05f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto h = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(half + i)));
+        auto f = _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x7FFF)), 13);
+        auto exp = _mm256_and_si256(f, exp_mask);
+        f = _mm256_add_epi32(f, rebias);
+
+        auto special = _mm256_cmpeq_epi32(exp, exp_mask);
+        f = _mm256_add_epi32(f, _mm256_and_si256(special, rebias));
+
+        auto small = _mm256_cmpeq_epi32(exp, _mm256_setzero_si256());
+        auto subnormal = _mm256_castps_si256(_mm256_sub_ps(_mm256_castsi256_ps(_mm256_add_epi32(f, _mm256_set1_epi32(0x00800000))), magic));
+        f = select_si256(small, subnormal, f);
+
+        f = _mm256_or_si256(f, _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x8000)), 16));
+        _mm256_storeu_ps(values + i, _mm256_castsi256_ps(f));
+    }
+    half_to_float_scalar(half + i, count - i, values + i);
+}
+
+#endif
+
+// quantize count xyz points
+void stl_simd_quantize(const float* xyz, size_t count, const float min[3], const float scale[3], float max_value, uint32_t* q)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            quantize_avx2(xyz, count, min, scale, max_value, q);
+            break;
+
+        case stl_simd_sse:
+            quantize_sse(xyz, count, min, scale, max_value, q);
+            break;
+#endif
+        default:
+            quantize_scalar(xyz, count, min, scale, max_value, q);
+            break;
+    }
+}
+
+// min + q * step for count xyz points
+void stl_simd_dequantize(const uint32_t* q, size_t count, const float min[3], const float step[3], float* xyz)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            dequantize_avx2(q, count, min, step, xyz);
+            break;
+
+        case stl_simd_sse:
+            dequantize_sse(q, count, min, step, xyz);
+            break;
+#endif
+        default:
+            dequantize_scalar(q, count, min, step, xyz);
+            break;
+    }
+}
+
+// floats to half floats
+void stl_simd_float_to_half(const float* values, size_t count, uint16_t* half)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            float_to_half_avx2(values, count, half);
+            break;
+
+        case stl_simd_sse:
+            float_to_half_sse(values, count, half);
+            break;
+#endif
+        default:
+            float_to_half_scalar(values, count, half);
+            break;
+    }
+}
+
+// half floats to floats
+void stl_simd_half_to_float(const uint16_t* half, size_t count, float* values)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+            half_to_float_avx2(half, count, values);
+            break;
+
+        case stl_simd_sse:
+            half_to_float_sse(half, count, values);
+            break;
+#endif
+        default:
+            half_to_float_scalar(half, count, values);
+            break;
+    }
+}
+
+// unit normals to octahedral 2 x 16 bit
+void stl_simd_octahedral_encode(const float* normals, size_t count, uint32_t* packed)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+        case stl_simd_sse:
+            octahedral_encode_sse(normals, count, packed);
+            break;
+#endif
+        default:
+            octahedral_encode_scalar(normals, count, packed);
+            break;
+    }
+}
+
+// octahedral 2 x 16 bit to unit normals
+void stl_simd_octahedral_decode(const uint32_t* packed, size_t count, float* normals)
+{
+    switch (stl_simd_active()) {
+#ifdef STL_SIMD_X86
+        case stl_simd_avx2:
+        case stl_simd_sse:
+            octahedral_decode_sse(packed, count, normals);
+            break;
+#endif
+        default:
+            octahedral_decode_scalar(packed, count, normals);
+            break;
+    }
+}
@@ -0,0 +1,99 @@
+// stl_simd.h : vector kernels for the stl algorithms
+//
+// every kernel has a scalar version and, on x86, SSE and AVX2 versions.
+// The best version the cpu supports is picked at run time and all the
+// versions give the same results bit for bit.
+
+#ifndef STL_SIMD_H
+#define STL_SIMD_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define STL_SIMD_X86 1
+#endif
+
+enum stl_simd_level
+{
+    stl_simd_scalar,
+    stl_simd_sse,
+    stl_simd_avx2
+};
+
+// the level used by the kernels
+stl_simd_level stl_simd_active();
+
+// limit the level used by the kernels, for testing and benchmarks
+// the cpu level is still the upper bound
+void stl_simd_limit(stl_simd_level level);
+
+// unit right hand normals of count triangles of 9 floats each
+// normals gets 3 floats per triangle
+void stl_simd_normals(const float* vectors, float* normals, size_t count);
+
+// stl_simd_normals with the vertices in separate x, y and z arrays
+// corner c of triangle t is at index 3 * t + c
+void stl_simd_normals_soa(const float* x, const float* y, const float* z, float* normals, size_t count);
+
+// min and max of each axis of count xyz points
+// min and max must hold a finite starting value or +inf/-inf. nan and inf
+// coordinates are skipped at every level, so the box is that of the
+// finite values. The min or max of +0 and -0 may come out as either of them
+void stl_simd_bounds(const float* xyz, size_t count, float min[3], float max[3]);
+
+// (p - center) * scale for count xyz points
+void stl_simd_scale_translate(float* xyz, size_t count, const float center[3], float scale);
+
+// p = M * p + t for count xyz points
+// matrix is the 3 x 4 affine part of a row major 4 x 4 matrix
+void stl_simd_affine(float* xyz, size_t count, const float matrix[12]);
+
+// n = M * n, scaled to unit length, for count xyz vectors
+// zero length vectors stay zero
+void stl_simd_linear_normalize(float* xyz, size_t count, const float matrix[9]);
+
+// the same kernels with separate x, y and z arrays
+void stl_simd_axis_bounds(const float* v, size_t count, float& min, float& max);
+void stl_simd_axis_scale_translate(float* v, size_t count, float center, float scale);
+void stl_simd_affine_soa(float* x, float* y, float* z, size_t count, const float matrix[12]);
+
+// nearest hit of a ray with the 4 triangles of a block
+// the block holds corner 0 x of the 4 triangles, then corner 0 y,
+// ... up to corner 2 z, 36 floats. Unused lanes are nan.
+// return the lane of the hit with t_min < t < t_max and set t u v,
+// or -1 when there is none
+int stl_simd_intersect_block(const float* block, const float origin[3], const float direction[3],
+    float t_min, float t_max, float& t, float& u, float& v);
+
+// number of sums of stl_simd_mass_terms
+constexpr int STL_MASS_TERMS = 11;
+
+// sums over count triangles of 9 floats each, with the corners a b c
+// taken relative to origin and s = a + b + c:
+//  6 x the signed volume of the tetrahedron origin a b c (d), 2 x the area,
+//  d * s (3) and d * (a a' + b b' + c c' + s s') for xx yy zz xy yz zx (6)
+// the sums are in double with Kahan summation
+void stl_simd_mass_terms(const float* vectors, size_t count, const double origin[3], double sums[STL_MASS_TERMS]);
+
+// q = round((p - min) * scale) for count xyz points, clamped to 0 .. max_value
+// rounds to nearest even, nan goes to 0
+void stl_simd_quantize(const float* xyz, size_t count, const float min[3], const float scale[3], float max_value, uint32_t* q);
+
+// p = min + q * step for count xyz points
+void stl_simd_dequantize(const uint32_t* q, size_t count, const float min[3], const float step[3], float* xyz);
+
+// count floats to IEEE half floats and back
+// rounds to nearest even, too large values become inf and nan stays nan
+void stl_simd_float_to_half(const float* values, size_t count, uint16_t* half);
+void stl_simd_half_to_float(const uint16_t* half, size_t count, float* values);
+
+// count xyz normals to the octahedral 2 x 16 bit snorm u | v << 16 and back
+// the decoded normals have unit length. Zero and non finite normals, those
+// with a nan or inf component, are stored as STL_OCTAHEDRAL_NONE,
+// u = v = -32768 which no normal encodes to, and come back as 0 0 0
+constexpr uint32_t STL_OCTAHEDRAL_NONE = 0x80008000U;
+void stl_simd_octahedral_encode(const float* normals, size_t count, uint32_t* packed);
+void stl_simd_octahedral_decode(const uint32_t* packed, size_t count, float* normals);
+
+#endif
@@ -0,0 +1,308 @@
+// stl_slicer.cpp : cut a stl into layers of closed contours
+//
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "stl_slicer.h"
+#include "stl_parallel.h"
+
+namespace
+{
+    // first and last layer a triangle crosses
+    // a layer is crossed when zmin < z <= zmax
+    struct layer_span
+    {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    struct plane_stack
+    {
+        float first_z;
+        float layer_height;
+        size_t layers;
+
+        float z(size_t layer) const { return first_z + static_cast<float>(layer) * layer_height; }
+
+        // the first layer above zmin and the last one at or below zmax
+        // last < first when no layer is crossed, as for a triangle with a
+        // non finite z that no plane can cut
+        layer_span span(float zmin, float zmax) const
+        {
+            if (!std::isfinite(zmin) || !std::isfinite(zmax)) {
+                return { 1, 0 };
+            }
+            auto estimate = [&](float value) {
+                auto layer = std::floor((static_cast<double>(value) - first_z) / layer_height);
+                return !(layer > 0.0) ? 0.0 : std::min<double>(layer, static_cast<double>(layers));
+            };
+
+            auto first = static_cast<size_t>(estimate(zmin));
+            while (first < layers && !(z(first) > zmin)) {
+                ++first;
+            }
+            while (first > 0 && z(first - 1) > zmin) {
+                --first;
+            }
+
+            auto end = static_cast<size_t>(estimate(zmax));
+            while (end < layers && z(end) <= zmax) {
+                ++end;
+            }
+            while (end > 0 && !(z(end - 1) <= zmax)) {
+                --end;
+            }
+
+            if (first >= end) {
+                return { 1, 0 };
+            }
+            return { static_cast<uint32_t>(first), static_cast<uint32_t>(end - 1) };
+        }
+    };
+
+    inline bool less_xyz(const float* a, const float* b)
+    {
+        return std::lexicographical_compare(a, a + AXIS_PER_VERTEX, b, b + AXIS_PER_VERTEX);
+    }
+
+    // point where the edge a b crosses z
+    // the ends are put in a fixed order first so the 2 triangles
+    // sharing the edge get the same point bit for bit
+    inline void cut_edge(const float* a, const float* b, float z, float xy[2])
+    {
+        if (less_xyz(b, a)) {
+            std::swap(a, b);
+        }
+        auto t = (z - a[2]) / (b[2] - a[2]);
+        xy[0] = a[0] + (b[0] - a[0]) * t;
+        xy[1] = a[1] + (b[1] - a[1]) * t;
+    }
+
+    // segment where the triangle v crosses z
+    // a vertex on the plane counts as above it. The segment runs so the
+    // right hand normal of the winding is on its right, return false
+    // when there is none
+    bool cut_triangle(const float* v, float z, float segment[4])
+    {
+        auto points = 0;
+        for (auto i = 0; i < VERTEX_PER_TRIANGLE && points < 2; ++i) {
+            auto a = v + i * AXIS_PER_VERTEX;
+            auto b = v + ((i + 1) % VERTEX_PER_TRIANGLE) * AXIS_PER_VERTEX;
+            if ((a[2] < z) != (b[2] < z)) {
+                cut_edge(a, b, z, &segment[points * 2]);
+                ++points;
+            }
+        }
+        if (points != 2 || (segment[0] == segment[2] && segment[1] == segment[3])) {
+            return false;
+        }
+
+        float e1[3], e2[3];
+        for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+            e1[ax] = v[AXIS_PER_VERTEX + ax] - v[ax];
+            e2[ax] = v[2 * AXIS_PER_VERTEX + ax] - v[ax];
+        }
+        auto nx = e1[1] * e2[2] - e1[2] * e2[1];
+        auto ny = e1[2] * e2[0] - e1[0] * e2[2];
+        auto dx = segment[2] - segment[0];
+        auto dy = segment[3] - segment[1];
+        if (dy * nx - dx * ny < 0.0f) {
+            std::swap(segment[0], segment[2]);
+            std::swap(segment[1], segment[3]);
+        }
+        return true;
+    }
+
+    inline uint64_t point_key(const float* xy)
+    {
+        uint32_t x = 0, y = 0;
+        memcpy(&x, &xy[0], sizeof(x));
+        memcpy(&y, &xy[1], sizeof(y));
+        return (static_cast<uint64_t>(x) << 32) | y;
+    }
+
+    // chain segments (x0 y0 x1 y1) into contours
+    // a segment is followed by the segment starting where it ends
+    void chain_segments(const std::vector<float>& segments, std::vector<stl_contour>& contours)
+    {
+        auto count = segments.size() / 4;
+        std::unordered_map<uint64_t, uint32_t> starts;
+        starts.reserve(count);
+        for (uint32_t s = 0; s < count; ++s) {
+            starts.emplace(point_key(&segments[s * 4]), s);
+        }
+
+        std::vector<uint8_t> followed(count, 0);
+        for (size_t s = 0; s < count; ++s) {
+            auto next = starts.find(point_key(&segments[s * 4 + 2]));
+            if (next != starts.end()) {
+                followed[next->second] = 1;
+            }
+        }
+
+        std::vector<uint8_t> used(count, 0);
+        auto trace = [&](uint32_t first) {
+            stl_contour contour;
+            contour.closed = false;
+            auto s = first;
+            for (;;) {
+                used[s] = 1;
+                contour.points.push_back(segments[s * 4]);
+                contour.points.push_back(segments[s * 4 + 1]);
+                auto next = starts.find(point_key(&segments[s * 4 + 2]));
+                if (next != starts.end() && next->second == first) {
+                    contour.closed = true;
+                    break;
+                }
+                if (next == starts.end() || used[next->second]) {
+                    contour.points.push_back(segments[s * 4 + 2]);
+                    contour.points.push_back(segments[s * 4 + 3]);
+                    break;
+                }
+                s = next->second;
+            }
+            contours.push_back(std::move(contour));
+        };
+
+        // open chains start where no segment ends, the rest are loops
+        for (uint32_t s = 0; s < count; ++s) {
+            if (!used[s] && !followed[s]) {
+                trace(s);
+            }
+        }
+        for (uint32_t s = 0; s < count; ++s) {
+            if (!used[s]) {
+                trace(s);
+            }
+        }
+    }
+}
+
+// slice
+// cut the mesh with layers planes at first_z, first_z + layer_height, ...
+// threads 0 uses the hardware concurrency
+int stl_slicer::slice(const stl& mesh, float first_z, float layer_height, size_t layers, unsigned threads)
+{
+    clear();
+    if (!(layer_height > 0.0f) || !std::isfinite(first_z) || layers >= UINT32_MAX) {
+        throw std::runtime_error("Invalid slice layers.");
+    }
+
+    auto triangles = mesh.num_vertices() / VERTEX_PER_TRIANGLE;
+    if (triangles >= UINT32_MAX) {
+        throw std::runtime_error("stl has too many triangles for 32 bit indices.");
+    }
+
+    plane_stack planes = { first_z, layer_height, layers };
+    m_layers.resize(layers);
+    for (size_t layer = 0; layer < layers; ++layer) {
+        m_layers[layer].z = planes.z(layer);
+    }
+    if (triangles == 0 || layers == 0) {
+        return 0;
+    }
+    threads = stl_thread_count(threads);
+
+    std::vector<layer_span> spans(triangles);
+    stl_parallel_blocks(triangles, STL_VERTEX_BLOCK_SIZE, threads, [&](size_t first, size_t count) {
+        float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+        for (auto tri = first; tri < first + count; ++tri) {
+            auto v = mesh.triangle_vertices(tri, buffer);
+            spans[tri] = planes.span(std::min({ v[2], v[5], v[8] }), std::max({ v[2], v[5], v[8] }));
+        }
+    });
+
+    // bucket the triangles into every block of layers they cross
+    auto blocks = (layers + STL_SLICE_BLOCK_LAYERS - 1) / STL_SLICE_BLOCK_LAYERS;
+    std::vector<size_t> block_begin(blocks + 1, 0);
+    for (auto& span : spans) {
+        if (span.first <= span.last) {
+            for (auto block = span.first / STL_SLICE_BLOCK_LAYERS; block <= span.last / STL_SLICE_BLOCK_LAYERS; ++block) {
+                ++block_begin[block + 1];
+            }
+        }
+    }
+    for (size_t block = 0; block < blocks; ++block) {
+        block_begin[block + 1] += block_begin[block];
+    }
+
+    std::vector<uint32_t> bucketed(block_begin[blocks]);
+    std::vector<size_t> next(block_begin.begin(), block_begin.end() - 1);
+    for (uint32_t tri = 0; tri < triangles; ++tri) {
+        auto& span = spans[tri];
+        if (span.first <= span.last) {
+            for (auto block = span.first / STL_SLICE_BLOCK_LAYERS; block <= span.last / STL_SLICE_BLOCK_LAYERS; ++block) {
+                bucketed[next[block]++] = tri;
+            }
+        }
+    }
+
+    // sweep each block from its lowest layer up
+    stl_parallel_for(blocks, threads, [&](size_t block) {
+        auto first_layer = block * STL_SLICE_BLOCK_LAYERS;
+        auto block_layers = std::min(STL_SLICE_BLOCK_LAYERS, layers - first_layer);
+
+        // triangles by the layer of the block they enter at
+        std::vector<uint32_t> entering[STL_SLICE_BLOCK_LAYERS];
+        for (auto i = block_begin[block]; i < block_begin[block + 1]; ++i) {
+            auto tri = bucketed[i];
+            auto enter = std::max<size_t>(spans[tri].first, first_layer) - first_layer;
+            entering[enter].push_back(tri);
+        }
+
+        std::vector<uint32_t> active;
+        std::vector<float> segments;
+        float buffer[VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX];
+        for (size_t i = 0; i < block_layers; ++i) {
+            auto layer = first_layer + i;
+            auto z = m_layers[layer].z;
+            active.insert(active.end(), entering[i].begin(), entering[i].end());
+
+            segments.clear();
+            for (auto tri : active) {
+                float segment[4];
+                if (cut_triangle(mesh.triangle_vertices(tri, buffer), z, segment)) {
+                    segments.insert(segments.end(), segment, segment + 4);
+                }
+            }
+            chain_segments(segments, m_layers[layer].contours);
+
+            active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t tri) {
+                return spans[tri].last <= layer;
+            }), active.end());
+        }
+    });
+    return 0;
+}
+
+// slice
+// cut the mesh into layers layer_height thick
+// the planes are in the middle of each layer, starting at the bottom of the mesh
+int stl_slicer::slice(const stl& mesh, float layer_height, unsigned threads)
+{
+    if (!(layer_height > 0.0f)) {
+        throw std::runtime_error("Invalid slice layers.");
+    }
+
+    // a box without a finite z has no triangle a plane can cut
+    auto box = mesh.bounds(threads);
+    if (box.is_empty() || !std::isfinite(box.min[2]) || !std::isfinite(box.max[2])) {
+        clear();
+        return 0;
+    }
+    auto layers = std::floor((static_cast<double>(box.max[2]) - box.min[2]) / layer_height);
+    if (!(layers < static_cast<double>(UINT32_MAX))) {
+        throw std::runtime_error("Invalid slice layers.");
+    }
+    return slice(mesh, box.min[2] + layer_height / 2.0f, layer_height, std::max<size_t>(static_cast<size_t>(layers), 1), threads);
+}
+
+// clear
+// drop the layers
+void stl_slicer::clear()
+{
+    m_layers.clear();
+}
@@ -0,0 +1,49 @@
+// stl_slicer.h : cut a stl into layers of closed contours
+//
+
+#ifndef STL_SLICER_H
+#define STL_SLICER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "stl.h"
+
+constexpr size_t STL_SLICE_BLOCK_LAYERS = 8;
+
+// polyline in a slice plane, xy pairs
+// a closed contour does not repeat its first point, an open one comes
+// from a mesh with holes. The direction comes from the winding, not
+// from m_normals: when the triangles are counter clockwise seen from
+// outside, as calc_normals and stl_repair_topology expect, outer
+// contours run counter clockwise seen from +z and holes clockwise.
+struct stl_contour
+{
+    std::vector<float> points;
+    bool closed;
+};
+
+struct stl_layer
+{
+    float z;
+    std::vector<stl_contour> contours;
+};
+
+// stl_slicer
+// the triangles are bucketed into blocks of consecutive layers by their
+// z range. Each block is swept from its lowest layer up on a worker
+// thread, keeping the list of triangles that cross the current plane,
+// and the segments of a layer are chained into contours by matching
+// their end points in a hash table. A triangle with a nan or inf z is
+// in no layer.
+class stl_slicer
+{
+public:
+    std::vector<stl_layer> m_layers;
+
+    int slice(const stl& mesh, float first_z, float layer_height, size_t layers, unsigned threads = 0);
+    int slice(const stl& mesh, float layer_height, unsigned threads = 0);
+    void clear();
+};
+
+#endif
@@ -0,0 +1,80 @@
+// stl_stats.h : optional statistics of stl reads and writes
+//
+// define STL_ENABLE_STATS to collect them. Without it the STL_STATS
+// macros compile to nothing and stl::m_stats stays zero.
+
+#ifndef STL_STATS_H
+#define STL_STATS_H
+
+#include <chrono>
+#include <cstdint>
+
+enum stl_stats_phase
+{
+    stl_phase_open,         // open and map the input or create the output
+    stl_phase_detect,       // find out if the input is binary or ascii
+    stl_phase_tokenize,     // ascii tokens and the parse state machine
+    stl_phase_float,        // ascii numbers
+    stl_phase_copy,         // binary records into the vectors
+    stl_phase_format,       // binary records or ascii text of the output
+    stl_phase_write,        // output file writes
+    stl_phase_count
+};
+
+// statistics of the last read_stl or create_stl_* call
+// the phase times are wall time, except the parallel ascii parse
+// which adds up the time of every worker thread.
+// peak_bytes counts the vectors, i/o buffers and the mapped input.
+struct stl_stats
+{
+    double seconds[stl_phase_count] = {};
+    double total_seconds = 0.0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t tokens = 0;
+    uint64_t floats = 0;
+    uint64_t reallocations = 0;
+    uint64_t peak_bytes = 0;
+
+    void clear() { *this = stl_stats(); }
+};
+
+// counted by a scanner and its parser, added to stl_stats after the parse
+struct stl_scan_counters
+{
+    uint64_t tokens = 0;
+    uint64_t floats = 0;
+    uint64_t reallocations = 0;
+    double float_seconds = 0.0;
+};
+
+// add the time from construction to destruction to seconds
+class stl_stats_timer
+{
+public:
+    explicit stl_stats_timer(double& seconds) : m_seconds(seconds), m_start(std::chrono::steady_clock::now()) {}
+    ~stl_stats_timer()
+    {
+        m_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    stl_stats_timer(const stl_stats_timer&) = delete;
+    stl_stats_timer& operator=(const stl_stats_timer&) = delete;
+
+private:
+    double& m_seconds;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define STL_STATS_CAT2(a, b) a##b
+#define STL_STATS_CAT(a, b) STL_STATS_CAT2(a, b)
+
+#ifdef STL_ENABLE_STATS
+#define STL_STATS(...) __VA_ARGS__
+#define STL_STATS_TIME(seconds) stl_stats_timer STL_STATS_CAT(stl_stats_timer_, __LINE__)(seconds)
+#else
+#define STL_STATS(...)
+#define STL_STATS_TIME(seconds)
+#endif
+
+#endif
@@ -0,0 +1,178 @@
+// stl_stream.cpp : read stl files in batches of triangles
+//
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "stl_stream.h"
+
+// open
+// open the file and find out if it is binary or ascii
+// the same way read_stl does, from the start of the file
+bool stl_stream::open(const char* name)
+{
+    close();
+    m_name = std::string(name);
+
+    m_file.open(name, std::ios::binary | std::ios::ate);
+    if (!m_file.is_open()) {
+        throw std::runtime_error(std::string("Unable to open stl input file ") + name + ".");
+    }
+    auto size = static_cast<unsigned long long>(m_file.tellg());
+    if (size < MIN_STL_LENGTH) {
+        close();
+        throw std::runtime_error(m_name + " invalid stl file.");
+    }
+
+    std::vector<char> sniff(static_cast<size_t>(std::min<unsigned long long>(size, STL_STREAM_SNIFF_SIZE)));
+    m_file.seekg(0, std::ios::beg);
+    m_file.read(sniff.data(), static_cast<std::streamsize>(sniff.size()));
+    m_binary = !stl::detect_ascii(sniff.data(), sniff.size(), size);
+
+    if (m_binary) {
+        uint32_t num_triangles = 0;
+        if (size >= STL_HEADER_SIZE + STL_COUNT_SIZE) {
+            memcpy(m_header, sniff.data(), STL_HEADER_SIZE);
+            memcpy(&num_triangles, sniff.data() + STL_HEADER_SIZE, sizeof(num_triangles));
+        }
+        if (STL_HEADER_SIZE + STL_COUNT_SIZE + static_cast<unsigned long long>(num_triangles) * STL_TRIANGLE_SIZE != size) {
+            close();
+            throw std::runtime_error(m_name + " invalid stl file.");
+        }
+        m_remaining = num_triangles;
+        m_file.seekg(STL_HEADER_SIZE + STL_COUNT_SIZE, std::ios::beg);
+    }
+    else {
+        m_file.seekg(0, std::ios::beg);
+        m_parser.m_name = m_name;
+        m_state = stl::solid;
+        m_source = std::make_unique<stl_istream_source>(m_file);
+        m_scan = std::make_unique<stl_ascii_scanner>(*m_source);
+    }
+    return true;
+}
+
+// read
+// read up to max_triangles triangles into batch
+// return the number of triangles read, 0 at the end of the file
+size_t stl_stream::read(std::vector<stl_triangle>& batch, size_t max_triangles)
+{
+    batch.clear();
+    if (!m_file.is_open() || max_triangles == 0) {
+        return 0;
+    }
+
+    auto count = m_binary ? read_binary(batch, max_triangles) : read_ascii(batch, max_triangles);
+    m_triangles_read += count;
+    return count;
+}
+
+// read the next 50 byte records
+size_t stl_stream::read_binary(std::vector<stl_triangle>& batch, size_t max_triangles)
+{
+    auto count = static_cast<size_t>(std::min<uint64_t>(m_remaining, max_triangles));
+    if (count == 0) {
+        return 0;
+    }
+
+    m_records.resize(count * STL_TRIANGLE_SIZE);
+    m_file.read(m_records.data(), static_cast<std::streamsize>(m_records.size()));
+    if (static_cast<size_t>(m_file.gcount()) != m_records.size()) {
+        throw std::runtime_error(m_name + " invalid stl file.");
+    }
+    m_remaining -= static_cast<uint32_t>(count);
+
+    batch.resize(count);
+    auto record = m_records.data();
+    for (auto& triangle : batch) {
+        memcpy(triangle.normal, record, sizeof(triangle.normal));
+        memcpy(triangle.vertices, record + sizeof(triangle.normal), sizeof(triangle.vertices));
+        memcpy(&triangle.attribute, record + STL_TRIANGLE_SIZE - STL_ATTRIBUTE_SIZE, sizeof(triangle.attribute));
+        record += STL_TRIANGLE_SIZE;
+    }
+    return count;
+}
+
+// parse the next facets
+// the normals and vertices are grouped into triangles the same way
+// read_stl groups m_normals and m_vectors, values left over from a
+// batch are kept for the next one
+size_t stl_stream::read_ascii(std::vector<stl_triangle>& batch, size_t max_triangles)
+{
+    for (;;) {
+        auto count = std::min({ m_normals.size() / AXIS_PER_VERTEX,
+            m_vectors.size() / (VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX), max_triangles - batch.size() });
+
+        auto normal = m_normals.data();
+        auto vertex = m_vectors.data();
+        for (size_t i = 0; i < count; ++i) {
+            stl_triangle triangle;
+            memcpy(triangle.normal, normal, sizeof(triangle.normal));
+            memcpy(triangle.vertices, vertex, sizeof(triangle.vertices));
+            triangle.attribute = 0;
+            batch.push_back(triangle);
+            normal += AXIS_PER_VERTEX;
+            vertex += VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX;
+        }
+        m_normals.erase(m_normals.begin(), m_normals.begin() + count * AXIS_PER_VERTEX);
+        m_vectors.erase(m_vectors.begin(), m_vectors.begin() + count * VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX);
+
+        if (batch.size() >= max_triangles || m_state == stl::done) {
+            break;
+        }
+
+        // a failed parse leaves the state at error and parse_ascii
+        // would return at once on every later call
+        if (m_state == stl::error) {
+            throw std::runtime_error(m_name + " invalid stl file.");
+        }
+        auto state = m_state;
+        auto values = m_normals.size() + m_vectors.size();
+        m_parser.parse_ascii(*m_scan, m_state, m_normals, m_vectors, max_triangles - batch.size());
+        if (m_state == state && m_normals.size() + m_vectors.size() == values) {
+            throw std::runtime_error(m_name + " invalid stl file.");
+        }
+    }
+    return batch.size();
+}
+
+// close
+// close the file and drop the buffers
+void stl_stream::close()
+{
+    if (m_file.is_open()) {
+        m_file.close();
+    }
+    m_file.clear();
+    m_scan.reset();
+    m_source.reset();
+    m_binary = false;
+    memset(m_header, 0, STL_HEADER_SIZE);
+    m_triangles_read = 0;
+    m_remaining = 0;
+    m_state = stl::solid;
+    m_records.clear();
+    m_normals.clear();
+    m_vectors.clear();
+}
+
+stl_stream::~stl_stream()
+{
+    close();
+}
+
+// stl_for_each_batch
+// stream a stl file to visitor in batches of triangles
+// return the number of triangles read
+uint64_t stl_for_each_batch(const char* name, const stl_batch_visitor& visitor, size_t batch_size)
+{
+    stl_stream in;
+    std::vector<stl_triangle> batch;
+    batch.reserve(batch_size);
+
+    in.open(name);
+    while (in.read(batch, batch_size) > 0) {
+        visitor(batch.data(), batch.size());
+    }
+    return in.triangles_read();
+}
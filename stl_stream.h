@@ -0,0 +1,87 @@
+// stl_stream.h : read stl files in batches of triangles
+//
+
+#ifndef STL_STREAM_H
+#define STL_STREAM_H
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+
+constexpr size_t STL_STREAM_BATCH_SIZE = 1U << 14;
+constexpr size_t STL_STREAM_SNIFF_SIZE = 1U << 16;
+
+// a triangle delivered by the streaming reader
+// ascii triangles have an attribute of 0
+struct stl_triangle
+{
+    float normal[3];
+    float vertices[9];
+    uint16_t attribute;
+};
+
+// stl_stream
+// read a binary or ascii stl file front to back in fixed size batches
+// memory use depends on the batch size, not on the size of the file
+//
+//  stl_stream in;
+//  std::vector<stl_triangle> batch;
+//  in.open(name);
+//  while (in.read(batch) > 0) {
+//      ...
+//  }
+class stl_stream
+{
+public:
+    stl_stream() = default;
+    ~stl_stream();
+
+    stl_stream(const stl_stream&) = delete;
+    stl_stream& operator=(const stl_stream&) = delete;
+
+    bool open(const char* name);
+    size_t read(std::vector<stl_triangle>& batch, size_t max_triangles = STL_STREAM_BATCH_SIZE);
+    void close();
+
+    bool is_binary() const { return m_binary; }
+    const char* header() const { return m_header; }
+    uint64_t triangles_read() const { return m_triangles_read; }
+
+    // triangles of a binary file not read yet, 0 for ascii
+    uint32_t triangles_remaining() const { return m_remaining; }
+
+private:
+    std::string m_name;
+    std::ifstream m_file;
+    bool m_binary = false;
+    char m_header[STL_HEADER_SIZE] = { 0 };
+    uint64_t m_triangles_read = 0;
+
+    // binary
+    uint32_t m_remaining = 0;
+    std::vector<char> m_records;
+
+    // ascii
+    stl m_parser;
+    stl::sti_parse_state m_state = stl::solid;
+    std::unique_ptr<stl_istream_source> m_source;
+    std::unique_ptr<stl_ascii_scanner> m_scan;
+    stl_float_vector m_normals;
+    stl_float_vector m_vectors;
+
+    size_t read_binary(std::vector<stl_triangle>& batch, size_t max_triangles);
+    size_t read_ascii(std::vector<stl_triangle>& batch, size_t max_triangles);
+};
+
+// stream a stl file to visitor in batches of triangles
+// return the number of triangles read
+using stl_batch_visitor = std::function<void(const stl_triangle* triangles, size_t count)>;
+uint64_t stl_for_each_batch(const char* name, const stl_batch_visitor& visitor,
+    size_t batch_size = STL_STREAM_BATCH_SIZE);
+
+#endif
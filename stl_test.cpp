@@ -0,0 +1,422 @@
+// stl_test.cpp : checks of the stl functions on small meshes
+//
+// Each check builds a mesh in memory, runs the functions on it and
+// throws when a result is wrong. Files are written to the temp
+// directory and removed again.
+//
+// usage: stl_test
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+#include "stl_bvh.h"
+#include "stl_cache.h"
+#include "stl_compact.h"
+#include "stl_merge.h"
+#include "stl_metrics.h"
+#include "stl_simd.h"
+#include "stl_slicer.h"
+#include "stl_topology.h"
+#include "stl_writer.h"
+
+// path of a scratch file in the temp directory
+static std::string temp_path(const char* name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// a scratch stl file in the temp directory
+// the file and its cache are removed when it goes out of scope
+struct scratch_file
+{
+    std::string name;
+
+    explicit scratch_file(const char* file) : name(temp_path(file)) {}
+    ~scratch_file()
+    {
+        std::remove(stl_cache_name(name.c_str()).c_str());
+        std::remove(name.c_str());
+    }
+};
+
+// the simd level is put back when it goes out of scope, for checks
+// that run the kernels at each level with stl_simd_limit
+struct simd_level_scope
+{
+    stl_simd_level level = stl_simd_active();
+
+    ~simd_level_scope() { stl_simd_limit(level); }
+};
+
+// tetrahedron, counter clockwise seen from outside
+static void make_tetrahedron(stl& mesh)
+{
+    static const float vectors[] = {
+        0, 0, 0,    0, 1, 0,    1, 0, 0,
+        0, 0, 0,    1, 0, 0,    0, 0, 1,
+        0, 0, 0,    0, 0, 1,    0, 1, 0,
+        1, 0, 0,    0, 1, 0,    0, 0, 1
+    };
+    mesh.m_vectors.assign(std::begin(vectors), std::end(vectors));
+    mesh.calc_normals();
+}
+
+// unit cube as the stl format asks for it, counter clockwise seen from
+// outside with outward right hand normals. It must check as valid, need
+// no repair and have a volume of 1
+static void check_cube_topology()
+{
+    static const float corners[8][3] = {
+        { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+        { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+    };
+    static const int faces[12][3] = {
+        { 0, 2, 1 }, { 0, 3, 2 },   // bottom
+        { 4, 5, 6 }, { 4, 6, 7 },   // top
+        { 0, 1, 5 }, { 0, 5, 4 },   // front
+        { 2, 3, 7 }, { 2, 7, 6 },   // back
+        { 0, 4, 7 }, { 0, 7, 3 },   // left
+        { 1, 2, 6 }, { 1, 6, 5 }    // right
+    };
+
+    stl mesh;
+    for (auto& face : faces) {
+        for (auto corner : face) {
+            mesh.m_vectors.insert(mesh.m_vectors.end(), corners[corner], corners[corner] + 3);
+        }
+    }
+    mesh.calc_normals();
+    if (mesh.m_normals[2] != -1.0f || mesh.m_normals[2 * 3 + 2] != 1.0f) {
+        throw std::runtime_error("calc_normals does not point outwards.");
+    }
+
+    auto report = stl_check_topology(mesh);
+    if (report.flipped_normals != 0 || !report.is_valid()) {
+        throw std::runtime_error("stl_check_topology rejects the cube.");
+    }
+    auto repair = stl_repair_topology(mesh);
+    if (repair.triangles_flipped != 0) {
+        throw std::runtime_error("stl_repair_topology turns the cube over.");
+    }
+    auto metrics = stl_compute_metrics(mesh);
+    if (std::fabs(metrics.volume - 1.0) > 1e-9) {
+        throw std::runtime_error("the cube has a volume of " + std::to_string(metrics.volume) + ".");
+    }
+}
+
+// bounds of 16 vertices with a nan in the first and inf in others, at
+// every simd level and in both layouts. The non finite coordinates are
+// skipped, so the box is that of the finite ones wherever they are
+static void check_bounds_non_finite()
+{
+    const auto inf = std::numeric_limits<float>::infinity();
+    stl mesh;
+    for (auto i = 0; i < 16 * 3; ++i) {
+        mesh.m_vectors.push_back(static_cast<float>(i % 7) - 3.0f);
+    }
+    mesh.m_vectors[0] = std::numeric_limits<float>::quiet_NaN();
+    mesh.m_vectors[5 * 3 + 1] = inf;
+    mesh.m_vectors[9 * 3 + 2] = -inf;
+
+    stl_aabb expected = { { inf, inf, inf }, { -inf, -inf, -inf } };
+    for (size_t i = 0; i < mesh.m_vectors.size(); ++i) {
+        auto value = mesh.m_vectors[i];
+        if (std::isfinite(value)) {
+            expected.min[i % 3] = std::min(expected.min[i % 3], value);
+            expected.max[i % 3] = std::max(expected.max[i % 3], value);
+        }
+    }
+
+    simd_level_scope restore;
+    for (auto soa : { false, true }) {
+        if (soa) {
+            mesh.to_soa();
+        }
+        for (auto level : { stl_simd_scalar, stl_simd_sse, stl_simd_avx2 }) {
+            stl_simd_limit(level);
+            auto box = mesh.bounds();
+            for (auto ax = 0; ax < 3; ++ax) {
+                if (box.min[ax] != expected.min[ax] || box.max[ax] != expected.max[ax]) {
+                    throw std::runtime_error("axis " + std::to_string(ax) + " is wrong at level " +
+                        std::to_string(level) + (soa ? " with separate axes." : "."));
+                }
+            }
+        }
+    }
+}
+
+// every 4 bit color through stl_encode_attribute and stl_decode_attribute,
+// and colors through a binary stl file and back
+static void check_attribute_round_trip()
+{
+    for (auto value = 0; value < 0x1000; ++value) {
+        float rgb[3] = {
+            static_cast<float>((value >> 8) & 0x0F) / 15.0f,
+            static_cast<float>((value >> 4) & 0x0F) / 15.0f,
+            static_cast<float>(value & 0x0F) / 15.0f
+        };
+        float decoded[3];
+        if (!stl_decode_attribute(stl_encode_attribute(rgb), decoded) ||
+            decoded[0] != rgb[0] || decoded[1] != rgb[1] || decoded[2] != rgb[2]) {
+            throw std::runtime_error("color " + std::to_string(value) + " does not round trip.");
+        }
+    }
+    float none[3] = { -1.0f, 0.0f, 0.0f };
+    if (stl_decode_attribute(0, none) || none[0] != -1.0f) {
+        throw std::runtime_error("attribute 0 decodes as a color.");
+    }
+
+    scratch_file file("stl_test_colors.stl");
+    stl mesh;
+    make_tetrahedron(mesh);
+    const float colors[] = { 1, 0, 0,   0, 1, 0,   0, 0, 1,   1, 1, 1 };
+    mesh.m_rgb_color.assign(std::begin(colors), std::end(colors));
+    mesh.create_stl_binary(file.name.c_str());
+
+    stl colored;
+    colored.read_stl(file.name.c_str());
+    if (colored.m_rgb_color.size() != mesh.m_rgb_color.size() ||
+        !std::equal(colored.m_rgb_color.begin(), colored.m_rgb_color.end(), mesh.m_rgb_color.begin())) {
+        throw std::runtime_error("the colors change in a binary stl.");
+    }
+}
+
+// a row of triangles with a nan vertex in one of them
+// non finite coordinates are legal in a stl, the bvh must still build
+// and find the other triangles
+static void check_bvh_non_finite()
+{
+    const size_t triangles = 64;
+    stl mesh;
+    for (size_t tri = 0; tri < triangles; ++tri) {
+        auto x = static_cast<float>(tri);
+        float v[9] = { x, 0, 0, x + 1, 0, 0, x, 1, 0 };
+        mesh.m_vectors.insert(mesh.m_vectors.end(), v, v + 9);
+    }
+    mesh.m_vectors[10 * 9 + 3] = std::numeric_limits<float>::quiet_NaN();
+    mesh.calc_normals();
+
+    stl_bvh bvh;
+    bvh.build(mesh);
+
+    stl_ray ray = { { 40.25f, 0.25f, 1.0f }, { 0.0f, 0.0f, -1.0f } };
+    stl_ray_hit hit;
+    if (!bvh.intersect(ray, hit) || hit.triangle != 40) {
+        throw std::runtime_error("ray missed triangle 40.");
+    }
+}
+
+// the tetrahedron with a nan z in one triangle and an inf z in another
+// no plane can cut those, the slicer must skip them and still cut the
+// other triangles
+static void check_slicer_non_finite()
+{
+    stl mesh;
+    make_tetrahedron(mesh);
+    mesh.m_vectors[2] = std::numeric_limits<float>::quiet_NaN();
+    mesh.m_vectors[9 * 3 - 1] = std::numeric_limits<float>::infinity();
+
+    stl_slicer slicer;
+    slicer.slice(mesh, 0.1f);
+    if (slicer.m_layers.empty()) {
+        throw std::runtime_error("no layers.");
+    }
+    for (auto& layer : slicer.m_layers) {
+        if (layer.contours.empty()) {
+            throw std::runtime_error("no contour at z " + std::to_string(layer.z) + ".");
+        }
+    }
+}
+
+// a tetrahedron with a nan vertex, cached with m_cache_quantized set
+// a nan has no place in the quantized box, so the cache must keep the
+// exact floats and load the nan and every other coordinate back as is
+static void check_cache_non_finite()
+{
+    scratch_file file("stl_test_cache_nan.stl");
+    stl mesh;
+    make_tetrahedron(mesh);
+    mesh.m_vectors[4] = std::numeric_limits<float>::quiet_NaN();
+    mesh.create_stl_binary(file.name.c_str());
+
+    stl cached;
+    cached.m_cache_mode = stl_cache_update;
+    cached.m_cache_quantized = true;
+    cached.read_stl(file.name.c_str());
+    {
+        stl_cache cache;
+        if (!cache.open(stl_cache_name(file.name.c_str()).c_str()) || cache.quantized()) {
+            throw std::runtime_error("the cache was not written with exact floats.");
+        }
+    }
+    cached.read_stl(file.name.c_str());
+
+    if (cached.m_vectors.size() != mesh.m_vectors.size()) {
+        throw std::runtime_error("the cache lost triangles.");
+    }
+    for (size_t i = 0; i < mesh.m_vectors.size(); ++i) {
+        auto expected = mesh.m_vectors[i];
+        auto same = std::isnan(expected) ? std::isnan(cached.m_vectors[i]) : cached.m_vectors[i] == expected;
+        if (!same) {
+            throw std::runtime_error("coordinate " + std::to_string(i) + " changed in the cache.");
+        }
+    }
+}
+
+// round trip through stl_compact_mesh at every simd level, from a stl
+// and from a file. Zero, nan and inf normals must come back as 0 0 0,
+// the others as themselves. The nan x of the first vertex must not
+// leak into the box, so the other positions come back within a step.
+// 8 triangles run the 4 wide kernels
+static void check_compact_non_finite()
+{
+    const auto inf = std::numeric_limits<float>::infinity();
+    const auto nan = std::numeric_limits<float>::quiet_NaN();
+    const float normals[8][3] = {
+        { 1, 0, 0 }, { inf, 0, 0 }, { 0, 0, -inf }, { 0, 0, 0 },
+        { nan, 0, 1 }, { 0, -1, 0 }, { -inf, inf, 0 }, { 0, 0, -1 }
+    };
+    const float expected[8][3] = {
+        { 1, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+        { 0, 0, 0 }, { 0, -1, 0 }, { 0, 0, 0 }, { 0, 0, -1 }
+    };
+
+    stl mesh;
+    for (auto& normal : normals) {
+        for (auto corner = 0; corner < 9; ++corner) {
+            mesh.m_vectors.push_back(static_cast<float>(corner % 3 == corner / 3));
+        }
+        mesh.m_normals.insert(mesh.m_normals.end(), normal, normal + 3);
+    }
+    mesh.m_num_triangles = 8;
+    mesh.m_vectors[0] = nan;
+
+    scratch_file file("stl_test_compact_nan.stl");
+    mesh.create_stl_binary(file.name.c_str());
+
+    simd_level_scope restore;
+    for (auto level : { stl_simd_scalar, stl_simd_sse, stl_simd_avx2 }) {
+        stl_simd_limit(level);
+        for (auto from_file : { false, true }) {
+            stl_compact_mesh compact;
+            if (from_file) {
+                compact.read_stl(file.name.c_str(), stl_position_quantized16);
+            }
+            else {
+                compact.encode(mesh, stl_position_quantized16);
+            }
+            stl decoded;
+            compact.decode(decoded);
+
+            auto where = " at level " + std::to_string(level) + (from_file ? " from the file." : ".");
+            for (auto i = 0; i < 8 * 3; ++i) {
+                if (std::fabs(decoded.m_normals[i] - expected[i / 3][i % 3]) > 1e-4f) {
+                    throw std::runtime_error("normal " + std::to_string(i / 3) + " decodes wrong" + where);
+                }
+            }
+            for (size_t i = 1; i < mesh.m_vectors.size(); ++i) {
+                if (!(std::fabs(decoded.m_vectors[i] - mesh.m_vectors[i]) < 1e-4f)) {
+                    throw std::runtime_error("coordinate " + std::to_string(i) + " decodes wrong" + where);
+                }
+            }
+        }
+    }
+}
+
+// the header of a stl file is the given text padded with 0
+static void check_header(const stl& mesh, const char* text)
+{
+    char expected[STL_HEADER_SIZE] = { 0 };
+    memcpy(expected, text, strlen(text));
+    if (memcmp(mesh.m_header, expected, STL_HEADER_SIZE) != 0) {
+        throw std::runtime_error(std::string("the header is not \"") + text + "\" padded with 0.");
+    }
+}
+
+// stl_writer with a header shorter than STL_HEADER_SIZE
+// only the text up to its 0 is copied, the rest of the header is 0
+static void check_writer_short_header()
+{
+    scratch_file file("stl_test_writer.stl");
+    stl mesh;
+    make_tetrahedron(mesh);
+    {
+        stl_writer out;
+        out.open(file.name.c_str(), "plate 7");
+        out.add(mesh);
+        out.close();
+    }
+
+    stl written;
+    written.read_stl(file.name.c_str());
+    check_header(written, "plate 7");
+    if (written.m_num_triangles != 4) {
+        throw std::runtime_error("the file has " + std::to_string(written.m_num_triangles) + " triangles.");
+    }
+}
+
+// stl_merge of 2 tetrahedra, the second moved up, with a short header
+static void check_merge_short_header()
+{
+    scratch_file part("stl_test_merge_part.stl");
+    scratch_file merged("stl_test_merged.stl");
+    stl mesh;
+    make_tetrahedron(mesh);
+    mesh.create_stl_binary(part.name.c_str());
+
+    std::vector<stl_merge_part> parts(2);
+    parts[0].name = parts[1].name = part.name;
+    parts[1].matrix[11] = 2.0f;
+    auto triangles = stl_merge(parts, merged.name.c_str(), "plate 7");
+
+    stl written;
+    written.read_stl(merged.name.c_str());
+    check_header(written, "plate 7");
+    if (triangles != 8 || written.m_num_triangles != 8) {
+        throw std::runtime_error("the file has " + std::to_string(written.m_num_triangles) + " triangles.");
+    }
+}
+
+struct test_case
+{
+    const char* name;
+    void (*run)();
+};
+
+static const test_case tests[] = {
+    { "color attributes", check_attribute_round_trip },
+    { "topology of the unit cube", check_cube_topology },
+    { "bounds with nan and inf vertices", check_bounds_non_finite },
+    { "stl_bvh with a nan vertex", check_bvh_non_finite },
+    { "stl_slicer with nan and inf z", check_slicer_non_finite },
+    { "stl_cache with a nan vertex", check_cache_non_finite },
+    { "compact storage with nan and inf", check_compact_non_finite },
+    { "stl_writer with a short header", check_writer_short_header },
+    { "stl_merge with a short header", check_merge_short_header },
+};
+
+int main()
+{
+    auto failed = 0;
+    for (auto& test : tests) {
+        try {
+            test.run();
+            std::cout << "ok      " << test.name << "\n";
+        } catch (const std::exception& ex) {
+            std::cout << "FAILED  " << test.name << ": " << ex.what() << "\n";
+            ++failed;
+        }
+    }
+    std::cout << failed << " of " << std::size(tests) << " checks failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
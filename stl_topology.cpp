@@ -0,0 +1,505 @@
+// stl_topology.cpp : topology checks and repair of a stl
+//
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "stl_indexed_mesh.h"
+#include "stl_parallel.h"
+#include "stl_topology.h"
+
+namespace
+{
+    constexpr uint32_t NO_CORNER = 0xFFFFFFFFU;
+    constexpr size_t SKIP_SHARD = STL_TOPOLOGY_SHARDS;
+
+    inline uint64_t mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 33);
+    }
+
+    inline size_t table_capacity(size_t entries)
+    {
+        size_t capacity = 16;
+        while (capacity < entries * 2) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    inline uint32_t next_corner(uint32_t corner)
+    {
+        return corner % VERTEX_PER_TRIANGLE == VERTEX_PER_TRIANGLE - 1 ? corner - (VERTEX_PER_TRIANGLE - 1) : corner + 1;
+    }
+
+    // shard_ids
+    // group the ids 0 .. count - 1 by shard_of(id), in id order within a
+    // shard. shard_of returns SKIP_SHARD for ids that are left out.
+    // the ids of shard s are ids[starts[s] .. starts[s + 1] - 1]
+    template <class ShardOf>
+    void shard_ids(size_t count, unsigned threads, ShardOf shard_of,
+        std::vector<uint32_t>& ids, std::vector<size_t>& starts)
+    {
+        auto block_size = STL_TOPOLOGY_BLOCK_TRIANGLES * VERTEX_PER_TRIANGLE;
+        auto blocks = (count + block_size - 1) / block_size;
+        std::vector<size_t> offsets(blocks * STL_TOPOLOGY_SHARDS, 0);
+
+        stl_parallel_for(blocks, threads, [&](size_t block) {
+            auto counts = &offsets[block * STL_TOPOLOGY_SHARDS];
+            auto end = std::min(count, (block + 1) * block_size);
+            for (auto id = block * block_size; id < end; ++id) {
+                auto shard = shard_of(static_cast<uint32_t>(id));
+                if (shard != SKIP_SHARD) {
+                    counts[shard]++;
+                }
+            }
+        });
+
+        // turn the counts into the first slot of each block in each shard
+        starts.assign(STL_TOPOLOGY_SHARDS + 1, 0);
+        size_t total = 0;
+        for (size_t shard = 0; shard < STL_TOPOLOGY_SHARDS; ++shard) {
+            starts[shard] = total;
+            for (size_t block = 0; block < blocks; ++block) {
+                auto n = offsets[block * STL_TOPOLOGY_SHARDS + shard];
+                offsets[block * STL_TOPOLOGY_SHARDS + shard] = total;
+                total += n;
+            }
+        }
+        starts[STL_TOPOLOGY_SHARDS] = total;
+
+        ids.resize(total);
+        stl_parallel_for(blocks, threads, [&](size_t block) {
+            auto slots = &offsets[block * STL_TOPOLOGY_SHARDS];
+            auto end = std::min(count, (block + 1) * block_size);
+            for (auto id = block * block_size; id < end; ++id) {
+                auto shard = shard_of(static_cast<uint32_t>(id));
+                if (shard != SKIP_SHARD) {
+                    ids[slots[shard]++] = static_cast<uint32_t>(id);
+                }
+            }
+        });
+    }
+
+    // counts of the edges of 1 shard
+    struct edge_counts
+    {
+        size_t boundary = 0;
+        size_t non_manifold = 0;
+        size_t inconsistent = 0;
+    };
+
+    // the welded triangles of a stl and the passes over them
+    class topology
+    {
+    public:
+        std::vector<float> m_vertices;
+        std::vector<uint32_t> m_indices;
+        std::vector<char> m_skip;
+        unsigned m_threads = 1;
+
+        size_t triangles() const { return m_indices.size() / VERTEX_PER_TRIANGLE; }
+        size_t find_degenerates();
+        size_t find_duplicates();
+        edge_counts find_edges(std::vector<uint32_t>* neighbors) const;
+
+    private:
+        uint64_t edge_key(uint32_t corner) const
+        {
+            auto a = m_indices[corner];
+            auto b = m_indices[next_corner(corner)];
+            return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+        }
+
+        void sorted_triangle(uint32_t t, uint32_t v[3]) const
+        {
+            memcpy(v, &m_indices[static_cast<size_t>(t) * VERTEX_PER_TRIANGLE], VERTEX_PER_TRIANGLE * sizeof(uint32_t));
+            std::sort(v, v + VERTEX_PER_TRIANGLE);
+        }
+    };
+
+    // find_degenerates
+    // skip the triangles with 2 equal vertices or no area
+    size_t topology::find_degenerates()
+    {
+        auto n = triangles();
+        m_skip.assign(n, 0);
+        std::vector<size_t> counts((n + STL_TOPOLOGY_BLOCK_TRIANGLES - 1) / STL_TOPOLOGY_BLOCK_TRIANGLES, 0);
+        stl_parallel_for(counts.size(), m_threads, [&](size_t block) {
+            auto end = std::min(n, (block + 1) * STL_TOPOLOGY_BLOCK_TRIANGLES);
+            for (auto t = block * STL_TOPOLOGY_BLOCK_TRIANGLES; t < end; ++t) {
+                auto tri = &m_indices[t * VERTEX_PER_TRIANGLE];
+                auto degenerate = tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2];
+                if (!degenerate) {
+                    const float* p[3];
+                    for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                        p[i] = &m_vertices[static_cast<size_t>(tri[i]) * AXIS_PER_VERTEX];
+                    }
+                    double u[3];
+                    double v[3];
+                    for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                        u[ax] = static_cast<double>(p[1][ax]) - p[0][ax];
+                        v[ax] = static_cast<double>(p[2][ax]) - p[0][ax];
+                    }
+                    degenerate = u[1] * v[2] - u[2] * v[1] == 0.0 && u[2] * v[0] - u[0] * v[2] == 0.0 &&
+                        u[0] * v[1] - u[1] * v[0] == 0.0;
+                }
+                if (degenerate) {
+                    m_skip[t] = 1;
+                    counts[block]++;
+                }
+            }
+        });
+
+        size_t total = 0;
+        for (auto count : counts) {
+            total += count;
+        }
+        return total;
+    }
+
+    // find_duplicates
+    // skip the triangles whose sorted vertices match an earlier triangle
+    size_t topology::find_duplicates()
+    {
+        auto shard_of = [&](uint32_t t) {
+            if (m_skip[t]) {
+                return SKIP_SHARD;
+            }
+            uint32_t v[3];
+            sorted_triangle(t, v);
+            return static_cast<size_t>(mix((static_cast<uint64_t>(v[0]) << 32 | v[1]) ^ mix(v[2])) % STL_TOPOLOGY_SHARDS);
+        };
+
+        std::vector<uint32_t> ids;
+        std::vector<size_t> starts;
+        shard_ids(triangles(), m_threads, shard_of, ids, starts);
+
+        std::vector<size_t> counts(STL_TOPOLOGY_SHARDS, 0);
+        stl_parallel_for(STL_TOPOLOGY_SHARDS, m_threads, [&](size_t shard) {
+            auto first = starts[shard];
+            auto size = starts[shard + 1] - first;
+            std::vector<uint32_t> table(table_capacity(size), NO_CORNER);
+            auto mask = table.size() - 1;
+            for (auto i = first; i < first + size; ++i) {
+                auto t = ids[i];
+                uint32_t v[3];
+                sorted_triangle(t, v);
+                auto slot = static_cast<size_t>(mix(mix((static_cast<uint64_t>(v[0]) << 32 | v[1]) ^ v[2]))) & mask;
+                for (;; slot = (slot + 1) & mask) {
+                    if (table[slot] == NO_CORNER) {
+                        table[slot] = t;
+                        break;
+                    }
+                    uint32_t w[3];
+                    sorted_triangle(table[slot], w);
+                    if (v[0] == w[0] && v[1] == w[1] && v[2] == w[2]) {
+                        // the ids are in order so the first triangle is kept
+                        m_skip[t] = 1;
+                        counts[shard]++;
+                        break;
+                    }
+                }
+            }
+        });
+
+        size_t total = 0;
+        for (auto count : counts) {
+            total += count;
+        }
+        return total;
+    }
+
+    // find_edges
+    // count the triangles on each edge and the ones that use it from the
+    // lower vertex to the higher one. neighbors, if given, is set to the
+    // corner across the edge of each corner for edges of 2 triangles
+    edge_counts topology::find_edges(std::vector<uint32_t>* neighbors) const
+    {
+        auto shard_of = [&](uint32_t corner) {
+            if (m_skip[corner / VERTEX_PER_TRIANGLE]) {
+                return SKIP_SHARD;
+            }
+            return static_cast<size_t>(mix(edge_key(corner)) % STL_TOPOLOGY_SHARDS);
+        };
+
+        std::vector<uint32_t> ids;
+        std::vector<size_t> starts;
+        shard_ids(m_indices.size(), m_threads, shard_of, ids, starts);
+
+        if (neighbors != nullptr) {
+            neighbors->assign(m_indices.size(), NO_CORNER);
+        }
+
+        struct edge
+        {
+            uint64_t key;
+            uint32_t first;
+            uint32_t second;
+            uint32_t count;
+            uint32_t forward;
+        };
+
+        std::vector<edge_counts> counts(STL_TOPOLOGY_SHARDS);
+        stl_parallel_for(STL_TOPOLOGY_SHARDS, m_threads, [&](size_t shard) {
+            auto first = starts[shard];
+            auto size = starts[shard + 1] - first;
+
+            // a closed mesh has 2 corners per edge but an open one or a
+            // triangle soup up to 1, so the table has room for every corner
+            std::vector<edge> table(table_capacity(size), edge{ 0, NO_CORNER, NO_CORNER, 0, 0 });
+            auto mask = table.size() - 1;
+            for (auto i = first; i < first + size; ++i) {
+                auto corner = ids[i];
+                auto key = edge_key(corner);
+                auto forward = m_indices[corner] < m_indices[next_corner(corner)] ? 1U : 0U;
+                auto slot = static_cast<size_t>(mix(mix(key))) & mask;
+                for (;; slot = (slot + 1) & mask) {
+                    auto& e = table[slot];
+                    if (e.count == 0) {
+                        e = edge{ key, corner, NO_CORNER, 1, forward };
+                        break;
+                    }
+                    if (e.key == key) {
+                        if (e.count == 1) {
+                            e.second = corner;
+                        }
+                        e.count++;
+                        e.forward += forward;
+                        break;
+                    }
+                }
+            }
+
+            auto& c = counts[shard];
+            for (auto& e : table) {
+                if (e.count == 1) {
+                    c.boundary++;
+                }
+                else if (e.count > 2) {
+                    c.non_manifold++;
+                }
+                else if (e.count == 2) {
+                    if (e.forward != 1) {
+                        c.inconsistent++;
+                    }
+                    if (neighbors != nullptr) {
+                        (*neighbors)[e.first] = e.second;
+                        (*neighbors)[e.second] = e.first;
+                    }
+                }
+            }
+        });
+
+        edge_counts total;
+        for (auto& c : counts) {
+            total.boundary += c.boundary;
+            total.non_manifold += c.non_manifold;
+            total.inconsistent += c.inconsistent;
+        }
+        return total;
+    }
+
+    // weld a stl into a topology
+    void load(topology& topo, const stl& mesh, float epsilon, unsigned threads)
+    {
+        stl_indexed_mesh indexed;
+        indexed.build(mesh, epsilon, threads);
+        topo.m_vertices = std::move(indexed.m_vertices);
+        topo.m_indices = std::move(indexed.m_indices);
+        topo.m_threads = threads;
+    }
+}
+
+// stl_check_topology
+stl_topology_report stl_check_topology(const stl& mesh, float epsilon, unsigned threads)
+{
+    threads = stl_thread_count(threads);
+    topology topo;
+    load(topo, mesh, epsilon, threads);
+
+    stl_topology_report report = {};
+    report.triangles = topo.triangles();
+    report.vertices = topo.m_vertices.size() / AXIS_PER_VERTEX;
+    report.degenerate_triangles = topo.find_degenerates();
+    report.duplicate_triangles = topo.find_duplicates();
+
+    auto edges = topo.find_edges(nullptr);
+    report.boundary_edges = edges.boundary;
+    report.non_manifold_edges = edges.non_manifold;
+    report.inconsistent_edges = edges.inconsistent;
+
+    // the stored normals against the winding of the triangles
+    // the right hand normal u x w sees the triangle counter clockwise
+    auto n = topo.triangles();
+    if (mesh.m_normals.size() >= n * AXIS_PER_VERTEX) {
+        std::vector<size_t> counts((n + STL_TOPOLOGY_BLOCK_TRIANGLES - 1) / STL_TOPOLOGY_BLOCK_TRIANGLES, 0);
+        stl_parallel_for(counts.size(), threads, [&](size_t block) {
+            auto end = std::min(n, (block + 1) * STL_TOPOLOGY_BLOCK_TRIANGLES);
+            for (auto t = block * STL_TOPOLOGY_BLOCK_TRIANGLES; t < end; ++t) {
+                if (topo.m_skip[t]) {
+                    continue;
+                }
+                float buffer[9];
+                auto v = mesh.triangle_vertices(t, buffer);
+                double u[3];
+                double w[3];
+                for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                    u[ax] = static_cast<double>(v[3 + ax]) - v[ax];
+                    w[ax] = static_cast<double>(v[6 + ax]) - v[ax];
+                }
+                auto normal = &mesh.m_normals[t * AXIS_PER_VERTEX];
+                auto d = normal[0] * (u[1] * w[2] - u[2] * w[1]) + normal[1] * (u[2] * w[0] - u[0] * w[2]) +
+                    normal[2] * (u[0] * w[1] - u[1] * w[0]);
+                if (d < 0.0) {
+                    counts[block]++;
+                }
+            }
+        });
+        for (auto count : counts) {
+            report.flipped_normals += count;
+        }
+    }
+    return report;
+}
+
+// stl_repair_topology
+stl_repair_report stl_repair_topology(stl& mesh, float epsilon, unsigned threads)
+{
+    threads = stl_thread_count(threads);
+    topology topo;
+    load(topo, mesh, epsilon, threads);
+
+    stl_repair_report report = {};
+    report.degenerate_removed = topo.find_degenerates();
+    report.duplicates_removed = topo.find_duplicates();
+
+    // keep the colors when each triangle has one
+    auto n = topo.triangles();
+    auto colors = mesh.m_rgb_color.size() == n * AXIS_PER_VERTEX && n > 0;
+    std::vector<float> rgb;
+
+    // drop the skipped triangles
+    size_t kept = 0;
+    for (size_t t = 0; t < n; ++t) {
+        if (topo.m_skip[t]) {
+            continue;
+        }
+        if (kept != t) {
+            memcpy(&topo.m_indices[kept * VERTEX_PER_TRIANGLE], &topo.m_indices[t * VERTEX_PER_TRIANGLE], VERTEX_PER_TRIANGLE * sizeof(uint32_t));
+        }
+        if (colors) {
+            rgb.insert(rgb.end(), &mesh.m_rgb_color[t * AXIS_PER_VERTEX], &mesh.m_rgb_color[t * AXIS_PER_VERTEX] + AXIS_PER_VERTEX);
+        }
+        kept++;
+    }
+    topo.m_indices.resize(kept * VERTEX_PER_TRIANGLE);
+    topo.m_skip.assign(kept, 0);
+    n = kept;
+
+    std::vector<uint32_t> neighbors;
+    topo.find_edges(&neighbors);
+
+    // walk each component from its first triangle and turn the
+    // neighbors that use a shared edge in the same direction
+    const uint32_t unvisited = 0xFFFFFFFFU;
+    std::vector<uint32_t> component(n, unvisited);
+    std::vector<char> flip(n, 0);
+    std::vector<double> volumes;
+    std::vector<uint32_t> stack;
+    for (size_t seed = 0; seed < n; ++seed) {
+        if (component[seed] != unvisited) {
+            continue;
+        }
+        auto id = static_cast<uint32_t>(volumes.size());
+        volumes.push_back(0.0);
+        component[seed] = id;
+        stack.push_back(static_cast<uint32_t>(seed));
+        while (!stack.empty()) {
+            auto t = stack.back();
+            stack.pop_back();
+            for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+                auto corner = t * VERTEX_PER_TRIANGLE + i;
+                auto other = neighbors[corner];
+                if (other == NO_CORNER) {
+                    continue;
+                }
+                auto u = other / VERTEX_PER_TRIANGLE;
+                if (component[u] != unvisited) {
+                    continue;
+                }
+                auto same = topo.m_indices[corner] == topo.m_indices[other];
+                flip[u] = static_cast<char>(same != (flip[t] != 0));
+                component[u] = id;
+                stack.push_back(u);
+            }
+        }
+    }
+    report.components = volumes.size();
+
+    // signed volume of each component about the first vertex of the stl
+    // it is positive when the triangles are counter clockwise seen from
+    // outside, which is the winding calc_normals turns into outward normals
+    auto origin = topo.m_vertices.data();
+    for (size_t t = 0; t < n; ++t) {
+        double p[3][3];
+        for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+            for (auto ax = 0; ax < AXIS_PER_VERTEX; ++ax) {
+                p[i][ax] = static_cast<double>(topo.m_vertices[static_cast<size_t>(topo.m_indices[t * VERTEX_PER_TRIANGLE + i]) * AXIS_PER_VERTEX + ax]) - origin[ax];
+            }
+        }
+        auto volume = p[0][0] * (p[1][1] * p[2][2] - p[1][2] * p[2][1]) - p[0][1] * (p[1][0] * p[2][2] - p[1][2] * p[2][0]) +
+            p[0][2] * (p[1][0] * p[2][1] - p[1][1] * p[2][0]);
+        volumes[component[t]] += flip[t] ? -volume : volume;
+    }
+
+    // write the triangles back with the welded positions
+    auto soa = mesh.m_layout == stl_soa;
+    auto corners = n * VERTEX_PER_TRIANGLE;
+    if (soa) {
+        mesh.m_vectors.clear();
+        mesh.m_x.resize(corners);
+        mesh.m_y.resize(corners);
+        mesh.m_z.resize(corners);
+    }
+    else {
+        mesh.m_x.clear();
+        mesh.m_y.clear();
+        mesh.m_z.clear();
+        mesh.m_vectors.resize(corners * AXIS_PER_VERTEX);
+    }
+    for (size_t t = 0; t < n; ++t) {
+        auto turn = (flip[t] != 0) != (volumes[component[t]] < 0.0);
+        if (turn) {
+            report.triangles_flipped++;
+        }
+        for (auto i = 0; i < VERTEX_PER_TRIANGLE; ++i) {
+            auto from = turn && i > 0 ? VERTEX_PER_TRIANGLE - i : i;
+            auto v = &topo.m_vertices[static_cast<size_t>(topo.m_indices[t * VERTEX_PER_TRIANGLE + from]) * AXIS_PER_VERTEX];
+            auto corner = t * VERTEX_PER_TRIANGLE + i;
+            if (soa) {
+                mesh.m_x[corner] = v[0];
+                mesh.m_y[corner] = v[1];
+                mesh.m_z[corner] = v[2];
+            }
+            else {
+                memcpy(&mesh.m_vectors[corner * AXIS_PER_VERTEX], v, AXIS_PER_VERTEX * sizeof(float));
+            }
+        }
+    }
+
+    mesh.m_num_triangles = static_cast<uint32_t>(n);
+    if (colors) {
+        mesh.m_rgb_color.assign(rgb.begin(), rgb.end());
+    }
+    else {
+        mesh.m_rgb_color.clear();
+    }
+    mesh.calc_normals();
+    return report;
+}
@@ -0,0 +1,62 @@
+// stl_topology.h : topology checks and repair of a stl
+//
+
+#ifndef STL_TOPOLOGY_H
+#define STL_TOPOLOGY_H
+
+#include <cstdint>
+
+#include "stl.h"
+
+constexpr size_t STL_TOPOLOGY_SHARDS = 256;
+constexpr size_t STL_TOPOLOGY_BLOCK_TRIANGLES = 1U << 16;
+
+// problems found in the welded triangles of a stl
+// a degenerate triangle has 2 equal vertices or no area and is left
+// out of the other counts. A duplicate has the same 3 vertices as an
+// earlier triangle, in any order. Edges are counted once each.
+struct stl_topology_report
+{
+    size_t triangles;
+    size_t vertices;
+    size_t degenerate_triangles;
+    size_t duplicate_triangles;
+    size_t boundary_edges;          // 1 triangle
+    size_t non_manifold_edges;      // more than 2 triangles
+    size_t inconsistent_edges;      // 2 triangles that use it in the same direction
+    size_t flipped_normals;         // m_normals points against the winding
+
+    bool is_closed() const { return boundary_edges == 0 && non_manifold_edges == 0; }
+    bool is_valid() const
+    {
+        return is_closed() && degenerate_triangles == 0 && duplicate_triangles == 0 &&
+            inconsistent_edges == 0 && flipped_normals == 0;
+    }
+};
+
+// what stl_repair_topology changed
+struct stl_repair_report
+{
+    size_t degenerate_removed;
+    size_t duplicates_removed;
+    size_t triangles_flipped;
+    size_t components;              // sets of triangles joined by manifold edges
+};
+
+// stl_check_topology
+// weld the vertices (see stl_indexed_mesh) and put every edge into a
+// hash table. The edges and triangles are split by hash into shards
+// that are counted on the worker threads, so the work is linear in the
+// triangles and the report does not depend on the thread count.
+stl_topology_report stl_check_topology(const stl& mesh, float epsilon = 0.0f, unsigned threads = 0);
+
+// stl_repair_topology
+// remove the degenerate and duplicate triangles, turn the triangles of
+// each component to the winding of its first triangle, across manifold
+// edges, and then turn the component over if its signed volume is
+// negative. The triangles get the welded positions and calc_normals is
+// called, so the normals of closed components point outwards. Colors
+// are kept when every triangle has one.
+stl_repair_report stl_repair_topology(stl& mesh, float epsilon = 0.0f, unsigned threads = 0);
+
+#endif
@@ -0,0 +1,175 @@
+// stl_writer.cpp : write binary stl files a triangle or a batch at a time
+//
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "stl_simd.h"
+#include "stl_writer.h"
+
+namespace
+{
+    constexpr size_t FLOATS_PER_TRIANGLE = VERTEX_PER_TRIANGLE * AXIS_PER_VERTEX;
+
+    // triangles per stl_simd_normals call when add calculates the normals
+    constexpr size_t NORMALS_BATCH = 1024;
+}
+
+// open
+// write the header and a count of 0 that close replaces
+void stl_writer::open(const char* name, const char* header, size_t buffer_triangles)
+{
+    close();
+    m_name = name;
+    m_file.open(name, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!m_file.is_open()) {
+        throw std::runtime_error(std::string("Unable to open stl output file ") + name + ".");
+    }
+
+    char buffer[STL_HEADER_SIZE] = { 0 };
+    if (header != nullptr) {
+        memcpy(buffer, header, strnlen(header, STL_HEADER_SIZE));
+    }
+    uint32_t count = 0;
+    m_file.write(buffer, STL_HEADER_SIZE);
+    m_file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    m_buffer.resize(std::max<size_t>(buffer_triangles, 1) * STL_TRIANGLE_SIZE);
+    m_buffered = 0;
+    m_triangles = 0;
+    if (!m_file) {
+        m_file.close();
+        throw std::runtime_error(std::string("Unable to write stl output file ") + name + ".");
+    }
+}
+
+// close
+// write the buffered records and the triangle count
+void stl_writer::close()
+{
+    if (!m_file.is_open()) {
+        return;
+    }
+
+    try {
+        flush();
+        auto count = static_cast<uint32_t>(m_triangles);
+        m_file.seekp(STL_HEADER_SIZE);
+        m_file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    }
+    catch (...) {
+        m_file.close();
+        throw;
+    }
+
+    auto ok = static_cast<bool>(m_file);
+    m_file.close();
+    m_buffer.clear();
+    m_buffer.shrink_to_fit();
+    if (!ok) {
+        throw std::runtime_error(std::string("Unable to write stl output file ") + m_name + ".");
+    }
+}
+
+stl_writer::~stl_writer()
+{
+    try {
+        close();
+    }
+    catch (...) {
+    }
+}
+
+// next_record
+// room for one more record, the buffer is written when it is full
+char* stl_writer::next_record()
+{
+    if (!m_file.is_open()) {
+        throw std::runtime_error("stl output file is not open.");
+    }
+    if (m_triangles >= UINT32_MAX) {
+        throw std::runtime_error("Too many triangles for a stl file.");
+    }
+    if ((m_buffered + 1) * STL_TRIANGLE_SIZE > m_buffer.size()) {
+        flush();
+    }
+    ++m_triangles;
+    return &m_buffer[m_buffered++ * STL_TRIANGLE_SIZE];
+}
+
+// flush
+void stl_writer::flush()
+{
+    if (m_buffered == 0) {
+        return;
+    }
+    m_file.write(m_buffer.data(), static_cast<std::streamsize>(m_buffered * STL_TRIANGLE_SIZE));
+    m_buffered = 0;
+    if (!m_file) {
+        throw std::runtime_error(std::string("Unable to write stl output file ") + m_name + ".");
+    }
+}
+
+// add
+// a single triangle
+void stl_writer::add(const float normal[3], const float vertices[9], uint16_t attribute)
+{
+    float calculated[AXIS_PER_VERTEX];
+    if (normal == nullptr) {
+        stl_simd_normals(vertices, calculated, 1);
+        normal = calculated;
+    }
+    stl_pack_triangle(next_record(), normal, vertices, attribute);
+}
+
+// add
+// a batch of triangles in the layout of stl::m_vectors, m_normals and
+// m_rgb_color
+void stl_writer::add(const float* vectors, const float* normals, size_t count, const float* rgb_color)
+{
+    float calculated[NORMALS_BATCH * AXIS_PER_VERTEX];
+    for (size_t first = 0; first < count; first += NORMALS_BATCH) {
+        auto n = std::min(NORMALS_BATCH, count - first);
+        auto v = vectors + first * FLOATS_PER_TRIANGLE;
+        const float* nv = calculated;
+        if (normals != nullptr) {
+            nv = normals + first * AXIS_PER_VERTEX;
+        }
+        else {
+            stl_simd_normals(v, calculated, n);
+        }
+        for (size_t t = 0; t < n; ++t) {
+            auto attribute = rgb_color != nullptr ? stl_encode_attribute(&rgb_color[(first + t) * AXIS_PER_VERTEX]) : uint16_t(0);
+            stl_pack_triangle(next_record(), &nv[t * AXIS_PER_VERTEX], &v[t * FLOATS_PER_TRIANGLE], attribute);
+        }
+    }
+}
+
+// add
+// triangles from stl_stream
+void stl_writer::add(const stl_triangle* triangles, size_t count)
+{
+    for (size_t t = 0; t < count; ++t) {
+        stl_pack_triangle(next_record(), triangles[t].normal, triangles[t].vertices, triangles[t].attribute);
+    }
+}
+
+// add
+// the triangles of a stl with the colors it has, as create_stl_binary
+// writes them
+void stl_writer::add(const stl& mesh)
+{
+    if (mesh.m_num_triangles * 3LL != mesh.m_normals.size() || mesh.num_vertices() * AXIS_PER_VERTEX != mesh.m_normals.size() * 3LL) {
+        throw std::runtime_error("Invalid stl data.");
+    }
+
+    float buffer[FLOATS_PER_TRIANGLE];
+    for (size_t triangle = 0; triangle < mesh.m_num_triangles; ++triangle) {
+        uint16_t attribute = 0;
+        auto rgb_index = triangle * AXIS_PER_VERTEX;
+        if (rgb_index + 2 < mesh.m_rgb_color.size()) {
+            attribute = stl_encode_attribute(&mesh.m_rgb_color[rgb_index]);
+        }
+        stl_pack_triangle(next_record(), &mesh.m_normals[triangle * AXIS_PER_VERTEX], mesh.triangle_vertices(triangle, buffer), attribute);
+    }
+}
@@ -0,0 +1,69 @@
+// stl_writer.h : write binary stl files a triangle or a batch at a time
+//
+
+#ifndef STL_WRITER_H
+#define STL_WRITER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "stl.h"
+#include "stl_stream.h"
+
+// stl_writer
+// append triangles to a binary stl file as they are produced
+// the records are packed into a fixed size buffer that is written when
+// it is full, and close goes back to write the triangle count after
+// the header, so memory use does not depend on the size of the file
+//
+//  stl_writer out;
+//  out.open(name);
+//  for (...) {
+//      out.add(normal, vertices);
+//  }
+//  out.close();
+class stl_writer
+{
+public:
+    stl_writer() = default;
+    ~stl_writer();
+
+    stl_writer(const stl_writer&) = delete;
+    stl_writer& operator=(const stl_writer&) = delete;
+
+    // header may be null for an empty header, it is copied up to its
+    // terminating 0 or STL_HEADER_SIZE characters and padded with 0
+    // throws if the file can not be created or written
+    void open(const char* name, const char* header = nullptr, size_t buffer_triangles = STL_WRITE_BLOCK_TRIANGLES);
+    void close();
+
+    // normal may be null to calculate it
+    void add(const float normal[3], const float vertices[9], uint16_t attribute = 0);
+
+    // count triangles of 9 floats, normals and rgb_color may be null
+    // for calculated normals and no colors
+    void add(const float* vectors, const float* normals, size_t count, const float* rgb_color = nullptr);
+    void add(const stl_triangle* triangles, size_t count);
+
+    // all the triangles of a stl
+    void add(const stl& mesh);
+
+    bool is_open() const { return m_file.is_open(); }
+    uint64_t triangles_written() const { return m_triangles; }
+
+private:
+    std::string m_name;
+    std::ofstream m_file;
+    uint64_t m_triangles = 0;
+
+    // packed records waiting to be written
+    std::vector<char> m_buffer;
+    size_t m_buffered = 0;
+
+    char* next_record();
+    void flush();
+};
+
+#endif